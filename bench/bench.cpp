@@ -0,0 +1,53 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+
+void BenchmarkRunner::add(const std::string& name, Body body) {
+    cases.emplace_back(name, std::move(body));
+}
+
+std::vector<BenchmarkRunner::Result> BenchmarkRunner::run(const std::string& filter, double min_seconds) const {
+    std::vector<Result> results;
+    for (const auto& [name, body] : cases) {
+        if (name.find(filter) == std::string::npos) {
+            continue;
+        }
+        // One untimed call warms caches and lazily built state
+        body(1);
+        size_t iterations = 1;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            body(iterations);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= min_seconds || iterations >= (size_t(1) << 40)) {
+                results.push_back({name, iterations, elapsed.count() * 1e9 / static_cast<double>(iterations)});
+                break;
+            }
+            iterations *= 2;
+        }
+    }
+    return results;
+}
+
+void write_json(std::ostream& out, const std::vector<BenchmarkRunner::Result>& results) {
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkRunner::Result& result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << std::fixed << std::setprecision(1)
+            << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+            << ", \"ns_per_op\": " << result.ns_per_op
+            << ", \"ops_per_second\": " << 1e9 / result.ns_per_op << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void remove_database_files(const std::string& data_file) {
+    for (const char* suffix : {"", "-wal", "-journal"}) {
+        std::remove((data_file + suffix).c_str());
+    }
+}
@@ -0,0 +1,46 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef SQLITE_BENCH_H
+#define SQLITE_BENCH_H
+#pragma once
+
+// Self-contained microbenchmark harness. A case's body runs the measured
+// operation the given number of times; the runner doubles the count until
+// one run takes at least the minimum time and reports that run.
+class BenchmarkRunner {
+public:
+    using Body = std::function<void(size_t iterations)>;
+
+    struct Result {
+        std::string name;
+        uint64_t iterations;
+        double ns_per_op;
+    };
+
+    void add(const std::string& name, Body body);
+    // Runs the cases whose name contains filter
+    std::vector<Result> run(const std::string& filter, double min_seconds) const;
+
+private:
+    std::vector<std::pair<std::string, Body>> cases;
+};
+
+void register_micro_benchmarks(BenchmarkRunner& runner, const std::string& data_file);
+void write_json(std::ostream& out, const std::vector<BenchmarkRunner::Result>& results);
+
+// Removes a database file along with its log and journal
+void remove_database_files(const std::string& data_file);
+
+// Keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+#endif //SQLITE_BENCH_H
@@ -0,0 +1,114 @@
+#include "bench.h"
+#include "workload.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " micro [--filter <text>] [--min-time <seconds>]" << std::endl;
+    std::cerr << "       " << program << " workload <read-heavy|read-only|update-heavy|scan-heavy>"
+              << " [--records <count>] [--operations <count>] [--threads <count>] [--theta <zipfian>]"
+              << " [--max-scan-length <rows>] [--wal-sync <commit|interval|off>] [--scan-threads <count>]"
+              << std::endl;
+    std::cerr << "Common options: --data-file <path> --json <output path, default stdout>" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::string mode = argv[1];
+    int first = mode == "workload" ? 3 : 2;
+    if (argc < first || (mode != "micro" && mode != "workload")) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string filter, json_path, data_file = "bench.db";
+    double min_seconds = 0.5;
+    WorkloadOptions workload;
+    // Measure the engine rather than the disk unless asked to
+    workload.database.wal_sync_policy = SyncPolicy::OFF;
+    try {
+        if (mode == "workload" && !find_workload_mix(argv[2], workload.mix)) {
+            throw std::runtime_error(std::string("Unknown workload ") + argv[2]);
+        }
+        for (int i = first; i < argc; ++i) {
+            std::string option = argv[i];
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for option " + option);
+            }
+            std::string value = argv[++i];
+            if (option == "--filter") {
+                filter = value;
+            } else if (option == "--min-time") {
+                min_seconds = std::stod(value);
+            } else if (option == "--data-file") {
+                data_file = value;
+            } else if (option == "--json") {
+                json_path = value;
+            } else if (option == "--records") {
+                workload.record_count = std::stoull(value);
+            } else if (option == "--operations") {
+                workload.operation_count = std::stoull(value);
+            } else if (option == "--threads") {
+                workload.threads = std::stoi(value);
+            } else if (option == "--theta") {
+                workload.theta = std::stod(value);
+            } else if (option == "--max-scan-length") {
+                workload.max_scan_length = std::stoul(value);
+            } else if (option == "--scan-threads") {
+                workload.database.scan_threads = std::stoi(value);
+            } else if (option == "--wal-sync") {
+                if (value == "commit") {
+                    workload.database.wal_sync_policy = SyncPolicy::EVERY_COMMIT;
+                } else if (value == "interval") {
+                    workload.database.wal_sync_policy = SyncPolicy::INTERVAL;
+                } else if (value == "off") {
+                    workload.database.wal_sync_policy = SyncPolicy::OFF;
+                } else {
+                    throw std::runtime_error("--wal-sync must be commit, interval or off");
+                }
+            } else {
+                throw std::runtime_error("Unknown option " + option);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid options: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::ostringstream report;
+    try {
+        if (mode == "micro") {
+            BenchmarkRunner runner;
+            register_micro_benchmarks(runner, data_file);
+            write_json(report, runner.run(filter, min_seconds));
+        } else {
+            workload.database.data_file = data_file;
+            run_workload(workload, report);
+            remove_database_files(data_file);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (json_path.empty()) {
+        std::cout << report.str();
+        return 0;
+    }
+    std::ofstream out(json_path);
+    out << report.str();
+    if (!out) {
+        std::cerr << "Failed to write " << json_path << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "bench.h"
+#include "../include/database.h"
+#include "../include/protocol.h"
+#include <memory>
+#include <random>
+
+namespace {
+
+constexpr int64_t TABLE_ROWS = 100000;
+constexpr size_t INSERT_BATCH_ROWS = 500;
+
+const char* const FILTER_QUERY =
+        "SELECT id, name FROM scan WHERE age >= 30 AND age < 40 AND name != 'nobody' ORDER BY id LIMIT 100";
+
+// Clears what a previous run may have left behind
+const std::string& fresh_data_file(const std::string& data_file) {
+    remove_database_files(data_file);
+    return data_file;
+}
+
+// A table straight on a buffer pool, without a catalog or log around it
+struct TableFixture {
+    explicit TableFixture(const std::string& data_file)
+            : data_file(data_file), pager(fresh_data_file(data_file)), pool(pager, 64 * 1024 * 1024) {
+        Schema schema({{"id", ColumnType::INTEGER}, {"name", ColumnType::TEXT}, {"age", ColumnType::INTEGER}});
+        table = std::make_unique<Table>("bench", schema, pool, BTree::create(pool), 0, nullptr);
+    }
+
+    ~TableFixture() {
+        table.reset();
+        remove_database_files(data_file);
+    }
+
+    std::string data_file;
+    Pager pager;
+    BufferPool pool;
+    std::unique_ptr<Table> table;
+};
+
+struct DatabaseFixture {
+    explicit DatabaseFixture(const std::string& data_file) : data_file(data_file) {
+        DatabaseConfig config;
+        config.data_file = fresh_data_file(data_file);
+        config.wal_sync_policy = SyncPolicy::OFF;
+        database = std::make_unique<Database>(config);
+        database->execute_query("CREATE TABLE scan (id INTEGER, name TEXT, age INTEGER)");
+        for (int64_t start = 0; start < TABLE_ROWS; start += INSERT_BATCH_ROWS) {
+            std::string query = "INSERT INTO scan VALUES ";
+            for (int64_t id = start; id < start + static_cast<int64_t>(INSERT_BATCH_ROWS); ++id) {
+                query += (id == start ? "(" : ", (") + std::to_string(id) + ", 'name" + std::to_string(id) +
+                         "', " + std::to_string(id % 80) + ")";
+            }
+            database->execute_query(query);
+        }
+    }
+
+    ~DatabaseFixture() {
+        database.reset();
+        remove_database_files(data_file);
+    }
+
+    std::string data_file;
+    std::unique_ptr<Database> database;
+};
+
+std::vector<std::string> make_row(int64_t id) {
+    return {std::to_string(id), "name" + std::to_string(id), std::to_string(id % 80)};
+}
+
+} // namespace
+
+void register_micro_benchmarks(BenchmarkRunner& runner, const std::string& data_file) {
+    runner.add("tokenize", [](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            QueryArena::Scope arena_scope;
+            keep(QueryParser::tokenize(FILTER_QUERY).size());
+        }
+    });
+
+    runner.add("parse", [](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            QueryArena::Scope arena_scope;
+            Statement statement = QueryParser::parse(QueryParser::tokenize(FILTER_QUERY));
+            keep(statement.columns.size());
+        }
+    });
+
+    auto insert_table = std::make_shared<TableFixture>(data_file + "-insert");
+    auto next_key = std::make_shared<int64_t>(0);
+    runner.add("table_insert", [insert_table, next_key](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            insert_table->table->insert(make_row((*next_key)++));
+        }
+    });
+
+    auto select_table = std::make_shared<TableFixture>(data_file + "-select");
+    for (int64_t id = 0; id < TABLE_ROWS; ++id) {
+        select_table->table->insert(make_row(id));
+    }
+    runner.add("table_select", [select_table](size_t iterations) {
+        std::mt19937_64 random(42);
+        std::uniform_int_distribution<int64_t> keys(0, TABLE_ROWS - 1);
+        for (size_t i = 0; i < iterations; ++i) {
+            keep(select_table->table->select(keys(random)).size());
+        }
+    });
+
+    // One operation is a whole query, through the statement cache and executor
+    auto database = std::make_shared<DatabaseFixture>(data_file + "-queries");
+    auto add_query = [&runner, database](const std::string& name, const std::string& query) {
+        runner.add(name, [database, query](size_t iterations) {
+            size_t rows = 0;
+            for (size_t i = 0; i < iterations; ++i) {
+                database->database->execute_query(query, [&rows](const std::vector<Value>&) { rows++; });
+            }
+            keep(rows);
+        });
+    };
+    add_query("select_point", "SELECT id, name, age FROM scan WHERE id = 4242");
+    add_query("select_scan_all", "SELECT * FROM scan");
+    add_query("select_scan_filter", "SELECT id, name FROM scan WHERE age = 7");
+    add_query("select_scan_count", "SELECT COUNT(*), SUM(age) FROM scan WHERE name != 'nobody'");
+    add_query("select_order_limit", "SELECT id, name FROM scan ORDER BY age DESC LIMIT 10");
+
+    // One operation encodes a response of 1000 rows
+    runner.add("serialize_row_batches", [](size_t iterations) {
+        std::vector<std::vector<Value>> rows;
+        for (int64_t id = 0; id < 1000; ++id) {
+            rows.push_back({id, "name" + std::to_string(id), static_cast<double>(id) * 0.5});
+        }
+        std::string output;
+        for (size_t i = 0; i < iterations; ++i) {
+            RowBatchEncoder batch;
+            output.clear();
+            for (const std::vector<Value>& row : rows) {
+                batch.add_row(row);
+                if (batch.get_size() >= ROW_BATCH_TARGET_SIZE) {
+                    batch.flush_to(output);
+                }
+            }
+            batch.flush_to(output);
+            keep(output.size());
+        }
+    });
+}
@@ -0,0 +1,216 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "workload.h"
+#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t FIELD_COUNT = 4;
+constexpr size_t FIELD_LENGTH = 100;
+constexpr size_t LOAD_BATCH_ROWS = 200;
+
+const WorkloadMix MIXES[] = {
+        {"read-heavy", 0.95, 0.05, 0.0, 0.0},
+        {"read-only", 1.0, 0.0, 0.0, 0.0},
+        {"update-heavy", 0.5, 0.5, 0.0, 0.0},
+        {"scan-heavy", 0.0, 0.0, 0.95, 0.05},
+};
+
+enum Operation { READ, UPDATE, SCAN, INSERT, OPERATION_COUNT };
+const char* const OPERATION_NAMES[] = {"read", "update", "scan", "insert"};
+
+double zeta_sum(uint64_t count, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= count; ++i) {
+        sum += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+}
+
+uint64_t fnv_hash(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+        hash = (hash ^ (value & 0xff)) * 0x100000001b3ULL;
+        value >>= 8;
+    }
+    return hash;
+}
+
+std::string random_field(std::mt19937_64& random) {
+    std::string field(FIELD_LENGTH, 'a');
+    for (char& c : field) {
+        c = static_cast<char>('a' + random() % 26);
+    }
+    return field;
+}
+
+std::string row_values(uint64_t key, std::mt19937_64& random) {
+    std::string values = "(" + std::to_string(key);
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        values += ", '" + random_field(random) + "'";
+    }
+    return values + ")";
+}
+
+void load(Database& database, uint64_t record_count) {
+    std::string create = "CREATE TABLE usertable (id INTEGER";
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        create += ", field" + std::to_string(i) + " TEXT";
+    }
+    database.execute_query(create + ")");
+    std::mt19937_64 random(1);
+    for (uint64_t start = 0; start < record_count; start += LOAD_BATCH_ROWS) {
+        std::string query = "INSERT INTO usertable VALUES ";
+        for (uint64_t key = start; key < std::min(record_count, start + LOAD_BATCH_ROWS); ++key) {
+            query += (key == start ? "" : ", ") + row_values(key, random);
+        }
+        database.execute_query(query);
+    }
+    database.checkpoint();
+}
+
+// Latencies in nanoseconds, one list per operation type
+using Latencies = std::vector<std::vector<uint64_t>>;
+
+double percentile_us(const std::vector<uint64_t>& sorted, double fraction) {
+    size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[std::max<size_t>(rank, 1) - 1]) / 1000.0;
+}
+
+} // namespace
+
+ZipfianGenerator::ZipfianGenerator(uint64_t item_count, double theta)
+        : item_count(item_count), theta(theta), alpha(1.0 / (1.0 - theta)), zeta(zeta_sum(item_count, theta)) {
+    eta = (1.0 - std::pow(2.0 / static_cast<double>(item_count), 1.0 - theta)) / (1.0 - zeta_sum(2, theta) / zeta);
+}
+
+uint64_t ZipfianGenerator::next(std::mt19937_64& random) const {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+    double uz = u * zeta;
+    uint64_t rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + std::pow(0.5, theta)) {
+        rank = 1;
+    } else {
+        rank = static_cast<uint64_t>(static_cast<double>(item_count) * std::pow(eta * u - eta + 1.0, alpha));
+    }
+    return fnv_hash(std::min(rank, item_count - 1)) % item_count;
+}
+
+bool find_workload_mix(const std::string& name, WorkloadMix& mix) {
+    for (const WorkloadMix& candidate : MIXES) {
+        if (candidate.name == name) {
+            mix = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void run_workload(const WorkloadOptions& options, std::ostream& out) {
+    if (options.record_count < 2 || options.threads < 1) {
+        throw std::runtime_error("The workload needs at least two records and one thread");
+    }
+    remove_database_files(options.database.data_file);
+    Database database(options.database);
+    auto load_start = std::chrono::steady_clock::now();
+    load(database, options.record_count);
+    std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+
+    ZipfianGenerator keys(options.record_count, options.theta);
+    const WorkloadMix& mix = options.mix;
+    std::atomic<uint64_t> next_insert_key{options.record_count};
+    std::atomic<uint64_t> errors{0};
+    std::vector<Latencies> thread_latencies(options.threads, Latencies(OPERATION_COUNT));
+
+    auto worker = [&](int thread) {
+        std::mt19937_64 random(1000 + thread);
+        std::uniform_real_distribution<double> choose(0.0, 1.0);
+        std::uniform_int_distribution<size_t> scan_length(1, options.max_scan_length);
+        Latencies& latencies = thread_latencies[thread];
+        uint64_t operations = options.operation_count / options.threads +
+                              (static_cast<uint64_t>(thread) < options.operation_count % options.threads ? 1 : 0);
+        for (uint64_t i = 0; i < operations; ++i) {
+            double pick = choose(random);
+            Operation operation = pick < mix.read ? READ
+                                : pick < mix.read + mix.update ? UPDATE
+                                : pick < mix.read + mix.update + mix.scan ? SCAN
+                                : INSERT;
+            std::string query;
+            switch (operation) {
+                case READ:
+                    query = "SELECT * FROM usertable WHERE id = " + std::to_string(keys.next(random));
+                    break;
+                case UPDATE:
+                    query = "UPDATE usertable SET field0 = '" + random_field(random) + "' WHERE id = " +
+                            std::to_string(keys.next(random));
+                    break;
+                case SCAN:
+                    query = "SELECT * FROM usertable WHERE id >= " + std::to_string(keys.next(random)) +
+                            " LIMIT " + std::to_string(scan_length(random));
+                    break;
+                default:
+                    query = "INSERT INTO usertable VALUES " + row_values(next_insert_key++, random);
+                    break;
+            }
+            auto start = std::chrono::steady_clock::now();
+            try {
+                database.execute_query(query, [](const std::vector<Value>&) {});
+            } catch (const std::exception&) {
+                errors++;
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            latencies[operation].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    };
+
+    auto run_start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < options.threads; ++thread) {
+        threads.emplace_back(worker, thread);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> run_time = std::chrono::steady_clock::now() - run_start;
+
+    out << std::fixed << std::setprecision(3)
+        << "{\n  \"workload\": \"" << mix.name << "\",\n  \"records\": " << options.record_count
+        << ",\n  \"operations\": " << options.operation_count << ",\n  \"threads\": " << options.threads
+        << ",\n  \"theta\": " << options.theta << ",\n  \"load_seconds\": " << load_time.count()
+        << ",\n  \"run_seconds\": " << run_time.count()
+        << ",\n  \"throughput_ops_per_second\": " << static_cast<double>(options.operation_count) / run_time.count()
+        << ",\n  \"errors\": " << errors.load() << ",\n  \"latency_us\": {";
+    bool first = true;
+    for (int operation = 0; operation < OPERATION_COUNT; ++operation) {
+        std::vector<uint64_t> merged;
+        for (const Latencies& latencies : thread_latencies) {
+            merged.insert(merged.end(), latencies[operation].begin(), latencies[operation].end());
+        }
+        if (merged.empty()) {
+            continue;
+        }
+        std::sort(merged.begin(), merged.end());
+        double total = 0;
+        for (uint64_t latency : merged) {
+            total += static_cast<double>(latency);
+        }
+        out << (first ? "\n" : ",\n") << "    \"" << OPERATION_NAMES[operation] << "\": {\"count\": "
+            << merged.size() << ", \"mean\": " << total / static_cast<double>(merged.size()) / 1000.0
+            << ", \"p50\": " << percentile_us(merged, 0.5) << ", \"p95\": " << percentile_us(merged, 0.95)
+            << ", \"p99\": " << percentile_us(merged, 0.99) << ", \"p999\": " << percentile_us(merged, 0.999)
+            << ", \"max\": " << static_cast<double>(merged.back()) / 1000.0 << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+}
@@ -0,0 +1,55 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "../include/database.h"
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+
+#ifndef SQLITE_WORKLOAD_H
+#define SQLITE_WORKLOAD_H
+#pragma once
+
+// Zipfian ranks over [0, item_count) as generated by YCSB: rank 0 is the most
+// popular. Ranks are scrambled through a hash so the popular keys are spread
+// over the key space instead of sitting together in the first leaves.
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t item_count, double theta);
+    uint64_t next(std::mt19937_64& random) const;
+
+private:
+    uint64_t item_count;
+    double theta;
+    double alpha;
+    double zeta;
+    double eta;
+};
+
+// YCSB-style mixes: proportions of point reads, updates, short scans and
+// inserts, in that order. Scan-heavy matches YCSB workload E.
+struct WorkloadMix {
+    std::string name;
+    double read;
+    double update;
+    double scan;
+    double insert;
+};
+
+bool find_workload_mix(const std::string& name, WorkloadMix& mix);
+
+struct WorkloadOptions {
+    WorkloadMix mix;
+    uint64_t record_count = 100000;
+    uint64_t operation_count = 100000;
+    int threads = 1;
+    double theta = 0.99;
+    size_t max_scan_length = 100;
+    DatabaseConfig database;
+};
+
+// Loads record_count rows into a fresh database, then runs the mix from all
+// threads and writes throughput and latency percentiles per operation as JSON
+void run_workload(const WorkloadOptions& options, std::ostream& out);
+#endif //SQLITE_WORKLOAD_H
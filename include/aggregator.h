@@ -0,0 +1,75 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "record.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef SQLITE_AGGREGATOR_H
+#define SQLITE_AGGREGATOR_H
+#pragma once
+
+// Hash aggregation for GROUP BY. Each row's group key is looked up once in an
+// open-addressing table; the aggregate states live in one flat array per
+// aggregate, indexed by group, and are updated a column at a time in tight
+// loops over gathered values. There is no NULL, so COUNT(column) counts every
+// row and SUM, AVG, MIN and MAX of no rows are zero.
+class Aggregator {
+public:
+    enum Function { COUNT, SUM, AVG, MIN, MAX };
+
+    struct Aggregate {
+        Function function;
+        int column; // -1 for COUNT(*)
+    };
+
+    // Splits a select-list name such as "SUM(age)" into the function and its
+    // column; false when the name isn't an aggregate call
+    static bool parse_aggregate(const std::string& name, const Schema& schema, Aggregate& aggregate);
+
+    Aggregator(const Schema& schema, std::vector<int> group_columns, std::vector<Aggregate> aggregates);
+    void add_batch(const RecordView* rows, size_t count);
+    // Folds in the groups of an aggregator built for the same query over other
+    // rows; groups new to this one are numbered after its own
+    void merge(const Aggregator& other);
+    size_t get_group_count() const;
+    // The group columns followed by the aggregates, typed as get_result_columns() says
+    void get_group(size_t group, std::vector<Value>& values) const;
+    std::vector<Column> get_result_columns(const std::vector<std::string>& aggregate_names) const;
+
+private:
+    struct State {
+        Aggregate aggregate;
+        ColumnType type; // of the input column
+        std::vector<int64_t> integers;
+        std::vector<double> reals;
+        std::vector<std::string> texts;
+    };
+
+    const Schema& schema;
+    std::vector<int> group_columns;
+    std::vector<State> states;
+    std::vector<int64_t> row_counts;
+
+    // Slots hold group + 1, or 0 when free; the table is kept at most half full
+    std::vector<uint32_t> slots;
+    std::vector<uint64_t> group_hashes;
+    std::vector<std::string> group_keys;
+    std::vector<std::vector<Value>> group_values;
+
+    // Scratch space reused by every batch
+    std::string key;
+    std::vector<uint32_t> groups;
+    std::vector<int64_t> integer_values;
+    std::vector<double> real_values;
+
+    uint32_t find_group(const RecordView& row);
+    // The group whose packed key is in key, or UINT32_MAX
+    uint32_t lookup_group(uint64_t hash) const;
+    uint32_t create_group(const RecordView* row, uint64_t hash);
+    void start_extremes(uint32_t group, const RecordView& row);
+    void grow();
+};
+#endif //SQLITE_AGGREGATOR_H
@@ -0,0 +1,55 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#ifndef SQLITE_ARENA_H
+#define SQLITE_ARENA_H
+#pragma once
+
+// Bump allocator for the scratch memory of one query: tokens, filter
+// selections, sort and aggregation buffers. Every thread has its own, so
+// allocating is a pointer bump without locks, freeing is a no-op, and
+// reset() drops everything at once while keeping the blocks for the
+// thread's next query. Use it through std::pmr containers; nothing
+// allocated here may outlive the query.
+class QueryArena : public std::pmr::memory_resource {
+public:
+    // Resets the calling thread's arena when the outermost scope closes
+    class Scope {
+    public:
+        Scope();
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    static QueryArena& local();
+    void reset();
+    size_t get_allocated_bytes() const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    // Blocks past this many bytes are given back on reset, so one huge query
+    // doesn't pin its memory for the life of the thread
+    static constexpr size_t RETAINED_BYTES = 1024 * 1024;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+    size_t allocated = 0;
+    int depth = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+#endif //SQLITE_ARENA_H
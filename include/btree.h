@@ -0,0 +1,79 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "buffer_pool.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef SQLITE_BTREE_H
+#define SQLITE_BTREE_H
+#pragma once
+
+// B+tree mapping integer keys to variable-length payloads. Every node is one
+// buffer pool page; leaves are chained left to right for ordered scans. The
+// root page never moves, so its id can be stored in the catalog.
+class BTree {
+public:
+    static constexpr size_t MAX_PAYLOAD_SIZE = 1000;
+    using Entry = std::pair<int64_t, std::string>;
+
+    BTree(BufferPool& pool, page_id_t root_page_id);
+    static page_id_t create(BufferPool& pool);
+
+    bool insert(int64_t key, const std::string& payload);
+    bool find(int64_t key, std::string& payload) const;
+    bool remove(int64_t key);
+    page_id_t get_root_page_id() const;
+    bool is_empty() const;
+    // Builds an empty tree bottom-up from entries sorted by unique key, filling
+    // every page instead of splitting its way there one insert at a time
+    void bulk_load(const std::vector<Entry>& entries);
+    // The keys that separate neighbouring leaves, in order. Only internal
+    // pages are read, so this is cheap even for big trees.
+    void get_leaf_separators(std::vector<int64_t>& separators) const;
+
+    // Walks the leaf chain in key order. The current leaf stays pinned.
+    class Cursor {
+    public:
+        explicit Cursor(const BTree& tree);
+        void first();
+        void seek(int64_t key);
+        bool valid() const;
+        void next();
+        int64_t key() const;
+        std::string_view payload() const;
+        // Returns the remaining payloads of the current leaf and moves to the
+        // next one. The views stay valid until the following call.
+        size_t next_batch(std::vector<std::string_view>& payloads);
+
+    private:
+        BufferPool& pool;
+        page_id_t root_page_id;
+        PageHandle page;
+        PageHandle batch_page;
+        uint16_t slot;
+
+        void skip_exhausted_leaves();
+    };
+
+private:
+    struct SplitResult {
+        bool split = false;
+        int64_t separator = 0;
+        page_id_t right_page_id = INVALID_PAGE_ID;
+    };
+
+    BufferPool& pool;
+    page_id_t root_page_id;
+
+    SplitResult insert_into(page_id_t page_id, int64_t key, const std::string& payload, bool& inserted);
+    SplitResult insert_into_leaf(PageHandle& page, int64_t key, const std::string& payload, bool& inserted);
+    SplitResult insert_into_internal(PageHandle& page, uint16_t child_slot, int64_t separator, page_id_t right_page_id);
+    void split_root(const SplitResult& result);
+    PageHandle find_leaf(int64_t key) const;
+    void collect_separators(page_id_t page_id, int height, std::vector<int64_t>& separators) const;
+};
+#endif //SQLITE_BTREE_H
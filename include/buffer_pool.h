@@ -0,0 +1,72 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "pager.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#ifndef SQLITE_BUFFER_POOL_H
+#define SQLITE_BUFFER_POOL_H
+#pragma once
+
+// Caches database pages in a fixed number of frames and evicts unpinned
+// pages with the clock algorithm once the memory budget is used up.
+class BufferPool {
+public:
+    BufferPool(Pager& pager, size_t memory_budget);
+    char* fetch_page(page_id_t page_id);
+    char* new_page(page_id_t& page_id);
+    void unpin_page(page_id_t page_id, bool dirty);
+    void flush_all();
+    size_t get_capacity() const;
+
+private:
+    struct Frame {
+        page_id_t page_id = INVALID_PAGE_ID;
+        int pin_count = 0;
+        bool dirty = false;
+        bool referenced = false;
+    };
+
+    static constexpr size_t MIN_FRAMES = 16;
+
+    Pager& pager;
+    size_t capacity;
+    std::unique_ptr<char[]> memory;
+    std::vector<Frame> frames;
+    std::unordered_map<page_id_t, size_t> page_table;
+    size_t clock_hand = 0;
+    std::mutex mutex;
+
+    size_t acquire_frame();
+    char* frame_data(size_t frame_index);
+};
+
+// Keeps a page pinned for as long as the handle is alive.
+class PageHandle {
+public:
+    PageHandle();
+    PageHandle(BufferPool& pool, page_id_t page_id);
+    PageHandle(PageHandle&& other) noexcept;
+    PageHandle& operator=(PageHandle&& other) noexcept;
+    PageHandle(const PageHandle&) = delete;
+    PageHandle& operator=(const PageHandle&) = delete;
+    ~PageHandle();
+
+    static PageHandle create(BufferPool& pool);
+
+    char* get_data() const;
+    page_id_t get_page_id() const;
+    bool is_valid() const;
+    void mark_dirty();
+    void release();
+
+private:
+    BufferPool* pool;
+    page_id_t page_id;
+    char* data;
+    bool dirty;
+};
+#endif //SQLITE_BUFFER_POOL_H
@@ -0,0 +1,38 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "btree.h"
+#include "record.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef SQLITE_CSV_LOADER_H
+#define SQLITE_CSV_LOADER_H
+#pragma once
+
+// Turns a CSV file into encoded rows sorted by primary key, ready for
+// BTree::bulk_load. The file is cut into line-aligned chunks that are parsed,
+// encoded and sorted on separate threads and then merged. Fields may be
+// quoted ("" escapes a quote), but every record must fit on one line. When a
+// key repeats, the row that comes last in the file wins. Errors give the line
+// and column but never the file's contents, which COPY hands to clients.
+class CsvLoader {
+public:
+    static constexpr size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+    static std::vector<BTree::Entry> load(const std::string& path, const Schema& schema, bool header);
+
+private:
+    struct Chunk {
+        size_t begin = 0;
+        size_t end = 0;
+        std::vector<BTree::Entry> rows;
+        std::string error;
+        size_t error_line = 0;
+    };
+
+    static void parse_chunk(std::string_view data, const Schema& schema, Chunk& chunk);
+    static void split_fields(std::string_view line, std::vector<std::string>& fields);
+};
+#endif //SQLITE_CSV_LOADER_H
@@ -2,45 +2,294 @@
 // Created by amir on 01.07.24.
 //
 #include "query_parser.h"
+#include "btree.h"
+#include "wal.h"
+#include "record.h"
+#include "index.h"
+#include "expression.h"
+#include "statement_cache.h"
+#include "csv_loader.h"
+#include "aggregator.h"
+#include "hash_join.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "metrics.h"
+#include "query_profile.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #pragma once
 #ifndef SQLITE_DATABASE_H
 #define SQLITE_DATABASE_H
 
+// Callers synchronize through get_mutex(): shared for reads, exclusive for
+// anything that changes the tree, the row count or the indexes. The version
+// goes up with every row written or removed, after the change. Each DICT
+// column keeps its dictionary in a tree of its own, code to value, which is
+// read back in full when the table is opened.
 class Table {
 public:
-    Table(const std::string& name, const std::vector<std::string>& columns);
+    // dictionary_root_page_ids holds one tree per DICT column, in column order
+    Table(const std::string& name, const Schema& schema, BufferPool& pool, page_id_t root_page_id,
+          int64_t row_count, WriteAheadLog* wal, const std::vector<page_id_t>& dictionary_root_page_ids = {});
     void insert(const std::vector<std::string>& values);
-    std::vector<std::string> select(int key) const;
-    void update(int key, const std::vector<std::string>& values);
-    void remove(int key);
+    // Logged inserts of already encoded rows, applied in key order
+    void insert_rows(std::vector<BTree::Entry> rows);
+    // Unlogged load of rows sorted by unique key; the caller checkpoints afterwards
+    void bulk_load(const std::vector<BTree::Entry>& rows);
+    std::vector<std::string> select(int64_t key) const;
+    void update(int64_t key, const std::vector<std::string>& values);
+    void remove(int64_t key);
     int get_row_count() const;
     const std::vector<std::string>& get_columns() const;
     int get_column_index(const std::string& column_name) const;
+    const Schema& get_schema() const;
+    bool lookup(int64_t key, std::string& payload) const;
+    void scan(const std::function<bool(const RecordView& row)>& visitor) const;
+    // Visits one leaf page worth of rows at a time, limited to keys in [lower, upper]
+    void scan_batches(const std::function<bool(const RecordView* rows, size_t count)>& visitor,
+                      int64_t lower = INT64_MIN, int64_t upper = INT64_MAX) const;
+    void get_leaf_separators(std::vector<int64_t>& separators) const;
+    void create_index(const std::string& column_name, IndexType type, bool build = true);
+    void build_indexes() const;
+    const SecondaryIndex* find_index(int column_index, bool needs_range) const;
+    const std::vector<std::unique_ptr<SecondaryIndex>>& get_indexes() const;
+    page_id_t get_root_page_id() const;
+    uint64_t get_version() const;
+    // LSN of the newest log record for this table; a writer reads it under
+    // the exclusive lock to learn the LSN of its own last record
+    uint64_t get_last_lsn() const;
+    // INVALID_PAGE_ID unless the column is a DICT column
+    page_id_t get_dictionary_root_page_id(int column_index) const;
+    void apply_log_record(const WriteAheadLog::Record& record);
+    std::shared_mutex& get_mutex() const;
 
 private:
+    struct DictionaryTree {
+        int column;
+        BTree tree;
+    };
+
     std::string name;
+    Schema schema;
     std::vector<std::string> columns;
-    std::unordered_map<int, std::vector<std::string>> data;
+    BTree tree;
+    std::vector<DictionaryTree> dictionaries;
+    int64_t row_count;
+    std::atomic<uint64_t> version{0};
+    WriteAheadLog* wal;
+    uint64_t last_lsn = 0;
+    std::vector<std::unique_ptr<SecondaryIndex>> indexes;
+    mutable std::once_flag index_build;
+    // Only changes inside index_build; writers read it under the exclusive lock
+    mutable bool indexes_built = false;
+    // Held shared while a statement reads the table and exclusively while one
+    // changes it, so a statement run in one go sees every write whole or not at
+    // all. A streaming ScanCursor only holds it for each batch: a write that
+    // commits between two of its batches may be seen in part.
+    mutable std::shared_mutex mutex;
+
+    void save_dictionary_additions(bool logged);
+    void put(int64_t key, const std::string& payload);
+    bool store(int64_t key, const std::string& payload);
+    bool erase(int64_t key);
+};
+
+struct DatabaseConfig {
+    std::string data_file = "sqlite.db";
+    size_t buffer_pool_size = 64 * 1024 * 1024;
+    SyncPolicy wal_sync_policy = SyncPolicy::EVERY_COMMIT;
+    int wal_sync_interval_ms = 10;
+    size_t checkpoint_wal_size = 64 * 1024 * 1024;
+    size_t statement_cache_size = 256;
+    // Extra threads for parallel scans; -1 for one per core beyond the first
+    int scan_threads = -1;
+    // Smaller tables are always scanned by the query's own thread
+    size_t parallel_scan_rows = 100000;
+    // Checkpoints this often in the background when set, as SAVE does
+    int save_interval_ms = 0;
+    // As shard shard_index of shard_count (see ShardedDatabase), INSERT and
+    // COPY keep only the rows whose key get_shard() assigns to this shard
+    size_t shard_count = 1;
+    size_t shard_index = 0;
+    // COPY only reads files under this directory, named relative to it; with
+    // none set COPY is refused
+    std::string copy_dir;
+};
+
+// The shard of shard_count that owns a primary key
+size_t get_shard(int64_t key, size_t shard_count);
+
+// Receives result rows one at a time; the row is only valid during the call
+using RowSink = std::function<void(const std::vector<Value>& row)>;
+
+// Receives matching rows a batch at a time and returns false to stop
+using BatchVisitor = std::function<bool(const RecordView* rows, size_t count)>;
+
+// The rows of one table split into parts, e.g. the shards of a
+// ShardedDatabase, each part in key order. scan_all visits every part at once
+// until the visitor returns false for it: the rows of one part arrive in
+// order on one thread, different parts may be visited at the same time.
+struct PartedRows {
+    size_t part_count = 0;
+    std::function<void(const std::function<bool(size_t part, const RecordView* rows, size_t count)>& visitor)>
+            scan_all;
+};
+
+// A query's statement and literals as get_result_key() prepared them, so
+// open_query() needn't prepare the query again. Empty if it didn't parse.
+struct PreparedQuery {
+    std::shared_ptr<const Statement> statement;
+    std::vector<std::string> parameters;
+};
+
+// Pull side of a query, from Database::open_query(). Each next() hands up to
+// max_rows further rows to the sink and returns false once none are left.
+// Plain single-table SELECTs in key order stream: between calls the cursor
+// holds no locks and only remembers where it stopped, so memory stays flat
+// however big the result, but it reads committed rows rather than a snapshot
+// (see Table::mutex). Other statements run to completion when opened and
+// their rows are handed out from a buffer.
+class QueryCursor {
+public:
+    virtual ~QueryCursor() = default;
+    virtual bool next(const RowSink& sink, size_t max_rows) = 0;
+    // Rows handed out so far; for other statements the rows they changed
+    virtual size_t get_row_count() const = 0;
+    // Releases the cursor's table and buffers; next() returns false afterwards
+    virtual void close() = 0;
+};
+
+// Cursor over a statement that already ran; its rows wait in memory
+class BufferedCursor : public QueryCursor {
+public:
+    bool next(const RowSink& sink, size_t max_rows) override {
+        size_t end = std::min(rows.size(), position + max_rows);
+        for (; position < end; ++position) {
+            sink(rows[position]);
+        }
+        return position < rows.size();
+    }
+
+    size_t get_row_count() const override {
+        return row_count;
+    }
+
+    void close() override {
+        rows = {};
+        position = 0;
+    }
+
+    std::vector<std::vector<Value>> rows;
+    size_t position = 0;
+    size_t row_count = 0;
 };
 
 class Database {
 public:
+    explicit Database(const DatabaseConfig& config = DatabaseConfig());
+    ~Database();
     std::vector<std::vector<std::string>> execute_query(const std::string& query);
+    // Streams typed rows to sink and returns the number of rows produced or changed
+    size_t execute_query(const std::string& query, const RowSink& sink);
+    std::unique_ptr<QueryCursor> open_query(const std::string& query);
+    std::unique_ptr<QueryCursor> open_query(const std::string& query, PreparedQuery& prepared);
+    // For a plain SELECT, whose result only depends on the rows of the tables
+    // it reads: a key identifying the result, made of the normalized text and
+    // its literals, and those tables. False for any other query. Either way
+    // prepared is filled in for open_query() once the query parses.
+    bool get_result_key(const std::string& query, std::string& key, std::vector<std::shared_ptr<const Table>>& tables,
+                        PreparedQuery& prepared);
+    // The parts of get_result_key: the key of a SELECT prepared from normalized
+    // and parameters, and the tables it reads, added to tables
+    static bool make_result_key(const Statement& statement, const std::string& normalized,
+                                const std::vector<std::string>& parameters, std::string& key);
+    bool find_result_tables(const Statement& statement, std::vector<std::shared_ptr<const Table>>& tables);
+    // A copy of the table's schema; throws when there is no such table
+    Schema get_schema(const std::string& table_name);
+    // Hands the table's rows matching condition to visitor a batch at a time,
+    // in key order, until it returns false
+    void scan_table(const std::string& table_name, const Expression* condition,
+                    const std::vector<std::string>& parameters, const BatchVisitor& visitor);
+    // Runs a single-table SELECT over rows of schema spread across parts, as
+    // if they were one table. WHERE is left to the parts' scans.
+    static size_t select_parts(const Statement& statement, const std::vector<std::string>& parameters,
+                               const Schema& schema, const PartedRows& parts, const RowSink& sink);
+    void checkpoint();
+    StatementCache::Stats get_statement_cache_stats() const;
 
 private:
+    class ScanCursor;
+
+    Pager pager;
+    BufferPool buffer_pool;
+    WriteAheadLog wal;
+    size_t checkpoint_wal_size;
     std::unordered_map<std::string, std::shared_ptr<Table>> tables;
-    std::vector<std::vector<std::string>> execute_select(const std::string& table_name, const std::vector<std::string>& columns, const std::string& condition);
-    void execute_insert(const std::string& table_name, const std::vector<std::string>& values);
-    void execute_update(const std::string& table_name,
-                        const std::vector<std::string>& columns,
-                        const std::vector<std::string>& values,
-                        const std::string& condition);
-    void execute_delete(const std::string& table_name, const std::string& condition);
-    void create_table(const std::basic_string<char> &name, const std::vector<std::basic_string<char>> &columns);
+    // Statements hold this shared while they use a table; DDL and checkpoints
+    // hold it exclusively, so the tables map is stable and no page changes
+    // while dirty pages are written out
+    std::shared_mutex catalog_mutex;
+    StatementCache statement_cache;
+    std::unordered_map<std::string, std::shared_ptr<const Statement>> prepared_statements;
+    std::mutex prepared_mutex;
+    ThreadPool scan_pool;
+    size_t parallel_scan_rows;
+    std::thread save_thread;
+    std::mutex save_mutex;
+    std::condition_variable save_cv;
+    bool stopping = false;
+    size_t shard_count;
+    size_t shard_index;
+    std::string copy_dir;
+
+    std::shared_ptr<const Statement> prepare_statement(const std::string& query, std::vector<std::string>& parameters,
+                                                       std::string* normalized_query = nullptr);
+    std::shared_ptr<const Statement> find_prepared_statement(const std::string& name);
+    bool owns_key(const std::string& key) const;
+    std::unique_ptr<QueryCursor> open_scan(const std::shared_ptr<const Statement>& statement,
+                                           const std::vector<std::string>& parameters);
+    size_t execute_statement(const Statement& statement, const std::vector<std::string>& parameters,
+                             const RowSink& sink);
+    std::vector<std::pair<int64_t, int64_t>> plan_parallel_scan(const Table& table, const Expression* condition,
+                                                                const std::vector<std::string>& parameters) const;
+    size_t execute_select(const Statement& statement, const std::vector<std::string>& parameters,
+                          const RowSink& sink);
+    size_t execute_join(const Table& left, const Statement& statement, const std::vector<std::string>& parameters,
+                        size_t limit, size_t offset, const RowSink& sink);
+    // The writes set lsn to that of the last log record they appended, for commit
+    size_t execute_insert(const std::string& table_name, const std::vector<std::string>& values, size_t row_count,
+                          uint64_t& lsn);
+    size_t execute_copy(const std::string& table_name, const std::string& path, bool header);
+    size_t execute_update(const std::string& table_name,
+                          const std::vector<std::string>& columns,
+                          const std::vector<std::string>& values,
+                          const Expression* condition,
+                          const std::vector<std::string>& parameters,
+                          uint64_t& lsn);
+    size_t execute_delete(const std::string& table_name, const Expression* condition,
+                          const std::vector<std::string>& parameters, uint64_t& lsn);
+    size_t execute_explain(const Statement& statement, const std::vector<std::string>& parameters,
+                           const RowSink& sink);
+    size_t write_stats(const RowSink& sink);
+    void create_table(const std::string& name, const std::vector<Column>& columns);
+    void create_index(const std::string& table_name, const std::string& column_name, IndexType type);
+    void save_periodically(int interval_ms);
+    void write_checkpoint();
+    void initialize_database();
+    void load_catalog();
+    void save_catalog();
+    void recover();
 };
 
 #endif
@@ -2,26 +2,69 @@
 // Created by amir on 01.07.24.
 //
 #pragma once
+#include "protocol.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #ifndef SQLITE_DATABASE_CLIENT_H
 #define SQLITE_DATABASE_CLIENT_H
 
 
+struct QueryResult {
+    std::vector<std::vector<Value>> rows;
+    // Rows returned, or rows changed by INSERT/UPDATE/DELETE
+    uint64_t row_count = 0;
+};
+
+// Pool of persistent connections with an asynchronous API. submit() picks a
+// connection round-robin, writes the query and returns at once; any number of
+// queries may be in flight per connection. The server answers each connection
+// in request order, so a reader thread per connection completes the oldest
+// outstanding future whenever an END or ERROR frame arrives. A connection that
+// fails is reopened by the next submit() that lands on it.
 class DatabaseClient {
 public:
-    DatabaseClient(const std::string& ip, int port);
+    DatabaseClient(const std::string& ip, int port, size_t pool_size = 1);
     ~DatabaseClient();
     std::vector<std::vector<std::string>> execute_query(const std::string& query);
+    // Rows with their column types intact; throws on errors
+    std::vector<std::vector<Value>> execute_typed_query(const std::string& query);
+    std::future<QueryResult> submit(const std::string& query);
+    // Server-side prepared statements: the query uses ? placeholders and is
+    // parsed once; execute() only ships the parameter values, none of which
+    // may contain both ' and "
+    void prepare(const std::string& name, const std::string& query);
+    std::vector<std::vector<std::string>> execute(const std::string& name, const std::vector<std::string>& parameters);
+    std::future<QueryResult> submit_execute(const std::string& name, const std::vector<std::string>& parameters);
 
 private:
-    int sock;
+    struct Connection {
+        int sock = -1;
+        std::thread reader;
+        std::atomic<bool> broken{false};
+        // Serializes writers so frames never interleave and the pending
+        // queue matches the order queries hit the wire
+        std::mutex write_mutex;
+        std::mutex pending_mutex;
+        std::deque<std::promise<QueryResult>> pending;
+    };
+
     std::string server_ip;
     int server_port;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::atomic<size_t> next_connection;
 
-    void connect_to_server();
-    void send_query(const std::string& query);
-    std::vector<std::vector<std::string>> receive_results();
-    std::vector<std::vector<std::string>> deserialize_results(const std::string& serialized);
+    void connect_to_server(Connection& connection);
+    void disconnect(Connection& connection);
+    void send_query(Connection& connection, const std::string& query);
+    void receive_results(Connection& connection);
+    void fail_pending(Connection& connection, const std::string& error);
+    static std::string format_execute(const std::string& name, const std::vector<std::string>& parameters);
 };
 #endif //SQLITE_DATABASE_CLIENT_H
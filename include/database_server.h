@@ -2,40 +2,129 @@
 // Created by amir on 01.07.24.
 //
 #include "database.h"
+#include "protocol.h"
+#include "result_cache.h"
+#include "sharded_database.h"
+#include "slow_query_log.h"
+#include <chrono>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <condition_variable>
 #ifndef SQLITE_DATABASE_SERVER_H
 #define SQLITE_DATABASE_SERVER_H
 #pragma once
 
 
+// Single epoll reactor plus a worker pool. Connections stay open and carry any
+// number of QUERY frames (see protocol.h). Queries on one connection run one at
+// a time, so pipelined responses come back in request order. A query runs as a
+// cursor, one ROW_BATCH per worker task, and its next batch is only produced
+// once the client has taken most of the last ones: a slow reader holds up its
+// own query rather than piling its result up in server memory.
 class DatabaseServer {
 public:
-    DatabaseServer(int port);
+    // Queries that finish slower than its threshold go to slow_query_log when
+    // given. With result_cache_size > 0, responses to SELECTs are cached in up
+    // to that many bytes and repeats are answered without running them. With
+    // config.shard_count above one the tables are spread over a ShardedDatabase.
+    DatabaseServer(int port, const DatabaseConfig& config = DatabaseConfig(),
+                   SlowQueryLog* slow_query_log = nullptr, size_t result_cache_size = 0);
     ~DatabaseServer();
     void run();
     void stop();
+    void request_stop();
 
 private:
-    Database db;
+    // Owned by the reactor thread; workers only hold a reference to route
+    // their response back
+    struct Connection {
+        int fd;
+        std::string input;
+        std::deque<std::string> pending;
+        std::string output;
+        // The running query between two batches, while it waits for the
+        // client, and its response so far when that is to be cached
+        std::shared_ptr<QueryCursor> cursor;
+        std::unique_ptr<ResultCache::Fill> cache_fill;
+        // The running query so far; its text is only kept for the slow query log
+        std::string query;
+        std::chrono::steady_clock::time_point query_start;
+        std::chrono::nanoseconds query_queued{0};
+        std::chrono::nanoseconds query_executed{0};
+        uint64_t query_bytes = 0;
+        uint32_t events = 0;
+        bool busy = false;
+        bool eof = false;
+        bool closed = false;
+    };
+
+    // Opens query, or carries on with cursor when that is set
+    struct Task {
+        std::shared_ptr<Connection> connection;
+        std::string query;
+        std::shared_ptr<QueryCursor> cursor;
+        std::unique_ptr<ResultCache::Fill> cache_fill;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    // Response bytes for a connection. cursor is set while the query has rows
+    // left; otherwise output ends with the END or ERROR frame, and row_count
+    // and failed tell which.
+    struct Completion {
+        std::shared_ptr<Connection> connection;
+        std::string output;
+        std::shared_ptr<QueryCursor> cursor;
+        std::unique_ptr<ResultCache::Fill> cache_fill;
+        std::chrono::nanoseconds queued{0};
+        std::chrono::nanoseconds executed{0};
+        uint64_t row_count = 0;
+        bool failed = false;
+    };
+
+    static constexpr size_t READ_BUDGET = 1024 * 1024;
+    static constexpr size_t MAX_PENDING_QUERIES = 1024;
+    static constexpr size_t MAX_OUTPUT_BUFFER = 4 * 1024 * 1024;
+    // A running query's next batch is made once less than this waits to be sent
+    static constexpr size_t STREAM_OUTPUT_BUFFER = 256 * 1024;
+    // Rows asked of a cursor at a time while filling a batch
+    static constexpr size_t CURSOR_STEP_ROWS = 256;
+
+    // sharded_db instead of db when config.shard_count is above one
+    std::unique_ptr<Database> db;
+    std::unique_ptr<ShardedDatabase> sharded_db;
+    SlowQueryLog* slow_query_log;
+    std::unique_ptr<ResultCache> result_cache;
     int server_fd;
+    int epoll_fd;
+    int wake_fd;
     std::atomic<bool> running;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
     std::vector<std::thread> worker_threads;
-    std::queue<int> client_queue;
+    std::queue<Task> task_queue;
     std::mutex queue_mutex;
     std::condition_variable queue_cv;
+    std::vector<Completion> completions;
+    std::mutex completion_mutex;
     const int num_workers = 4;
 
     void setup_server(int port);
-    int accept_connection();
+    void accept_connections();
+    void read_from(const std::shared_ptr<Connection>& connection);
+    void write_to(const std::shared_ptr<Connection>& connection);
+    void dispatch(const std::shared_ptr<Connection>& connection);
+    void update_events(const std::shared_ptr<Connection>& connection);
+    void close_connection(const std::shared_ptr<Connection>& connection);
+    void process_completions();
     void start_workers();
     void worker_function();
-    void handle_client(int client_socket);
-    void send_response(int client_socket, const std::basic_string<char> &response);
-    std::string serialize_results(const std::vector<std::vector<std::string>>& results);
+    void execute(Task& task);
+    void post(Completion completion);
 };
 #endif //SQLITE_DATABASE_SERVER_H
@@ -0,0 +1,80 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "record.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef SQLITE_EXPRESSION_H
+#define SQLITE_EXPRESSION_H
+#pragma once
+
+// Parsed WHERE clause. Comparisons are always normalized to "column op literal";
+// the literal stays as text until it is bound to the column's type in compile().
+// A literal may instead be placeholder number `parameter`, supplied per execution.
+struct Expression {
+    enum Kind { COMPARISON, AND, OR, NOT };
+    enum Operator { EQ, NE, LT, GT, LE, GE };
+
+    Kind kind;
+    Operator op = EQ;
+    std::string column;
+    std::string literal;
+    int parameter = -1;
+    std::unique_ptr<Expression> left;
+    std::unique_ptr<Expression> right;
+
+    static std::unique_ptr<Expression> comparison(const std::string& column, Operator op, const std::string& literal,
+                                                  int parameter = -1);
+    static std::unique_ptr<Expression> logical(Kind kind, std::unique_ptr<Expression> left,
+                                               std::unique_ptr<Expression> right);
+    // terms joined by AND or OR as a balanced tree, so that walking a long
+    // chain recurses log2(terms) deep rather than once per term; nullptr if empty
+    static std::unique_ptr<Expression> join(Kind kind, std::vector<std::unique_ptr<Expression>> terms);
+    const std::string& get_literal(const std::vector<std::string>& parameters) const;
+    std::string to_string() const;
+    // Deep copy with every column name passed through rename
+    std::unique_ptr<Expression> clone(const std::function<std::string(const std::string&)>& rename) const;
+};
+
+Expression::Operator parse_operator(std::string_view op);
+Expression::Operator flip_operator(Expression::Operator op);
+const char* operator_name(Expression::Operator op);
+
+// Binds a literal to the type of the column it is compared with. Integral
+// literals stay INTEGER for INTEGER columns, anything else compares as REAL.
+Value bind_literal(ColumnType type, const std::string& literal);
+
+// A WHERE clause compiled against a schema into a tree of type- and
+// operator-specialized closures. matches() tests one row; filter() tests a
+// block of rows at a time, gathering numeric columns into contiguous arrays
+// so the comparisons run as tight, vectorizable loops.
+class CompiledPredicate {
+public:
+    static constexpr size_t BATCH_SIZE = 256;
+
+    CompiledPredicate();
+    static CompiledPredicate compile(const Expression* expression, const Schema& schema,
+                                     const std::vector<std::string>& parameters);
+
+    bool is_trivial() const;
+    bool matches(const RecordView& row) const;
+    void filter(const RecordView* rows, size_t count, uint8_t* selection) const;
+
+private:
+    using RowFunction = std::function<bool(const RecordView&)>;
+    using BatchFunction = std::function<void(const RecordView*, size_t, uint8_t*)>;
+
+    bool trivial;
+    RowFunction row_function;
+    BatchFunction batch_function;
+
+    static void compile_node(const Expression* expression, const Schema& schema,
+                             const std::vector<std::string>& parameters,
+                             RowFunction& row_function, BatchFunction& batch_function);
+};
+#endif //SQLITE_EXPRESSION_H
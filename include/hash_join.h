@@ -0,0 +1,65 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "record.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef SQLITE_HASH_JOIN_H
+#define SQLITE_HASH_JOIN_H
+#pragma once
+
+// Key type both sides of a join are compared as: their common type, or REAL
+// when an INTEGER column meets a REAL one
+ColumnType join_key_type(ColumnType left, ColumnType right);
+Value join_key(const RecordView& row, int column, ColumnType key_type);
+
+// Build side of a hash join. Rows are copied into one arena and, when they
+// don't fit in cache, radix-partitioned on the high bits of their key hash so
+// that each partition's rows and buckets do. Probes are grouped by partition
+// for the same reason.
+class JoinHashTable {
+public:
+    static constexpr size_t PARTITION_BYTES = 256 * 1024;
+
+    JoinHashTable(const Schema& schema, int key_column, ColumnType key_type);
+    void add(const RecordView* rows, size_t count);
+    // Call once every row has been added
+    void build();
+    size_t size() const;
+    RecordView get_row(size_t index) const;
+    // Calls visitor(i, build_row) for every build row whose key equals that of rows[i]
+    void probe(const RecordView* rows, size_t count, int key_column,
+               const std::function<void(size_t index, const RecordView& build_row)>& visitor);
+
+private:
+    struct Entry {
+        uint64_t hash;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    const Schema& schema;
+    int key_column;
+    ColumnType key_type;
+    std::string arena;
+    std::vector<Entry> entries;
+    std::vector<Value> keys;
+    int partition_bits;
+    // Entries are sorted by partition; partition p owns [partition_starts[p], partition_starts[p + 1])
+    std::vector<uint32_t> partition_starts;
+    // Per partition, bucket heads (entry + 1, 0 when empty) chained through next
+    std::vector<std::vector<uint32_t>> buckets;
+    std::vector<uint32_t> next;
+
+    // Scratch space reused by every probe
+    std::vector<uint64_t> probe_hashes;
+    std::vector<Value> probe_keys;
+    std::vector<uint32_t> probe_order;
+    std::vector<uint32_t> probe_counts;
+
+    uint32_t partition_of(uint64_t hash) const;
+};
+#endif //SQLITE_HASH_JOIN_H
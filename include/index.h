@@ -0,0 +1,73 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "record.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef SQLITE_INDEX_H
+#define SQLITE_INDEX_H
+#pragma once
+
+enum class IndexType : uint8_t { HASH = 1, ORDERED = 2 };
+
+IndexType parse_index_type(const std::string& name);
+const char* index_type_name(IndexType type);
+
+// Maps the values of one non-key column to the primary keys of the rows that
+// hold them. Only the definition is persisted in the catalog; the entries are
+// rebuilt from the table by the first query that needs an index after the
+// database is opened.
+class SecondaryIndex {
+public:
+    SecondaryIndex(const std::string& column_name, int column_index);
+    virtual ~SecondaryIndex() = default;
+
+    virtual IndexType get_type() const = 0;
+    virtual void insert(const Value& value, int64_t key) = 0;
+    virtual void remove(const Value& value, int64_t key) = 0;
+    virtual void find_equal(const Value& value, std::vector<int64_t>& keys) const = 0;
+    virtual bool supports_range() const;
+    virtual void find_range(const Value* lower, bool lower_inclusive, const Value* upper, bool upper_inclusive,
+                            std::vector<int64_t>& keys) const;
+
+    const std::string& get_column_name() const;
+    int get_column_index() const;
+
+private:
+    std::string column_name;
+    int column_index;
+};
+
+class HashIndex : public SecondaryIndex {
+public:
+    using SecondaryIndex::SecondaryIndex;
+
+    IndexType get_type() const override;
+    void insert(const Value& value, int64_t key) override;
+    void remove(const Value& value, int64_t key) override;
+    void find_equal(const Value& value, std::vector<int64_t>& keys) const override;
+
+private:
+    std::unordered_multimap<Value, int64_t> entries;
+};
+
+class OrderedIndex : public SecondaryIndex {
+public:
+    using SecondaryIndex::SecondaryIndex;
+
+    IndexType get_type() const override;
+    void insert(const Value& value, int64_t key) override;
+    void remove(const Value& value, int64_t key) override;
+    void find_equal(const Value& value, std::vector<int64_t>& keys) const override;
+    bool supports_range() const override;
+    void find_range(const Value* lower, bool lower_inclusive, const Value* upper, bool upper_inclusive,
+                    std::vector<int64_t>& keys) const override;
+
+private:
+    std::multimap<Value, int64_t> entries;
+};
+#endif //SQLITE_INDEX_H
@@ -0,0 +1,118 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef SQLITE_METRICS_H
+#define SQLITE_METRICS_H
+#pragma once
+
+// Process-wide counters and latency histograms. Every thread records into a
+// shard of its own with plain relaxed stores, so recording takes no lock and
+// shares no cache line; snapshot() adds the shards up.
+class Metrics {
+public:
+    enum Counter {
+        CONNECTIONS_ACCEPTED,
+        QUERIES,
+        QUERY_ERRORS,
+        ROWS_RETURNED,
+        ROWS_CHANGED,
+        BYTES_RECEIVED,
+        BYTES_SENT,
+        RESULT_CACHE_HITS,
+        RESULT_CACHE_MISSES,
+        COUNTER_COUNT
+    };
+
+    enum Timer {
+        ACCEPT,     // accepting and registering one connection
+        READ,       // draining a readable socket and splitting frames
+        QUEUE,      // a task waiting for a worker
+        NORMALIZE,  // lifting literals out of the query text
+        TOKENIZE,   // statement cache misses only, as is PARSE
+        PARSE,
+        EXECUTE,    // a worker producing one batch; opening the query counts toward the first
+        SEND,       // one pass of writing buffered responses to a socket
+        QUERY,      // from dispatch to the END or ERROR frame
+        TIMER_COUNT
+    };
+
+    // Log-linear buckets as in HDR histograms: 16 per power of two, so any
+    // value is reported within 1/16 of what was recorded
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKET_COUNT);
+
+        // Nanoseconds below which the given fraction of the values lie
+        uint64_t percentile(double fraction) const;
+    };
+
+    struct Snapshot {
+        uint64_t counters[COUNTER_COUNT] = {};
+        Histogram timers[TIMER_COUNT];
+    };
+
+    static void add(Counter counter, uint64_t amount = 1);
+    static void record(Timer timer, uint64_t nanoseconds);
+    static void record(Timer timer, std::chrono::steady_clock::time_point start);
+    static Snapshot snapshot();
+    static const char* get_name(Counter counter);
+    static const char* get_name(Timer timer);
+    // One line per counter and per timer that has values
+    static void write_text(std::ostream& out);
+
+    static size_t get_bucket(uint64_t value);
+    static uint64_t get_bucket_value(size_t bucket);
+
+private:
+    struct Shard;
+    struct Registry;
+
+    static Registry& registry();
+    static Shard& local();
+};
+
+// Records the time from construction to destruction
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Metrics::Timer timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { Metrics::record(timer, start); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Metrics::Timer timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Rewrites a file with Metrics::write_text() at a fixed interval, replacing it
+// in one rename so readers never see half a dump
+class MetricsDumper {
+public:
+    MetricsDumper(const std::string& path, int interval_ms);
+    ~MetricsDumper();
+
+private:
+    std::string path;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping;
+
+    void write_dump();
+};
+#endif //SQLITE_METRICS_H
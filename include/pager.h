@@ -0,0 +1,55 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_set>
+#include <vector>
+
+#ifndef SQLITE_PAGER_H
+#define SQLITE_PAGER_H
+#pragma once
+
+using page_id_t = uint32_t;
+
+constexpr size_t PAGE_SIZE = 4096;
+constexpr page_id_t INVALID_PAGE_ID = 0xFFFFFFFF;
+
+// Reads and writes fixed-size pages of the database file. Not thread-safe on
+// its own; the buffer pool serializes access to it.
+//
+// Between checkpoints the file is protected by a rollback journal: before a
+// page from the last checkpoint is overwritten, its original image is copied
+// to <path>-journal and synced. Opening a file with a non-empty journal rolls
+// it back to the last checkpoint, so the WAL can be replayed on a consistent tree.
+//
+// Pages of the file as of the last checkpoint are read from a shared read-only
+// mapping, so opening a large database reads nothing up front and a page
+// costs a copy, not a system call, once the kernel has it cached.
+class Pager {
+public:
+    explicit Pager(const std::string& path);
+    ~Pager();
+    void read_page(page_id_t page_id, char* buffer);
+    void write_page(page_id_t page_id, const char* buffer);
+    void journal_pages(const std::vector<page_id_t>& page_ids);
+    page_id_t allocate_page();
+    page_id_t get_page_count() const;
+    void sync();
+    void commit_checkpoint();
+
+private:
+    int fd;
+    int journal_fd;
+    std::string path;
+    page_id_t page_count;
+    page_id_t checkpoint_page_count;
+    std::unordered_set<page_id_t> journaled_pages;
+    const char* mapping;
+    page_id_t mapped_page_count;
+
+    void rollback_journal();
+    void map_file();
+};
+#endif //SQLITE_PAGER_H
@@ -0,0 +1,52 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "record.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef SQLITE_PROTOCOL_H
+#define SQLITE_PROTOCOL_H
+#pragma once
+
+// Wire format shared by server and client. Every message is a frame:
+// [u32 payload_length][u8 type][payload]. A request is one QUERY frame holding
+// the query text; its response is any number of ROW_BATCH frames followed by
+// exactly one END or ERROR frame.
+enum class FrameType : uint8_t { QUERY = 1, ROW_BATCH = 2, END = 3, ERROR = 4 };
+
+constexpr size_t FRAME_HEADER_SIZE = 5;
+constexpr size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+// Row batches are cut once they pass this many bytes
+constexpr size_t ROW_BATCH_TARGET_SIZE = 64 * 1024;
+
+void append_frame(std::string& out, FrameType type, std::string_view payload);
+// Returns false until buffer holds the whole frame starting at offset; on
+// success advances offset past it. Throws on an oversized or unknown frame.
+bool read_frame(const std::string& buffer, size_t& offset, FrameType& type, std::string_view& payload);
+
+// END carries the number of rows returned or affected
+std::string encode_end(uint64_t row_count);
+uint64_t decode_end(std::string_view payload);
+
+// ROW_BATCH payload: [u32 row_count] then per row [u16 cell_count] and each
+// cell as [u8 column type] followed by an i64, an f64 or [u32 length][bytes]. Cells are written straight into the
+// frame buffer, which is reused from batch to batch.
+class RowBatchEncoder {
+public:
+    RowBatchEncoder();
+    void add_row(const std::vector<Value>& row);
+    size_t get_row_count() const;
+    size_t get_size() const;
+    // Appends the batch as a ROW_BATCH frame and starts a new one
+    void flush_to(std::string& out);
+
+private:
+    std::string frame;
+    uint32_t row_count;
+};
+
+void decode_row_batch(std::string_view payload, std::vector<std::vector<Value>>& rows);
+#endif //SQLITE_PROTOCOL_H
@@ -1,7 +1,12 @@
 //
 // Created by amir on 01.07.24.
 //
+#include "expression.h"
+#include "arena.h"
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <stdexcept>
 
@@ -9,23 +14,86 @@
 #define SQLITE_QUERY_PARSER_H
 #pragma once
 
+struct OrderTerm {
+    std::string column;
+    bool descending = false;
+};
+
+// A parsed statement. Placeholders (?) are numbered in order of appearance;
+// value_parameters[i] is the placeholder that supplies values[i], or -1 when
+// values[i] was written inline. A multi-row INSERT stores its rows one after
+// another in values, row_count rows of equal width.
+struct Statement {
+    std::string command;
+    std::string table_name;
+    std::vector<std::string> columns;
+    std::vector<std::string> values;
+    std::vector<int> value_parameters;
+    std::unique_ptr<Expression> condition;
+    size_t parameter_count = 0;
+    size_t row_count = 1;
+
+    // SELECT keeps its select list in columns: "*", column names and aggregate
+    // calls written canonically, e.g. COUNT(*) or SUM(age). GROUP BY, HAVING
+    // and ORDER BY refer to aggregates by the same names. The limit and offset
+    // are stored in values (-1 when absent) so they bind like any other literal.
+    std::vector<std::string> group_by;
+    std::unique_ptr<Expression> having;
+    // FROM table_name JOIN join_table ON join_left = join_right
+    std::string join_table;
+    std::string join_left;
+    std::string join_right;
+    std::vector<OrderTerm> order_by;
+    int limit_value = -1;
+    int offset_value = -1;
+
+    // PREPARE name AS <statement>, EXECUTE name (...) and DEALLOCATE name.
+    // EXPLAIN [ANALYZE] <statement> also keeps the statement in prepared.
+    std::string statement_name;
+    std::shared_ptr<const Statement> prepared;
+
+    std::vector<std::string> bind_values(const std::vector<std::string>& parameters) const;
+};
 
 class QueryParser {
 public:
+    // Token values point into the query text, or into the thread's query
+    // arena, and are only valid while both are
     struct Token {
-        enum Type { KEYWORD, IDENTIFIER, VALUE, OPERATOR, END };
+        enum Type { KEYWORD, IDENTIFIER, VALUE, PARAMETER, OPERATOR, PUNCTUATION, END };
         Type type;
-        std::string value;
-        Token(Type t, const std::string& v) : type(t), value(v) {}
+        std::string_view value;
+        Token(Type t, std::string_view v) : type(t), value(v) {}
     };
+    using TokenList = std::pmr::vector<Token>;
 
-    static std::vector<Token> tokenize(const std::string& query);
-    static void parse(const std::vector<Token>& tokens, std::string& command, std::string& table_name,
-                      std::vector<std::string>& columns, std::vector<std::string>& values, std::string& condition);
+    static TokenList tokenize(std::string_view query);
+    static Statement parse(const TokenList& tokens);
+    static std::string normalize(const std::string& query, std::vector<std::string>& literals);
+    // The query's first word as tokenize() reads it, e.g. its command keyword
+    static std::string_view first_word(std::string_view query);
 
 private:
-    static bool is_keyword(const std::string& word);
-    static bool is_operator(const std::string& word);
+    static bool is_keyword(std::string_view word);
+    static bool is_number(std::string_view word);
+    static void add_value(Statement& statement, const Token& token);
+    static std::string parse_column_reference(const TokenList& tokens, size_t& i);
+    static void parse_order_and_limit(const TokenList& tokens, size_t& i, Statement& statement);
+
+    // WHERE clause grammar, lowest precedence first:
+    //   or := and (OR and)*   and := not (AND not)*   not := NOT not | primary
+    //   primary := ( or ) | operand op operand | column BETWEEN value AND value
+    // where a column operand may also be an aggregate call such as COUNT(*).
+    // Nesting and the number of comparisons are bounded, see WhereLimits.
+    struct WhereLimits {
+        size_t depth = 0;
+        size_t terms = 0;
+    };
+    static std::unique_ptr<Expression> parse_where(const TokenList& tokens, size_t& i);
+    static std::unique_ptr<Expression> parse_or(const TokenList& tokens, size_t& i, WhereLimits& limits);
+    static std::unique_ptr<Expression> parse_and(const TokenList& tokens, size_t& i, WhereLimits& limits);
+    static std::unique_ptr<Expression> parse_not(const TokenList& tokens, size_t& i, WhereLimits& limits);
+    static std::unique_ptr<Expression> parse_comparison(const TokenList& tokens, size_t& i, WhereLimits& limits);
 };
 
 class QueryParseError : public std::runtime_error {
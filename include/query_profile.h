@@ -0,0 +1,90 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef SQLITE_QUERY_PROFILE_H
+#define SQLITE_QUERY_PROFILE_H
+#pragma once
+
+// What EXPLAIN reports about one statement. The executor notes every access
+// path, join and ordering decision it takes as a line of the plan, counts the
+// rows it reads and splits the statement's time between its operators. It
+// finds the profile through current(), which is null unless the statement is
+// being explained, so other queries pay a thread-local load per batch.
+//
+// A plan-only profile (plain EXPLAIN) makes every table scan and lookup come
+// back empty: the statement runs through all its decisions without reading a
+// row or changing one.
+class QueryProfile {
+public:
+    // Time is charged to one operator at a time on every thread: a scan
+    // handing a batch to a sort stops the scan's clock and starts the sort's.
+    // OUTPUT is producing result rows, or applying the changes of an UPDATE
+    // or DELETE. PLAN covers the rest, e.g. binding values, locking and
+    // compiling predicates.
+    enum Operator { PLAN, SCAN, JOIN, AGGREGATE, SORT, OUTPUT, OPERATOR_COUNT };
+
+    // Makes profile the calling thread's current one, charging time to op,
+    // until destroyed; the thread's previous profile and operator come back after
+    class Scope {
+    public:
+        explicit Scope(QueryProfile* profile, Operator op = PLAN);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        QueryProfile* saved_profile;
+        Operator saved_operator;
+    };
+
+    // Charges the calling thread's time to op until destroyed. Does nothing
+    // without a current profile.
+    class Phase {
+    public:
+        explicit Phase(Operator op);
+        ~Phase();
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+        // The operator that ran before, i.e. the one consuming this one's rows
+        Operator get_previous() const;
+
+    private:
+        bool active;
+        Operator previous;
+    };
+
+    explicit QueryProfile(bool plan_only);
+    static QueryProfile* current();
+    static Operator current_operator();
+    static const char* get_name(Operator op);
+
+    bool is_plan_only() const;
+    // Plan lines come from the statement's own thread only
+    void note(std::string line);
+    void count_rows(uint64_t examined, uint64_t matched);
+
+    const std::vector<std::string>& get_plan() const;
+    uint64_t get_rows_examined() const;
+    uint64_t get_rows_matched() const;
+    // Summed over every thread that worked for the operator
+    uint64_t get_nanoseconds(Operator op) const;
+    // Scratch taken from the query arenas of every thread involved
+    uint64_t get_arena_bytes() const;
+
+private:
+    bool plan_only;
+    std::vector<std::string> plan;
+    std::atomic<uint64_t> rows_examined{0};
+    std::atomic<uint64_t> rows_matched{0};
+    std::atomic<uint64_t> arena_bytes{0};
+    std::atomic<uint64_t> nanoseconds[OPERATOR_COUNT] = {};
+
+    static void switch_to(Operator op);
+};
+#endif //SQLITE_QUERY_PROFILE_H
@@ -0,0 +1,110 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#ifndef SQLITE_RECORD_H
+#define SQLITE_RECORD_H
+#pragma once
+
+enum class ColumnType : uint8_t { INTEGER = 1, REAL = 2, TEXT = 3 };
+
+// Distinct values of a DICT column, numbered in order of first appearance.
+// Records hold a value's code in the column's slot instead of the text, so
+// each value is stored once and equal values compare as integers. Values
+// never move once added, which lets decode() run without the lock.
+class Dictionary {
+public:
+    static constexpr size_t MAX_VALUE_SIZE = 512;
+    static constexpr uint32_t MAX_CODES = 1 << 20;
+
+    // The code of text, adding it when new
+    uint32_t encode(std::string_view text);
+    bool find(std::string_view text, uint32_t& code) const;
+    std::string_view decode(uint32_t code) const {
+        return chunks[code >> CHUNK_BITS][code & (CHUNK_SIZE - 1)];
+    }
+    // Restores a value read back from disk or from the log
+    void load(uint32_t code, std::string_view text);
+    // Values added since the last call; they must be durable before any record using them
+    std::vector<std::pair<uint32_t, std::string>> take_additions();
+    size_t size() const;
+
+private:
+    static constexpr int CHUNK_BITS = 10;
+    static constexpr uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+
+    std::unique_ptr<std::string[]> chunks[MAX_CODES / CHUNK_SIZE];
+    std::unordered_map<std::string_view, uint32_t> codes;
+    uint32_t next_code = 0;
+    std::vector<std::pair<uint32_t, std::string>> additions;
+    mutable std::mutex mutex;
+
+    void store(uint32_t code, std::string_view text);
+};
+
+// dictionary is set for DICT columns only and shared by every copy of the schema
+struct Column {
+    std::string name;
+    ColumnType type;
+    std::shared_ptr<Dictionary> dictionary = nullptr;
+};
+
+using Value = std::variant<int64_t, double, std::string>;
+
+ColumnType parse_column_type(const std::string& name);
+// A column from its declared type, e.g. "TEXT" or "TEXT DICT"
+Column make_column(const std::string& name, const std::string& declared_type);
+const char* column_type_name(ColumnType type);
+Value parse_value(ColumnType type, const std::string& text);
+std::string value_to_string(const Value& value);
+int compare_values(const Value& a, const Value& b);
+
+// Column layout of a table. A record has one fixed 8-byte slot per column,
+// holding the native INTEGER or REAL value, the offset and length of a TEXT
+// value in the string heap that follows the slots, or a DICT column's code.
+class Schema {
+public:
+    static constexpr size_t SLOT_SIZE = 8;
+
+    Schema() = default;
+    explicit Schema(std::vector<Column> columns);
+    size_t size() const;
+    const Column& operator[](size_t index) const;
+    const std::vector<Column>& get_columns() const;
+    int get_column_index(const std::string& column_name) const;
+    std::string encode(const std::vector<std::string>& values) const;
+    std::string encode_values(const std::vector<Value>& values) const;
+    std::vector<std::string> decode(std::string_view record) const;
+
+private:
+    std::vector<Column> columns;
+};
+
+// Read-only access to an encoded record without materializing its values
+class RecordView {
+public:
+    RecordView(const Schema& schema, std::string_view data) : schema(&schema), data(data) {}
+
+    int64_t get_integer(size_t column) const;
+    double get_real(size_t column) const;
+    double get_number(size_t column) const;
+    std::string_view get_text(size_t column) const;
+    Value get_value(size_t column) const;
+    std::string get_string(size_t column) const;
+    std::string_view get_data() const { return data; }
+    const Schema& get_schema() const { return *schema; }
+
+private:
+    const Schema* schema;
+    std::string_view data;
+};
+#endif //SQLITE_RECORD_H
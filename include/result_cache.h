@@ -0,0 +1,74 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "database.h"
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef SQLITE_RESULT_CACHE_H
+#define SQLITE_RESULT_CACHE_H
+#pragma once
+
+// LRU cache of complete SELECT responses, i.e. the encoded ROW_BATCH frames
+// and the END frame, keyed on the query's normalized text and literals (see
+// Database::get_result_key). An entry remembers the version of every table
+// the query read and is only served while they all still have it; a stale
+// entry is dropped when next looked up, or evicted in LRU order. The cache
+// holds at most capacity bytes and no entry takes more than an eighth of it.
+// Hits and misses are counted in Metrics.
+class ResultCache {
+public:
+    using TableVersions = std::vector<std::pair<std::shared_ptr<const Table>, uint64_t>>;
+
+    // A response being captured batch by batch while the query runs
+    struct Fill {
+        std::string key;
+        TableVersions versions;
+        std::string output;
+    };
+
+    // Database::get_result_key or its equivalent for the database served
+    using KeyFunction = std::function<bool(const std::string& query, std::string& key,
+                                           std::vector<std::shared_ptr<const Table>>& tables,
+                                           PreparedQuery& prepared)>;
+
+    ResultCache(KeyFunction get_key, size_t capacity);
+
+    // On a hit returns the cached response and its row count. On a miss of a
+    // query that may be cached, fill is set up to capture its response.
+    // Otherwise prepared holds the query for open_query, as get_key left it.
+    std::shared_ptr<const std::string> find(const std::string& query, uint64_t& row_count,
+                                            std::unique_ptr<Fill>& fill, PreparedQuery& prepared);
+    // Adds the next part of the response; false once it has grown too big to keep
+    bool capture(Fill& fill, const std::string& output) const;
+    // Keeps the captured response unless a table changed while it was produced
+    void insert(Fill& fill, uint64_t row_count);
+
+private:
+    struct Entry {
+        std::string key;
+        TableVersions versions;
+        std::shared_ptr<const std::string> output;
+        uint64_t row_count;
+    };
+
+    KeyFunction get_key;
+    size_t capacity;
+    size_t max_entry_size;
+    size_t bytes;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+    std::mutex mutex;
+
+    static bool is_current(const TableVersions& versions);
+    static size_t get_size(const Entry& entry);
+    void erase(std::list<Entry>::iterator it);
+};
+#endif //SQLITE_RESULT_CACHE_H
@@ -0,0 +1,78 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "database.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef SQLITE_SHARDED_DATABASE_H
+#define SQLITE_SHARDED_DATABASE_H
+#pragma once
+
+// Every table hash-partitioned on its primary key (see get_shard()) over
+// shard_count Databases, each in files of its own and run by one executor
+// thread pinned to a core. Statements only run on the executors, so shards
+// share no tables, locks or pages.
+//
+// A statement naming one key, through "key = value" among the AND-ed parts
+// of its WHERE clause or as a single-row INSERT, runs on that key's shard
+// alone. Other SELECTs scan every shard at once and are merged, grouped,
+// ordered and limited here, with the same result as without shards except
+// that rows tied under ORDER BY may come in another order. Everything else
+// runs on every shard, each keeping or changing only its own rows, and
+// reports the total. A statement that spans shards is not atomic across them.
+// JOIN is not supported.
+class ShardedDatabase {
+public:
+    // config.data_file names the shards' files, with "-shard<i>" appended
+    explicit ShardedDatabase(const DatabaseConfig& config);
+    ~ShardedDatabase();
+    std::unique_ptr<QueryCursor> open_query(const std::string& query);
+    std::unique_ptr<QueryCursor> open_query(const std::string& query, PreparedQuery& prepared);
+    // As Database::get_result_key, with the tables of every shard
+    bool get_result_key(const std::string& query, std::string& key, std::vector<std::shared_ptr<const Table>>& tables,
+                        PreparedQuery& prepared);
+
+private:
+    struct Shard {
+        std::unique_ptr<Database> db;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> jobs;
+        bool stopping = false;
+    };
+    class ShardCursor;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    StatementCache statement_cache;
+    // Prepared bodies, to route EXECUTE; the shards keep their own copies
+    std::unordered_map<std::string, std::shared_ptr<const Statement>> prepared_statements;
+    std::mutex prepared_mutex;
+    // Tables are never dropped, so a schema once looked up stays valid
+    std::unordered_map<std::string, std::shared_ptr<const Schema>> schemas;
+    std::shared_mutex schema_mutex;
+
+    std::shared_ptr<const Statement> prepare_statement(const std::string& query, std::vector<std::string>& parameters,
+                                                       std::string* normalized_query = nullptr);
+    std::shared_ptr<const Statement> find_prepared_statement(const std::string& name);
+    std::shared_ptr<const Schema> find_schema(const std::string& table_name);
+    bool find_shard(const Statement& statement, const std::vector<std::string>& parameters, size_t& shard);
+    std::unique_ptr<QueryCursor> open_on(size_t shard, const std::string& query);
+    std::unique_ptr<QueryCursor> open_everywhere(const std::string& query, bool label_rows);
+    std::unique_ptr<QueryCursor> select_everywhere(const Statement& statement,
+                                                   const std::vector<std::string>& parameters);
+    void submit(Shard& shard, std::function<void()> job);
+    void run(size_t shard, const std::function<void()>& job);
+    void run_everywhere(const std::function<void(size_t shard)>& job);
+    void run_jobs(Shard& shard);
+};
+#endif //SQLITE_SHARDED_DATABASE_H
@@ -0,0 +1,67 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef SQLITE_SLOW_QUERY_LOG_H
+#define SQLITE_SLOW_QUERY_LOG_H
+#pragma once
+
+// Appends a line for every query that took at least the threshold. record()
+// only queues the entry; a background thread formats and writes it, so the
+// threads serving queries never wait for the disk. When the queue is full
+// entries are dropped and counted instead. Once the file passes
+// max_file_bytes it is rotated: path becomes path.1, path.1 becomes path.2
+// and so on, keeping max_files old files.
+class SlowQueryLog {
+public:
+    struct Options {
+        std::string path;
+        int threshold_ms = 100;
+        size_t max_file_bytes = 64 * 1024 * 1024;
+        int max_files = 4;
+    };
+
+    struct Entry {
+        std::string query;
+        std::chrono::system_clock::time_point finished_at;
+        // From arrival to the last response frame, and the parts of it spent
+        // waiting for a worker and running on one
+        std::chrono::nanoseconds total;
+        std::chrono::nanoseconds queued;
+        std::chrono::nanoseconds executed;
+        uint64_t row_count;
+        uint64_t response_bytes;
+        bool failed;
+    };
+
+    explicit SlowQueryLog(const Options& options);
+    ~SlowQueryLog();
+    bool is_slow(std::chrono::nanoseconds elapsed) const;
+    void record(Entry entry);
+
+private:
+    static constexpr size_t MAX_QUEUED_ENTRIES = 4096;
+
+    Options options;
+    std::ofstream file;
+    size_t file_size;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Entry> queue;
+    uint64_t dropped;
+    bool stopping;
+
+    void write_entries();
+    void write_line(const std::string& line);
+    void rotate();
+};
+#endif //SQLITE_SLOW_QUERY_LOG_H
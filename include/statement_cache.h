@@ -0,0 +1,44 @@
+//
+// Created by amir on 01.07.24.
+//
+#include "query_parser.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#ifndef SQLITE_STATEMENT_CACHE_H
+#define SQLITE_STATEMENT_CACHE_H
+#pragma once
+
+// LRU cache of parsed statements keyed on normalized query text, so repeated
+// statement shapes skip tokenizing and parsing. Entries are shared_ptrs and
+// stay alive for a query that is still running when they get evicted.
+class StatementCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        size_t entries;
+        size_t capacity;
+    };
+
+    explicit StatementCache(size_t capacity);
+
+    std::shared_ptr<const Statement> find(const std::string& normalized_query);
+    void insert(const std::string& normalized_query, std::shared_ptr<const Statement> statement);
+    Stats get_stats() const;
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const Statement>>;
+
+    size_t capacity;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+    uint64_t hits;
+    uint64_t misses;
+    mutable std::mutex mutex;
+};
+#endif //SQLITE_STATEMENT_CACHE_H
@@ -0,0 +1,46 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef SQLITE_THREAD_POOL_H
+#define SQLITE_THREAD_POOL_H
+#pragma once
+
+// Fixed set of threads that run parallel loops. Each loop's tasks are dealt
+// out as one contiguous run per participant; a participant whose run is used
+// up takes tasks from the far end of someone else's, so uneven tasks even out
+// while neighbouring tasks mostly stay on one thread. The calling thread
+// takes part too, so a pool without threads runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+    size_t get_thread_count() const;
+    // Calls task(index, participant) for every index below task_count and
+    // returns once all calls are done. participant is below
+    // get_thread_count() + 1 and tells per-thread state apart. After the first
+    // exception the remaining tasks are skipped and it is rethrown here.
+    void run(size_t task_count, const std::function<void(size_t task, size_t participant)>& task);
+
+private:
+    struct Job;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    // Loops that still have a participant slot free
+    std::deque<std::shared_ptr<Job>> jobs;
+    bool stopping;
+
+    void worker_function();
+    static void participate(Job& job, size_t participant);
+};
+#endif //SQLITE_THREAD_POOL_H
@@ -0,0 +1,68 @@
+//
+// Created by amir on 01.07.24.
+//
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef SQLITE_WAL_H
+#define SQLITE_WAL_H
+#pragma once
+
+enum class SyncPolicy {
+    EVERY_COMMIT,   // commit waits for fdatasync, shared by all writers waiting at the same time
+    INTERVAL,       // a background thread syncs every sync_interval_ms
+    OFF             // records reach the OS but are never synced explicitly
+};
+
+// Logical redo log of row mutations. Records are idempotent row images, so
+// replaying the whole log on top of the last checkpoint restores the data.
+class WriteAheadLog {
+public:
+    // A DICTIONARY record adds value number key to a DICT column's
+    // dictionary; its payload is [u16 column][value]
+    struct Record {
+        enum Type : uint8_t { PUT = 1, REMOVE = 2, DICTIONARY = 3 };
+        Type type;
+        std::string table_name;
+        int64_t key;
+        std::string payload;
+    };
+
+    WriteAheadLog(const std::string& path, SyncPolicy policy, int sync_interval_ms);
+    ~WriteAheadLog();
+    uint64_t append(Record::Type type, const std::string& table_name, int64_t key, const std::string& payload);
+    void commit(uint64_t lsn);
+    uint64_t get_last_lsn();
+    size_t get_size();
+    void replay(const std::function<void(const Record&)>& apply);
+    void truncate();
+
+private:
+    int fd;
+    std::string path;
+    SyncPolicy policy;
+    int sync_interval_ms;
+
+    std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::string buffer;
+    uint64_t last_lsn = 0;
+    uint64_t written_lsn = 0;
+    uint64_t durable_lsn = 0;
+    bool flushing = false;
+    size_t file_size = 0;
+
+    std::atomic<bool> running;
+    std::condition_variable stop_cv;
+    std::thread sync_thread;
+
+    void flush(std::unique_lock<std::mutex>& lock, bool sync);
+    void wait_for(uint64_t lsn, bool sync);
+    void sync_loop();
+};
+#endif //SQLITE_WAL_H
@@ -0,0 +1,374 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/aggregator.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+namespace {
+
+// With a single group the loops below don't touch the group table at all, and
+// four independent accumulators let the compiler vectorize even the
+// floating-point sums, whose order it isn't allowed to change on its own
+template<typename T>
+void accumulate(Aggregator::Function function, const T* values, const uint32_t* groups, size_t count,
+                bool single_group, T* states) {
+    if (single_group) {
+        T lanes[4] = {states[0], states[0], states[0], states[0]};
+        if (function == Aggregator::SUM || function == Aggregator::AVG) {
+            lanes[1] = lanes[2] = lanes[3] = 0;
+        }
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            for (size_t lane = 0; lane < 4; ++lane) {
+                T value = values[i + lane];
+                switch (function) {
+                    case Aggregator::MIN: lanes[lane] = std::min(lanes[lane], value); break;
+                    case Aggregator::MAX: lanes[lane] = std::max(lanes[lane], value); break;
+                    default: lanes[lane] += value; break;
+                }
+            }
+        }
+        for (; i < count; ++i) {
+            switch (function) {
+                case Aggregator::MIN: lanes[0] = std::min(lanes[0], values[i]); break;
+                case Aggregator::MAX: lanes[0] = std::max(lanes[0], values[i]); break;
+                default: lanes[0] += values[i]; break;
+            }
+        }
+        switch (function) {
+            case Aggregator::MIN: states[0] = std::min({lanes[0], lanes[1], lanes[2], lanes[3]}); break;
+            case Aggregator::MAX: states[0] = std::max({lanes[0], lanes[1], lanes[2], lanes[3]}); break;
+            default: states[0] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]); break;
+        }
+        return;
+    }
+
+    switch (function) {
+        case Aggregator::MIN:
+            for (size_t i = 0; i < count; ++i) {
+                states[groups[i]] = std::min(states[groups[i]], values[i]);
+            }
+            break;
+        case Aggregator::MAX:
+            for (size_t i = 0; i < count; ++i) {
+                states[groups[i]] = std::max(states[groups[i]], values[i]);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < count; ++i) {
+                states[groups[i]] += values[i];
+            }
+            break;
+    }
+}
+
+} // namespace
+
+bool Aggregator::parse_aggregate(const std::string& name, const Schema& schema, Aggregate& aggregate) {
+    size_t open = name.find('(');
+    if (open == std::string::npos || name.back() != ')') {
+        return false;
+    }
+    std::string function = name.substr(0, open);
+    std::string column = name.substr(open + 1, name.size() - open - 2);
+    if (function == "COUNT") {
+        aggregate.function = COUNT;
+    } else if (function == "SUM") {
+        aggregate.function = SUM;
+    } else if (function == "AVG") {
+        aggregate.function = AVG;
+    } else if (function == "MIN") {
+        aggregate.function = MIN;
+    } else if (function == "MAX") {
+        aggregate.function = MAX;
+    } else {
+        throw std::runtime_error("Unknown function: " + function);
+    }
+
+    if (column == "*") {
+        if (aggregate.function != COUNT) {
+            throw std::runtime_error(function + "(*) is not supported");
+        }
+        aggregate.column = -1;
+        return true;
+    }
+    aggregate.column = schema.get_column_index(column);
+    if (aggregate.column == -1) {
+        throw std::runtime_error("Column not found: " + column);
+    }
+    if ((aggregate.function == SUM || aggregate.function == AVG) && schema[aggregate.column].type == ColumnType::TEXT) {
+        throw std::runtime_error(function + " needs a numeric column: " + column);
+    }
+    return true;
+}
+
+Aggregator::Aggregator(const Schema& schema, std::vector<int> group_columns, std::vector<Aggregate> aggregates)
+        : schema(schema), group_columns(std::move(group_columns)), slots(64, 0) {
+    for (const Aggregate& aggregate : aggregates) {
+        State state;
+        state.aggregate = aggregate;
+        state.type = aggregate.column == -1 ? ColumnType::INTEGER : schema[aggregate.column].type;
+        states.push_back(std::move(state));
+    }
+    // Without GROUP BY there is exactly one group, even when no row matches
+    if (this->group_columns.empty()) {
+        create_group(nullptr, 0);
+    }
+}
+
+void Aggregator::add_batch(const RecordView* rows, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    bool single_group = group_columns.empty();
+    groups.resize(count);
+    if (single_group) {
+        if (row_counts[0] == 0) {
+            // The lone group had no row to start MIN and MAX from yet
+            start_extremes(0, rows[0]);
+        }
+        row_counts[0] += static_cast<int64_t>(count);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            groups[i] = find_group(rows[i]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            row_counts[groups[i]]++;
+        }
+    }
+
+    for (State& state : states) {
+        const Aggregate& aggregate = state.aggregate;
+        if (aggregate.function == COUNT) {
+            continue;
+        }
+        int column = aggregate.column;
+        if (state.type == ColumnType::INTEGER) {
+            integer_values.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                integer_values[i] = rows[i].get_integer(column);
+            }
+            accumulate(aggregate.function, integer_values.data(), groups.data(), count, single_group,
+                       state.integers.data());
+        } else if (state.type == ColumnType::REAL) {
+            real_values.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                real_values[i] = rows[i].get_real(column);
+            }
+            accumulate(aggregate.function, real_values.data(), groups.data(), count, single_group,
+                       state.reals.data());
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                std::string& current = state.texts[single_group ? 0 : groups[i]];
+                std::string_view value = rows[i].get_text(column);
+                if (aggregate.function == MIN ? value < current : value > current) {
+                    current.assign(value);
+                }
+            }
+        }
+    }
+}
+
+void Aggregator::merge(const Aggregator& other) {
+    for (uint32_t other_group = 0; other_group < other.row_counts.size(); ++other_group) {
+        int64_t other_rows = other.row_counts[other_group];
+        if (other_rows == 0) {
+            continue;
+        }
+        uint32_t group = 0;
+        if (!group_columns.empty()) {
+            key = other.group_keys[other_group];
+            uint64_t hash = other.group_hashes[other_group];
+            group = lookup_group(hash);
+            if (group == UINT32_MAX) {
+                group = create_group(nullptr, hash);
+                group_values[group] = other.group_values[other_group];
+            }
+        }
+
+        // MIN and MAX of a group without rows yet hold no value to compare with
+        bool first = row_counts[group] == 0;
+        row_counts[group] += other_rows;
+        for (size_t i = 0; i < states.size(); ++i) {
+            State& state = states[i];
+            const State& from = other.states[i];
+            Function function = state.aggregate.function;
+            if (function == COUNT) {
+                continue;
+            }
+            if (state.type == ColumnType::INTEGER) {
+                int64_t& current = state.integers[group];
+                int64_t value = from.integers[other_group];
+                current = function == MIN ? (first ? value : std::min(current, value))
+                        : function == MAX ? (first ? value : std::max(current, value))
+                        : current + value;
+            } else if (state.type == ColumnType::REAL) {
+                double& current = state.reals[group];
+                double value = from.reals[other_group];
+                current = function == MIN ? (first ? value : std::min(current, value))
+                        : function == MAX ? (first ? value : std::max(current, value))
+                        : current + value;
+            } else {
+                std::string& current = state.texts[group];
+                const std::string& value = from.texts[other_group];
+                if (first || (function == MIN ? value < current : value > current)) {
+                    current = value;
+                }
+            }
+        }
+    }
+}
+
+size_t Aggregator::get_group_count() const {
+    return row_counts.size();
+}
+
+void Aggregator::get_group(size_t group, std::vector<Value>& values) const {
+    values = group_values[group];
+    for (const State& state : states) {
+        switch (state.aggregate.function) {
+            case COUNT:
+                values.emplace_back(row_counts[group]);
+                break;
+            case AVG: {
+                double total = state.type == ColumnType::INTEGER ? static_cast<double>(state.integers[group])
+                                                                 : state.reals[group];
+                values.emplace_back(row_counts[group] == 0 ? 0.0 : total / static_cast<double>(row_counts[group]));
+                break;
+            }
+            default:
+                if (state.type == ColumnType::INTEGER) {
+                    values.emplace_back(state.integers[group]);
+                } else if (state.type == ColumnType::REAL) {
+                    values.emplace_back(state.reals[group]);
+                } else {
+                    values.emplace_back(state.texts[group]);
+                }
+                break;
+        }
+    }
+}
+
+std::vector<Column> Aggregator::get_result_columns(const std::vector<std::string>& aggregate_names) const {
+    std::vector<Column> columns;
+    // Results hold the decoded text, so DICT group columns come back as plain TEXT
+    for (int column : group_columns) {
+        columns.push_back({schema[column].name, schema[column].type});
+    }
+    for (size_t i = 0; i < states.size(); ++i) {
+        ColumnType type = states[i].type;
+        if (states[i].aggregate.function == COUNT) {
+            type = ColumnType::INTEGER;
+        } else if (states[i].aggregate.function == AVG) {
+            type = ColumnType::REAL;
+        }
+        columns.push_back({aggregate_names[i], type});
+    }
+    return columns;
+}
+
+// Group keys are the group column values packed into bytes: eight per number
+// or DICT code, and a length followed by the bytes for other TEXT
+uint32_t Aggregator::find_group(const RecordView& row) {
+    key.clear();
+    for (int column : group_columns) {
+        if (schema[column].type == ColumnType::TEXT && !schema[column].dictionary) {
+            std::string_view text = row.get_text(column);
+            uint32_t length = static_cast<uint32_t>(text.size());
+            key.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            key.append(text);
+        } else {
+            int64_t bits = row.get_integer(column);
+            if (schema[column].type == ColumnType::REAL) {
+                double value = row.get_real(column);
+                memcpy(&bits, &value, sizeof(bits));
+            }
+            key.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+        }
+    }
+
+    uint64_t hash = std::hash<std::string_view>()(key);
+    uint32_t group = lookup_group(hash);
+    return group != UINT32_MAX ? group : create_group(&row, hash);
+}
+
+uint32_t Aggregator::lookup_group(uint64_t hash) const {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t group = slots[slot] - 1;
+        if (group_hashes[group] == hash && group_keys[group] == key) {
+            return group;
+        }
+    }
+    return UINT32_MAX;
+}
+
+uint32_t Aggregator::create_group(const RecordView* row, uint64_t hash) {
+    uint32_t group = static_cast<uint32_t>(row_counts.size());
+    row_counts.push_back(0);
+    group_hashes.push_back(hash);
+    group_keys.push_back(key);
+    std::vector<Value> values;
+    if (row != nullptr) {
+        for (int column : group_columns) {
+            values.push_back(row->get_value(column));
+        }
+    }
+    group_values.push_back(std::move(values));
+    for (State& state : states) {
+        state.integers.push_back(0);
+        state.reals.push_back(0.0);
+        state.texts.emplace_back();
+    }
+    if (row != nullptr) {
+        start_extremes(group, *row);
+    }
+
+    if (!group_columns.empty()) {
+        if (row_counts.size() * 2 > slots.size()) {
+            grow();
+        } else {
+            size_t mask = slots.size() - 1;
+            size_t slot = hash & mask;
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = group + 1;
+        }
+    }
+    return group;
+}
+
+// MIN and MAX start from the value of the first row in the group
+void Aggregator::start_extremes(uint32_t group, const RecordView& row) {
+    for (State& state : states) {
+        Function function = state.aggregate.function;
+        if (function != MIN && function != MAX) {
+            continue;
+        }
+        int column = state.aggregate.column;
+        if (state.type == ColumnType::INTEGER) {
+            state.integers[group] = row.get_integer(column);
+        } else if (state.type == ColumnType::REAL) {
+            state.reals[group] = row.get_real(column);
+        } else {
+            state.texts[group].assign(row.get_text(column));
+        }
+    }
+}
+
+void Aggregator::grow() {
+    slots.assign(slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (uint32_t group = 0; group < group_hashes.size(); ++group) {
+        size_t slot = group_hashes[group] & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = group + 1;
+    }
+}
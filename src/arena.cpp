@@ -0,0 +1,70 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/arena.h"
+#include <algorithm>
+#include <cstdint>
+
+QueryArena::Scope::Scope() {
+    local().depth++;
+}
+
+QueryArena::Scope::~Scope() {
+    QueryArena& arena = local();
+    if (--arena.depth == 0) {
+        arena.reset();
+    }
+}
+
+QueryArena& QueryArena::local() {
+    thread_local QueryArena arena;
+    return arena;
+}
+
+void QueryArena::reset() {
+    size_t retained = 0, kept = 0;
+    while (kept < blocks.size() && retained + blocks[kept].size <= RETAINED_BYTES) {
+        retained += blocks[kept++].size;
+    }
+    blocks.resize(kept);
+    current = 0;
+    used = 0;
+    allocated = 0;
+}
+
+size_t QueryArena::get_allocated_bytes() const {
+    return allocated;
+}
+
+void* QueryArena::do_allocate(size_t bytes, size_t alignment) {
+    while (true) {
+        if (current < blocks.size()) {
+            Block& block = blocks[current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            size_t start = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+            if (start + bytes <= block.size) {
+                used = start + bytes;
+                allocated += bytes;
+                return block.data.get() + start;
+            }
+            if (current + 1 < blocks.size() && blocks[current + 1].size >= bytes + alignment) {
+                current++;
+                used = 0;
+                continue;
+            }
+        }
+        // Oversized requests get a block of their own, placed after the current one
+        size_t size = std::max(BLOCK_SIZE, bytes + alignment);
+        size_t position = blocks.empty() ? 0 : current + 1;
+        blocks.insert(blocks.begin() + position, Block{std::make_unique<char[]>(size), size});
+        current = position;
+        used = 0;
+    }
+}
+
+void QueryArena::do_deallocate(void*, size_t, size_t) {}
+
+bool QueryArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
@@ -0,0 +1,538 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/btree.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Node header: [u8 type][u8 unused][u16 cell_count][u16 content_start][u16 fragmented][u32 link]
+// The link is the next leaf for leaf nodes and the rightmost child for internal nodes.
+// Cell offsets follow the header as a u16 slot array; cell contents grow down from the page end.
+// Leaf cell: [i64 key][u16 length][payload]
+// Internal cell: [i64 key][u32 child], where the child holds every key below the cell key
+constexpr uint8_t LEAF_NODE = 1;
+constexpr uint8_t INTERNAL_NODE = 2;
+constexpr size_t NODE_HEADER_SIZE = 12;
+constexpr size_t SLOT_SIZE = 2;
+constexpr size_t LEAF_CELL_HEADER_SIZE = 10;
+constexpr size_t INTERNAL_CELL_SIZE = 12;
+
+template<typename T>
+T read_at(const char* page, size_t offset) {
+    T value;
+    memcpy(&value, page + offset, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void write_at(char* page, size_t offset, T value) {
+    memcpy(page + offset, &value, sizeof(T));
+}
+
+uint8_t node_type(const char* page) { return static_cast<uint8_t>(page[0]); }
+uint16_t cell_count(const char* page) { return read_at<uint16_t>(page, 2); }
+uint16_t content_start(const char* page) { return read_at<uint16_t>(page, 4); }
+uint16_t fragmented(const char* page) { return read_at<uint16_t>(page, 6); }
+uint32_t link(const char* page) { return read_at<uint32_t>(page, 8); }
+
+void set_cell_count(char* page, uint16_t count) { write_at<uint16_t>(page, 2, count); }
+void set_content_start(char* page, uint16_t offset) { write_at<uint16_t>(page, 4, offset); }
+void set_fragmented(char* page, uint16_t bytes) { write_at<uint16_t>(page, 6, bytes); }
+void set_link(char* page, uint32_t page_id) { write_at<uint32_t>(page, 8, page_id); }
+
+uint16_t slot_offset(const char* page, uint16_t index) {
+    return read_at<uint16_t>(page, NODE_HEADER_SIZE + index * SLOT_SIZE);
+}
+
+void set_slot_offset(char* page, uint16_t index, uint16_t offset) {
+    write_at<uint16_t>(page, NODE_HEADER_SIZE + index * SLOT_SIZE, offset);
+}
+
+int64_t cell_key(const char* page, uint16_t index) {
+    return read_at<int64_t>(page, slot_offset(page, index));
+}
+
+size_t cell_size(const char* page, uint16_t index) {
+    if (node_type(page) == INTERNAL_NODE) {
+        return INTERNAL_CELL_SIZE;
+    }
+    return LEAF_CELL_HEADER_SIZE + read_at<uint16_t>(page, slot_offset(page, index) + 8);
+}
+
+page_id_t child_at(const char* page, uint16_t index) {
+    if (index >= cell_count(page)) {
+        return link(page);
+    }
+    return read_at<uint32_t>(page, slot_offset(page, index) + 8);
+}
+
+void set_child_at(char* page, uint16_t index, page_id_t child) {
+    if (index >= cell_count(page)) {
+        set_link(page, child);
+    } else {
+        write_at<uint32_t>(page, slot_offset(page, index) + 8, child);
+    }
+}
+
+void init_node(char* page, uint8_t type, uint32_t link_page_id) {
+    memset(page, 0, PAGE_SIZE);
+    page[0] = static_cast<char>(type);
+    set_content_start(page, PAGE_SIZE);
+    set_link(page, link_page_id);
+}
+
+size_t free_space(const char* page) {
+    return content_start(page) - (NODE_HEADER_SIZE + cell_count(page) * SLOT_SIZE);
+}
+
+size_t usable_space(const char* page) {
+    return free_space(page) + fragmented(page);
+}
+
+// First slot whose key is >= key
+uint16_t lower_bound(const char* page, int64_t key) {
+    uint16_t low = 0, high = cell_count(page);
+    while (low < high) {
+        uint16_t mid = (low + high) / 2;
+        if (cell_key(page, mid) < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// First slot whose key is > key, i.e. the child that covers key
+uint16_t upper_bound(const char* page, int64_t key) {
+    uint16_t low = 0, high = cell_count(page);
+    while (low < high) {
+        uint16_t mid = (low + high) / 2;
+        if (cell_key(page, mid) <= key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+std::string make_leaf_cell(int64_t key, const std::string& payload) {
+    std::string cell(LEAF_CELL_HEADER_SIZE + payload.size(), '\0');
+    write_at<int64_t>(&cell[0], 0, key);
+    write_at<uint16_t>(&cell[0], 8, static_cast<uint16_t>(payload.size()));
+    memcpy(&cell[LEAF_CELL_HEADER_SIZE], payload.data(), payload.size());
+    return cell;
+}
+
+std::string make_internal_cell(int64_t key, page_id_t child) {
+    std::string cell(INTERNAL_CELL_SIZE, '\0');
+    write_at<int64_t>(&cell[0], 0, key);
+    write_at<uint32_t>(&cell[0], 8, child);
+    return cell;
+}
+
+std::vector<std::string> collect_cells(const char* page) {
+    std::vector<std::string> cells;
+    uint16_t count = cell_count(page);
+    cells.reserve(count + 1);
+    for (uint16_t i = 0; i < count; ++i) {
+        cells.emplace_back(page + slot_offset(page, i), cell_size(page, i));
+    }
+    return cells;
+}
+
+// Moves all cells back to the end of the page so fragmented space becomes usable
+void compact(char* page) {
+    std::vector<std::string> cells = collect_cells(page);
+    uint16_t offset = PAGE_SIZE;
+    for (uint16_t i = 0; i < cells.size(); ++i) {
+        offset -= cells[i].size();
+        memcpy(page + offset, cells[i].data(), cells[i].size());
+        set_slot_offset(page, i, offset);
+    }
+    set_content_start(page, offset);
+    set_fragmented(page, 0);
+}
+
+// Caller guarantees usable_space(page) >= cell.size() + SLOT_SIZE
+void insert_cell(char* page, uint16_t index, const std::string& cell) {
+    if (free_space(page) < cell.size() + SLOT_SIZE) {
+        compact(page);
+    }
+    uint16_t count = cell_count(page);
+    uint16_t offset = content_start(page) - cell.size();
+    memcpy(page + offset, cell.data(), cell.size());
+
+    char* slots = page + NODE_HEADER_SIZE;
+    memmove(slots + (index + 1) * SLOT_SIZE, slots + index * SLOT_SIZE, (count - index) * SLOT_SIZE);
+    set_slot_offset(page, index, offset);
+    set_cell_count(page, count + 1);
+    set_content_start(page, offset);
+}
+
+void remove_cell(char* page, uint16_t index) {
+    uint16_t count = cell_count(page);
+    set_fragmented(page, fragmented(page) + cell_size(page, index));
+
+    char* slots = page + NODE_HEADER_SIZE;
+    memmove(slots + index * SLOT_SIZE, slots + (index + 1) * SLOT_SIZE, (count - index - 1) * SLOT_SIZE);
+    set_cell_count(page, count - 1);
+}
+
+// Appends a leaf cell after the last slot; the caller has checked that it fits
+void append_leaf_cell(char* page, int64_t key, const std::string& payload) {
+    uint16_t count = cell_count(page);
+    uint16_t offset = content_start(page) - (LEAF_CELL_HEADER_SIZE + payload.size());
+    write_at<int64_t>(page, offset, key);
+    write_at<uint16_t>(page, offset + 8, static_cast<uint16_t>(payload.size()));
+    memcpy(page + offset + LEAF_CELL_HEADER_SIZE, payload.data(), payload.size());
+    set_slot_offset(page, count, offset);
+    set_cell_count(page, count + 1);
+    set_content_start(page, offset);
+}
+
+void write_cells(char* page, uint8_t type, uint32_t link_page_id,
+                 const std::vector<std::string>& cells, size_t begin, size_t end) {
+    init_node(page, type, link_page_id);
+    for (size_t i = begin; i < end; ++i) {
+        insert_cell(page, i - begin, cells[i]);
+    }
+}
+
+} // namespace
+
+BTree::BTree(BufferPool& pool, page_id_t root_page_id) : pool(pool), root_page_id(root_page_id) {}
+
+page_id_t BTree::create(BufferPool& pool) {
+    PageHandle root = PageHandle::create(pool);
+    init_node(root.get_data(), LEAF_NODE, INVALID_PAGE_ID);
+    return root.get_page_id();
+}
+
+bool BTree::insert(int64_t key, const std::string& payload) {
+    if (payload.size() > MAX_PAYLOAD_SIZE) {
+        throw std::runtime_error("Row too large: " + std::to_string(payload.size()) + " bytes (max " +
+                                 std::to_string(MAX_PAYLOAD_SIZE) + ")");
+    }
+
+    bool inserted = false;
+    SplitResult result = insert_into(root_page_id, key, payload, inserted);
+    if (result.split) {
+        split_root(result);
+    }
+    return inserted;
+}
+
+bool BTree::find(int64_t key, std::string& payload) const {
+    PageHandle leaf = find_leaf(key);
+    const char* data = leaf.get_data();
+    uint16_t index = lower_bound(data, key);
+    if (index >= cell_count(data) || cell_key(data, index) != key) {
+        return false;
+    }
+    uint16_t offset = slot_offset(data, index);
+    payload.assign(data + offset + LEAF_CELL_HEADER_SIZE, read_at<uint16_t>(data, offset + 8));
+    return true;
+}
+
+bool BTree::remove(int64_t key) {
+    // Leaves are never merged; empty leaves stay in the chain and are skipped by cursors
+    PageHandle leaf = find_leaf(key);
+    char* data = leaf.get_data();
+    uint16_t index = lower_bound(data, key);
+    if (index >= cell_count(data) || cell_key(data, index) != key) {
+        return false;
+    }
+    remove_cell(data, index);
+    leaf.mark_dirty();
+    return true;
+}
+
+page_id_t BTree::get_root_page_id() const {
+    return root_page_id;
+}
+
+bool BTree::is_empty() const {
+    PageHandle root(pool, root_page_id);
+    return node_type(root.get_data()) == LEAF_NODE && cell_count(root.get_data()) == 0;
+}
+
+void BTree::bulk_load(const std::vector<Entry>& entries) {
+    if (!is_empty()) {
+        throw std::runtime_error("Bulk load needs an empty tree");
+    }
+    if (entries.empty()) {
+        return;
+    }
+
+    // Cut the entries into full leaves first, so a single leaf can go straight into the root
+    std::vector<size_t> leaf_starts;
+    size_t used = PAGE_SIZE;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const std::string& payload = entries[i].second;
+        if (payload.size() > MAX_PAYLOAD_SIZE) {
+            throw std::runtime_error("Row too large: " + std::to_string(payload.size()) + " bytes (max " +
+                                     std::to_string(MAX_PAYLOAD_SIZE) + ")");
+        }
+        if (i > 0 && entries[i].first <= entries[i - 1].first) {
+            throw std::runtime_error("Bulk load entries must be sorted by unique key");
+        }
+        size_t size = LEAF_CELL_HEADER_SIZE + payload.size() + SLOT_SIZE;
+        if (used + size > PAGE_SIZE - NODE_HEADER_SIZE) {
+            leaf_starts.push_back(i);
+            used = 0;
+        }
+        used += size;
+    }
+    leaf_starts.push_back(entries.size());
+
+    // (lowest key, page) of every node on the level being built
+    std::vector<std::pair<int64_t, page_id_t>> level;
+    PageHandle previous;
+    for (size_t leaf = 0; leaf + 1 < leaf_starts.size(); ++leaf) {
+        PageHandle page = leaf_starts.size() == 2 ? PageHandle(pool, root_page_id) : PageHandle::create(pool);
+        init_node(page.get_data(), LEAF_NODE, INVALID_PAGE_ID);
+        for (size_t i = leaf_starts[leaf]; i < leaf_starts[leaf + 1]; ++i) {
+            append_leaf_cell(page.get_data(), entries[i].first, entries[i].second);
+        }
+        page.mark_dirty();
+        if (previous.is_valid()) {
+            set_link(previous.get_data(), page.get_page_id());
+        }
+        level.emplace_back(entries[leaf_starts[leaf]].first, page.get_page_id());
+        previous = std::move(page);
+    }
+    previous.release();
+
+    // Spread each level's children evenly over as few internal nodes as
+    // possible until they all fit under the root
+    constexpr size_t MAX_CHILDREN = (PAGE_SIZE - NODE_HEADER_SIZE) / (INTERNAL_CELL_SIZE + SLOT_SIZE) + 1;
+    while (level.size() > 1) {
+        size_t groups = (level.size() + MAX_CHILDREN - 1) / MAX_CHILDREN;
+        std::vector<std::pair<int64_t, page_id_t>> parents;
+        for (size_t group = 0; group < groups; ++group) {
+            size_t begin = group * level.size() / groups;
+            size_t end = (group + 1) * level.size() / groups;
+            PageHandle page = groups == 1 ? PageHandle(pool, root_page_id) : PageHandle::create(pool);
+            init_node(page.get_data(), INTERNAL_NODE, level[end - 1].second);
+            for (size_t i = begin; i + 1 < end; ++i) {
+                insert_cell(page.get_data(), i - begin, make_internal_cell(level[i + 1].first, level[i].second));
+            }
+            page.mark_dirty();
+            parents.emplace_back(level[begin].first, page.get_page_id());
+        }
+        level = std::move(parents);
+    }
+}
+
+void BTree::get_leaf_separators(std::vector<int64_t>& separators) const {
+    separators.clear();
+    // Every leaf is at the same depth, so the leftmost path gives the height
+    int height = 0;
+    for (PageHandle page(pool, root_page_id); node_type(page.get_data()) == INTERNAL_NODE; height++) {
+        page = PageHandle(pool, child_at(page.get_data(), 0));
+    }
+    if (height > 0) {
+        collect_separators(root_page_id, height, separators);
+    }
+}
+
+// An internal node's keys separate its children's subtrees, so visiting the
+// children in order and emitting each key in between lists every separator
+void BTree::collect_separators(page_id_t page_id, int height, std::vector<int64_t>& separators) const {
+    PageHandle page(pool, page_id);
+    const char* data = page.get_data();
+    uint16_t count = cell_count(data);
+    for (uint16_t i = 0; i <= count; ++i) {
+        if (height > 1) {
+            collect_separators(child_at(data, i), height - 1, separators);
+        }
+        if (i < count) {
+            separators.push_back(cell_key(data, i));
+        }
+    }
+}
+
+BTree::SplitResult BTree::insert_into(page_id_t page_id, int64_t key, const std::string& payload, bool& inserted) {
+    PageHandle page(pool, page_id);
+    if (node_type(page.get_data()) == LEAF_NODE) {
+        return insert_into_leaf(page, key, payload, inserted);
+    }
+
+    uint16_t child_slot = upper_bound(page.get_data(), key);
+    SplitResult child_result = insert_into(child_at(page.get_data(), child_slot), key, payload, inserted);
+    if (!child_result.split) {
+        return {};
+    }
+    return insert_into_internal(page, child_slot, child_result.separator, child_result.right_page_id);
+}
+
+BTree::SplitResult BTree::insert_into_leaf(PageHandle& page, int64_t key, const std::string& payload, bool& inserted) {
+    char* data = page.get_data();
+    page.mark_dirty();
+
+    uint16_t index = lower_bound(data, key);
+    bool exists = index < cell_count(data) && cell_key(data, index) == key;
+    if (exists) {
+        remove_cell(data, index);
+    }
+    inserted = !exists;
+
+    std::string cell = make_leaf_cell(key, payload);
+    if (usable_space(data) >= cell.size() + SLOT_SIZE) {
+        insert_cell(data, index, cell);
+        return {};
+    }
+
+    // Split by bytes so both halves are guaranteed to fit
+    std::vector<std::string> cells = collect_cells(data);
+    cells.insert(cells.begin() + index, cell);
+    size_t total_bytes = 0;
+    for (const auto& c : cells) {
+        total_bytes += c.size() + SLOT_SIZE;
+    }
+    size_t left_count = 0, left_bytes = 0;
+    while (left_count < cells.size() - 1 && left_bytes < total_bytes / 2) {
+        left_bytes += cells[left_count].size() + SLOT_SIZE;
+        left_count++;
+    }
+
+    PageHandle right = PageHandle::create(pool);
+    write_cells(right.get_data(), LEAF_NODE, link(data), cells, left_count, cells.size());
+    write_cells(data, LEAF_NODE, right.get_page_id(), cells, 0, left_count);
+
+    SplitResult result;
+    result.split = true;
+    result.separator = read_at<int64_t>(cells[left_count].data(), 0);
+    result.right_page_id = right.get_page_id();
+    return result;
+}
+
+BTree::SplitResult BTree::insert_into_internal(PageHandle& page, uint16_t child_slot, int64_t separator,
+                                               page_id_t right_page_id) {
+    char* data = page.get_data();
+    page.mark_dirty();
+
+    // The split child keeps the keys below the separator and the new page takes over the rest of its range
+    page_id_t left_page_id = child_at(data, child_slot);
+    set_child_at(data, child_slot, right_page_id);
+
+    std::string cell = make_internal_cell(separator, left_page_id);
+    if (usable_space(data) >= cell.size() + SLOT_SIZE) {
+        insert_cell(data, child_slot, cell);
+        return {};
+    }
+
+    std::vector<std::string> cells = collect_cells(data);
+    cells.insert(cells.begin() + child_slot, cell);
+    size_t middle = cells.size() / 2;
+    int64_t middle_key = read_at<int64_t>(cells[middle].data(), 0);
+    page_id_t middle_child = read_at<uint32_t>(cells[middle].data(), 8);
+    uint32_t rightmost = link(data);
+
+    PageHandle right = PageHandle::create(pool);
+    write_cells(right.get_data(), INTERNAL_NODE, rightmost, cells, middle + 1, cells.size());
+    write_cells(data, INTERNAL_NODE, middle_child, cells, 0, middle);
+
+    SplitResult result;
+    result.split = true;
+    result.separator = middle_key;
+    result.right_page_id = right.get_page_id();
+    return result;
+}
+
+void BTree::split_root(const SplitResult& result) {
+    // Move the old root's contents down so the root page id stays stable
+    PageHandle root(pool, root_page_id);
+    PageHandle left = PageHandle::create(pool);
+    memcpy(left.get_data(), root.get_data(), PAGE_SIZE);
+
+    init_node(root.get_data(), INTERNAL_NODE, result.right_page_id);
+    insert_cell(root.get_data(), 0, make_internal_cell(result.separator, left.get_page_id()));
+    root.mark_dirty();
+}
+
+PageHandle BTree::find_leaf(int64_t key) const {
+    PageHandle page(pool, root_page_id);
+    while (node_type(page.get_data()) == INTERNAL_NODE) {
+        page_id_t child = child_at(page.get_data(), upper_bound(page.get_data(), key));
+        page = PageHandle(pool, child);
+    }
+    return page;
+}
+
+BTree::Cursor::Cursor(const BTree& tree) : pool(tree.pool), root_page_id(tree.root_page_id), slot(0) {}
+
+void BTree::Cursor::first() {
+    page = PageHandle(pool, root_page_id);
+    while (node_type(page.get_data()) == INTERNAL_NODE) {
+        page = PageHandle(pool, child_at(page.get_data(), 0));
+    }
+    slot = 0;
+    skip_exhausted_leaves();
+}
+
+void BTree::Cursor::seek(int64_t key) {
+    page = PageHandle(pool, root_page_id);
+    while (node_type(page.get_data()) == INTERNAL_NODE) {
+        page = PageHandle(pool, child_at(page.get_data(), upper_bound(page.get_data(), key)));
+    }
+    slot = lower_bound(page.get_data(), key);
+    skip_exhausted_leaves();
+}
+
+bool BTree::Cursor::valid() const {
+    return page.is_valid();
+}
+
+void BTree::Cursor::next() {
+    slot++;
+    skip_exhausted_leaves();
+}
+
+int64_t BTree::Cursor::key() const {
+    return cell_key(page.get_data(), slot);
+}
+
+std::string_view BTree::Cursor::payload() const {
+    const char* data = page.get_data();
+    uint16_t offset = slot_offset(data, slot);
+    return std::string_view(data + offset + LEAF_CELL_HEADER_SIZE, read_at<uint16_t>(data, offset + 8));
+}
+
+size_t BTree::Cursor::next_batch(std::vector<std::string_view>& payloads) {
+    payloads.clear();
+    if (!page.is_valid()) {
+        return 0;
+    }
+    const char* data = page.get_data();
+    uint16_t count = cell_count(data);
+    for (; slot < count; ++slot) {
+        uint16_t offset = slot_offset(data, slot);
+        payloads.emplace_back(data + offset + LEAF_CELL_HEADER_SIZE, read_at<uint16_t>(data, offset + 8));
+    }
+    page_id_t next_page_id = link(data);
+    batch_page = std::move(page);
+    if (next_page_id != INVALID_PAGE_ID) {
+        page = PageHandle(pool, next_page_id);
+        slot = 0;
+        skip_exhausted_leaves();
+    }
+    return payloads.size();
+}
+
+void BTree::Cursor::skip_exhausted_leaves() {
+    while (page.is_valid() && slot >= cell_count(page.get_data())) {
+        page_id_t next_page_id = link(page.get_data());
+        if (next_page_id == INVALID_PAGE_ID) {
+            page.release();
+            return;
+        }
+        page = PageHandle(pool, next_page_id);
+        slot = 0;
+    }
+}
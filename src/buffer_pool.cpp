@@ -0,0 +1,186 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/buffer_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+BufferPool::BufferPool(Pager& pager, size_t memory_budget) : pager(pager) {
+    capacity = std::max(memory_budget / PAGE_SIZE, MIN_FRAMES);
+    memory.reset(new char[capacity * PAGE_SIZE]);
+    frames.resize(capacity);
+}
+
+char* BufferPool::fetch_page(page_id_t page_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = page_table.find(page_id);
+    if (it != page_table.end()) {
+        Frame& frame = frames[it->second];
+        frame.pin_count++;
+        frame.referenced = true;
+        return frame_data(it->second);
+    }
+
+    size_t index = acquire_frame();
+    pager.read_page(page_id, frame_data(index));
+
+    Frame& frame = frames[index];
+    frame.page_id = page_id;
+    frame.pin_count = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    page_table[page_id] = index;
+    return frame_data(index);
+}
+
+char* BufferPool::new_page(page_id_t& page_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t index = acquire_frame();
+    page_id = pager.allocate_page();
+    memset(frame_data(index), 0, PAGE_SIZE);
+
+    Frame& frame = frames[index];
+    frame.page_id = page_id;
+    frame.pin_count = 1;
+    frame.dirty = true;
+    frame.referenced = true;
+    page_table[page_id] = index;
+    return frame_data(index);
+}
+
+void BufferPool::unpin_page(page_id_t page_id, bool dirty) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = page_table.find(page_id);
+    if (it == page_table.end()) {
+        return;
+    }
+    Frame& frame = frames[it->second];
+    if (frame.pin_count > 0) {
+        frame.pin_count--;
+    }
+    frame.dirty = frame.dirty || dirty;
+}
+
+void BufferPool::flush_all() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<page_id_t> dirty_pages;
+    for (const auto& frame : frames) {
+        if (frame.page_id != INVALID_PAGE_ID && frame.dirty) {
+            dirty_pages.push_back(frame.page_id);
+        }
+    }
+    pager.journal_pages(dirty_pages);
+
+    for (size_t i = 0; i < capacity; ++i) {
+        Frame& frame = frames[i];
+        if (frame.page_id != INVALID_PAGE_ID && frame.dirty) {
+            pager.write_page(frame.page_id, frame_data(i));
+            frame.dirty = false;
+        }
+    }
+    pager.sync();
+}
+
+size_t BufferPool::get_capacity() const {
+    return capacity;
+}
+
+// Must be called with the mutex held
+size_t BufferPool::acquire_frame() {
+    // Two full sweeps give every referenced page its second chance
+    for (size_t scanned = 0; scanned < capacity * 2; ++scanned) {
+        size_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % capacity;
+
+        Frame& frame = frames[index];
+        if (frame.page_id == INVALID_PAGE_ID) {
+            return index;
+        }
+        if (frame.pin_count > 0) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+
+        if (frame.dirty) {
+            pager.write_page(frame.page_id, frame_data(index));
+        }
+        page_table.erase(frame.page_id);
+        frame = Frame();
+        return index;
+    }
+    throw std::runtime_error("Buffer pool exhausted: all pages are pinned");
+}
+
+char* BufferPool::frame_data(size_t frame_index) {
+    return memory.get() + frame_index * PAGE_SIZE;
+}
+
+PageHandle::PageHandle() : pool(nullptr), page_id(INVALID_PAGE_ID), data(nullptr), dirty(false) {}
+
+PageHandle::PageHandle(BufferPool& pool, page_id_t page_id)
+        : pool(&pool), page_id(page_id), data(pool.fetch_page(page_id)), dirty(false) {}
+
+PageHandle::PageHandle(PageHandle&& other) noexcept
+        : pool(other.pool), page_id(other.page_id), data(other.data), dirty(other.dirty) {
+    other.pool = nullptr;
+    other.data = nullptr;
+}
+
+PageHandle& PageHandle::operator=(PageHandle&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        page_id = other.page_id;
+        data = other.data;
+        dirty = other.dirty;
+        other.pool = nullptr;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+PageHandle::~PageHandle() {
+    release();
+}
+
+PageHandle PageHandle::create(BufferPool& pool) {
+    PageHandle handle;
+    handle.pool = &pool;
+    handle.data = pool.new_page(handle.page_id);
+    handle.dirty = true;
+    return handle;
+}
+
+char* PageHandle::get_data() const {
+    return data;
+}
+
+page_id_t PageHandle::get_page_id() const {
+    return page_id;
+}
+
+bool PageHandle::is_valid() const {
+    return data != nullptr;
+}
+
+void PageHandle::mark_dirty() {
+    dirty = true;
+}
+
+void PageHandle::release() {
+    if (pool != nullptr && data != nullptr) {
+        pool->unpin_page(page_id, dirty);
+    }
+    pool = nullptr;
+    data = nullptr;
+    dirty = false;
+}
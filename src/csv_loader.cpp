@@ -0,0 +1,184 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/csv_loader.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+std::vector<BTree::Entry> CsvLoader::load(const std::string& path, const Schema& schema, bool header) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("cannot open the file");
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    std::string data = contents.str();
+
+    size_t start = 0;
+    if (header) {
+        start = data.find('\n');
+        start = start == std::string::npos ? data.size() : start + 1;
+    }
+
+    // One chunk per core, but don't bother spreading small files out
+    size_t thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    thread_count = std::max<size_t>(1, std::min(thread_count, (data.size() - start) / MIN_CHUNK_SIZE));
+    std::vector<Chunk> chunks(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        chunks[i].begin = i == 0 ? start : chunks[i - 1].end;
+        size_t end = start + (data.size() - start) * (i + 1) / thread_count;
+        if (i + 1 == thread_count) {
+            end = data.size();
+        } else if (end < chunks[i].begin) {
+            end = chunks[i].begin;
+        } else {
+            // Move the cut to just after the next line break
+            end = data.find('\n', end);
+            end = end == std::string::npos ? data.size() : end + 1;
+        }
+        chunks[i].end = end;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        threads.emplace_back(parse_chunk, std::string_view(data), std::cref(schema), std::ref(chunks[i]));
+    }
+    parse_chunk(data, schema, chunks[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const Chunk& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            size_t line = std::count(data.begin(), data.begin() + chunk.begin, '\n') + chunk.error_line;
+            throw std::runtime_error("line " + std::to_string(line) + ": " + chunk.error);
+        }
+    }
+    data.clear();
+    data.shrink_to_fit();
+
+    // Every chunk is already sorted; merge neighbours pairwise, which keeps
+    // rows from earlier in the file ahead of later ones with the same key
+    std::vector<size_t> bounds = {0};
+    size_t total = 0;
+    for (const Chunk& chunk : chunks) {
+        total += chunk.rows.size();
+        bounds.push_back(total);
+    }
+    std::vector<BTree::Entry> rows;
+    rows.reserve(total);
+    for (Chunk& chunk : chunks) {
+        std::move(chunk.rows.begin(), chunk.rows.end(), std::back_inserter(rows));
+        std::vector<BTree::Entry>().swap(chunk.rows);
+    }
+    auto less = [](const BTree::Entry& a, const BTree::Entry& b) { return a.first < b.first; };
+    for (size_t width = 1; width < chunks.size(); width *= 2) {
+        for (size_t i = 0; i + width < chunks.size(); i += 2 * width) {
+            size_t last = std::min(i + 2 * width, chunks.size());
+            std::inplace_merge(rows.begin() + bounds[i], rows.begin() + bounds[i + width],
+                               rows.begin() + bounds[last], less);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (i + 1 < rows.size() && rows[i + 1].first == rows[i].first) {
+            continue;
+        }
+        if (kept != i) {
+            rows[kept] = std::move(rows[i]);
+        }
+        kept++;
+    }
+    rows.resize(kept);
+    return rows;
+}
+
+void CsvLoader::parse_chunk(std::string_view data, const Schema& schema, Chunk& chunk) {
+    std::vector<std::string> fields;
+    std::vector<Value> values;
+    size_t line_number = 0;
+    size_t position = chunk.begin;
+    try {
+        while (position < chunk.end) {
+            size_t end = data.find('\n', position);
+            if (end == std::string_view::npos || end > chunk.end) {
+                end = chunk.end;
+            }
+            std::string_view line = data.substr(position, end - position);
+            position = end + 1;
+            line_number++;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+            split_fields(line, fields);
+            if (fields.size() != schema.size()) {
+                throw std::runtime_error("expected " + std::to_string(schema.size()) + " fields, got " +
+                                         std::to_string(fields.size()));
+            }
+            // Rather than Schema::encode, whose errors quote the value
+            values.clear();
+            for (size_t i = 0; i < fields.size(); ++i) {
+                try {
+                    values.push_back(parse_value(schema[i].type, fields[i]));
+                } catch (const std::exception&) {
+                    throw std::runtime_error(std::string("invalid ") + column_type_name(schema[i].type) +
+                                             " value for column " + schema[i].name);
+                }
+            }
+            std::string payload = schema.encode_values(values);
+            int64_t key = RecordView(schema, payload).get_integer(0);
+            chunk.rows.emplace_back(key, std::move(payload));
+        }
+    } catch (const std::exception& e) {
+        chunk.error = e.what();
+        chunk.error_line = line_number;
+        return;
+    }
+    std::stable_sort(chunk.rows.begin(), chunk.rows.end(), [](const BTree::Entry& a, const BTree::Entry& b) {
+        return a.first < b.first;
+    });
+}
+
+// Field strings are reused from the previous line to avoid reallocating them
+void CsvLoader::split_fields(std::string_view line, std::vector<std::string>& fields) {
+    size_t count = 0;
+    size_t i = 0;
+    while (true) {
+        if (count == fields.size()) {
+            fields.emplace_back();
+        }
+        std::string& field = fields[count++];
+        field.clear();
+        if (i < line.size() && line[i] == '"') {
+            for (++i; i < line.size(); ++i) {
+                if (line[i] == '"') {
+                    if (i + 1 < line.size() && line[i + 1] == '"') {
+                        ++i;
+                    } else {
+                        ++i;
+                        break;
+                    }
+                }
+                field += line[i];
+            }
+        }
+        size_t end = line.find(',', i);
+        if (end == std::string_view::npos) {
+            end = line.size();
+        }
+        field.append(line.substr(i, end - i));
+        if (end == line.size()) {
+            break;
+        }
+        i = end + 1;
+    }
+    fields.resize(count);
+}
@@ -5,64 +5,1594 @@
 #include <stdexcept>
 #include <algorithm>
 #include <iostream>
-#include <sstream>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
 
 std::vector<std::vector<std::string>> Database::execute_query(const std::string& query) {
+    std::vector<std::vector<std::string>> results;
+    execute_query(query, [&results](const std::vector<Value>& row) {
+        std::vector<std::string> cells;
+        cells.reserve(row.size());
+        for (const Value& value : row) {
+            cells.push_back(value_to_string(value));
+        }
+        results.push_back(std::move(cells));
+    });
+    return results;
+}
+
+size_t Database::execute_query(const std::string& query, const RowSink& sink) {
+    // Tokens and executor scratch are freed in one go when the query ends
+    QueryArena::Scope arena_scope;
+    Metrics::add(Metrics::QUERIES);
     try {
-        auto tokens = QueryParser::tokenize(query);
-        std::string command, table_name, condition;
-        std::vector<std::string> columns, values;
-        QueryParser::parse(tokens, command, table_name, columns, values, condition);
-
-        if (command == "SELECT") {
-            return execute_select(table_name, columns, condition);
-        } else if (command == "INSERT") {
-            execute_insert(table_name, values);
-        } else if (command == "UPDATE") {
-            execute_update(table_name, columns, values, condition);
-        } else if (command == "DELETE") {
-            execute_delete(table_name, condition);
+        std::vector<std::string> parameters;
+        std::shared_ptr<const Statement> statement = prepare_statement(query, parameters);
+        return execute_statement(*statement, parameters, sink);
+    } catch (const QueryParseError& e) {
+        Metrics::add(Metrics::QUERY_ERRORS);
+        throw std::runtime_error("Query parse error: " + std::string(e.what()));
+    } catch (const std::exception& e) {
+        Metrics::add(Metrics::QUERY_ERRORS);
+        throw std::runtime_error("Error executing query: " + std::string(e.what()));
+    }
+}
+
+// Literals are lifted out of the query text into parameters, so every query
+// with the same shape hits the same cached statement. PREPARE keeps its body
+// verbatim: inline literals there are part of the prepared statement.
+std::shared_ptr<const Statement> Database::prepare_statement(const std::string& query,
+                                                             std::vector<std::string>& parameters,
+                                                             std::string* normalized_query) {
+    if (QueryParser::first_word(query) == "PREPARE") {
+        return std::make_shared<const Statement>(QueryParser::parse(QueryParser::tokenize(query)));
+    }
+
+    auto phase_start = std::chrono::steady_clock::now();
+    std::string normalized = QueryParser::normalize(query, parameters);
+    Metrics::record(Metrics::NORMALIZE, phase_start);
+    if (normalized_query != nullptr) {
+        *normalized_query = normalized;
+    }
+    if (auto cached = statement_cache.find(normalized)) {
+        return cached;
+    }
+    phase_start = std::chrono::steady_clock::now();
+    QueryParser::TokenList tokens = QueryParser::tokenize(normalized);
+    Metrics::record(Metrics::TOKENIZE, phase_start);
+    phase_start = std::chrono::steady_clock::now();
+    auto statement = std::make_shared<const Statement>(QueryParser::parse(tokens));
+    Metrics::record(Metrics::PARSE, phase_start);
+    const std::string& command = statement->command;
+    if (command == "SELECT" || command == "INSERT" || command == "UPDATE" || command == "DELETE" ||
+        command == "EXECUTE") {
+        statement_cache.insert(normalized, statement);
+    }
+    return statement;
+}
+
+namespace {
+
+void check_parameter_count(const Statement& statement, const std::vector<std::string>& parameters) {
+    if (parameters.size() != statement.parameter_count) {
+        throw std::runtime_error("Statement expects " + std::to_string(statement.parameter_count) +
+                                 " parameter(s), got " + std::to_string(parameters.size()));
+    }
+}
+
+} // namespace
+
+// Returns the number of rows produced or changed
+size_t Database::execute_statement(const Statement& statement, const std::vector<std::string>& parameters,
+                                   const RowSink& sink) {
+    check_parameter_count(statement, parameters);
+    const std::string& command = statement.command;
+    const std::string& table_name = statement.table_name;
+    const std::vector<std::string>& columns = statement.columns;
+    size_t row_count = 0;
+    uint64_t lsn = 0;
+    if (command == "SELECT") {
+        return execute_select(statement, parameters, sink);
+    } else if (command == "INSERT") {
+        row_count = execute_insert(table_name, statement.bind_values(parameters), statement.row_count, lsn);
+    } else if (command == "UPDATE") {
+        row_count = execute_update(table_name, columns, statement.bind_values(parameters), statement.condition.get(),
+                                   parameters, lsn);
+    } else if (command == "DELETE") {
+        row_count = execute_delete(table_name, statement.condition.get(), parameters, lsn);
+    } else if (command == "CREATE TABLE") {
+        std::vector<Column> definitions;
+        for (size_t i = 0; i < columns.size(); ++i) {
+            definitions.push_back(make_column(columns[i], statement.values[i]));
+        }
+        create_table(table_name, definitions);
+        return 0;
+    } else if (command == "CREATE INDEX") {
+        create_index(table_name, columns[0], parse_index_type(statement.values[0]));
+        return 0;
+    } else if (command == "PREPARE") {
+        std::lock_guard<std::mutex> lock(prepared_mutex);
+        prepared_statements[statement.statement_name] = statement.prepared;
+        return 0;
+    } else if (command == "EXECUTE") {
+        std::shared_ptr<const Statement> prepared = find_prepared_statement(statement.statement_name);
+        return execute_statement(*prepared, statement.bind_values(parameters), sink);
+    } else if (command == "DEALLOCATE") {
+        std::lock_guard<std::mutex> lock(prepared_mutex);
+        if (prepared_statements.erase(statement.statement_name) == 0) {
+            throw std::runtime_error("Prepared statement not found: " + statement.statement_name);
+        }
+        return 0;
+    } else if (command == "COPY") {
+        std::vector<std::string> values = statement.bind_values(parameters);
+        return execute_copy(table_name, values[0], values[1] == "HEADER");
+    } else if (command == "SAVE") {
+        checkpoint();
+        return 0;
+    } else if (command == "SHOW CACHE") {
+        StatementCache::Stats stats = statement_cache.get_stats();
+        sink({std::string("hits"), static_cast<int64_t>(stats.hits)});
+        sink({std::string("misses"), static_cast<int64_t>(stats.misses)});
+        sink({std::string("entries"), static_cast<int64_t>(stats.entries)});
+        sink({std::string("capacity"), static_cast<int64_t>(stats.capacity)});
+        return 4;
+    } else if (command == "STATS") {
+        return write_stats(sink);
+    } else if (command == "EXPLAIN" || command == "EXPLAIN ANALYZE") {
+        return execute_explain(statement, parameters, sink);
+    } else {
+        throw std::runtime_error("Unknown command: " + command);
+    }
+
+    Metrics::add(Metrics::ROWS_CHANGED, row_count);
+    // Only acknowledge once the log says the change is durable. Waiting for
+    // this statement's last record rather than the log's newest keeps other
+    // writers' later records out of its wait.
+    wal.commit(lsn);
+    if (wal.get_size() > checkpoint_wal_size) {
+        checkpoint();
+    }
+    return row_count;
+}
+
+std::shared_ptr<const Statement> Database::find_prepared_statement(const std::string& name) {
+    std::lock_guard<std::mutex> lock(prepared_mutex);
+    auto it = prepared_statements.find(name);
+    if (it == prepared_statements.end()) {
+        throw std::runtime_error("Prepared statement not found: " + name);
+    }
+    return it->second;
+}
+
+// Runs the explained statement under a profile and returns its plan as
+// ("plan", line) rows. Plain EXPLAIN reads and changes nothing. EXPLAIN
+// ANALYZE really runs the statement, so an explained UPDATE or DELETE changes
+// the table, and adds row counts, the time of every operator in microseconds
+// and the query arena bytes used; result rows are dropped.
+size_t Database::execute_explain(const Statement& statement, const std::vector<std::string>& parameters,
+                                 const RowSink& sink) {
+    std::shared_ptr<const Statement> explained = statement.prepared;
+    std::vector<std::string> explained_parameters = parameters;
+    if (explained->command == "EXECUTE") {
+        explained_parameters = explained->bind_values(parameters);
+        explained = find_prepared_statement(explained->statement_name);
+        if (explained->command == "INSERT") {
+            throw std::runtime_error("Only SELECT, UPDATE and DELETE can be explained");
+        }
+    }
+    bool analyze = statement.command == "EXPLAIN ANALYZE";
+    QueryProfile profile(!analyze);
+    auto start = std::chrono::steady_clock::now();
+    size_t result_count;
+    {
+        QueryProfile::Scope profile_scope(&profile);
+        result_count = execute_statement(*explained, explained_parameters, [](const std::vector<Value>&) {});
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t row_count = 0;
+    for (const std::string& line : profile.get_plan()) {
+        sink({std::string("plan"), line});
+        row_count++;
+    }
+    if (!analyze) {
+        return row_count;
+    }
+    sink({std::string(explained->command == "SELECT" ? "rows_returned" : "rows_changed"),
+          static_cast<int64_t>(result_count)});
+    sink({std::string("rows_examined"), static_cast<int64_t>(profile.get_rows_examined())});
+    sink({std::string("rows_matched"), static_cast<int64_t>(profile.get_rows_matched())});
+    for (int op = 0; op < QueryProfile::OPERATOR_COUNT; ++op) {
+        auto profile_op = static_cast<QueryProfile::Operator>(op);
+        sink({std::string(QueryProfile::get_name(profile_op)) + "_us",
+              static_cast<double>(profile.get_nanoseconds(profile_op)) / 1000.0});
+    }
+    sink({std::string("total_us"),
+          static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / 1000.0});
+    sink({std::string("arena_bytes"), static_cast<int64_t>(profile.get_arena_bytes())});
+    return row_count + 5 + QueryProfile::OPERATOR_COUNT;
+}
+
+// One row per counter, then count, mean and percentiles in microseconds for
+// every timer that has recorded something
+size_t Database::write_stats(const RowSink& sink) {
+    Metrics::Snapshot snapshot = Metrics::snapshot();
+    size_t row_count = 0;
+    for (int c = 0; c < Metrics::COUNTER_COUNT; ++c) {
+        sink({std::string(Metrics::get_name(static_cast<Metrics::Counter>(c))),
+              static_cast<int64_t>(snapshot.counters[c])});
+        row_count++;
+    }
+    for (int t = 0; t < Metrics::TIMER_COUNT; ++t) {
+        const Metrics::Histogram& histogram = snapshot.timers[t];
+        if (histogram.count == 0) {
+            continue;
+        }
+        std::string name = Metrics::get_name(static_cast<Metrics::Timer>(t));
+        sink({name + "_count", static_cast<int64_t>(histogram.count)});
+        sink({name + "_mean_us", static_cast<double>(histogram.sum) / static_cast<double>(histogram.count) / 1000.0});
+        for (auto [label, fraction] : {std::make_pair("_p50_us", 0.5), std::make_pair("_p90_us", 0.9),
+                                       std::make_pair("_p99_us", 0.99), std::make_pair("_p999_us", 0.999)}) {
+            sink({name + label, static_cast<double>(histogram.percentile(fraction)) / 1000.0});
+        }
+        sink({name + "_max_us", static_cast<double>(histogram.max) / 1000.0});
+        row_count += 7;
+    }
+    return row_count;
+}
+
+StatementCache::Stats Database::get_statement_cache_stats() const {
+    return statement_cache.get_stats();
+}
+
+namespace {
+
+// Catalog page layout: [magic][u32 version][u32 table_count] followed by one entry per table:
+// [u16 name_len][name][u32 root_page_id][i64 row_count][u16 column_count]{[u16 len][column][u8 type]}
+// [u16 index_count]{[u16 len][column][u8 index_type]}
+// A DICT column has DICT_COLUMN set in its type, followed by [u32 dictionary_root_page_id].
+// Version 3 is the same without DICT columns.
+constexpr page_id_t CATALOG_PAGE_ID = 0;
+constexpr char CATALOG_MAGIC[8] = {'S', 'Q', 'L', 'C', 'L', 'O', 'N', 'E'};
+constexpr uint32_t CATALOG_VERSION = 4;
+constexpr uint8_t DICT_COLUMN = 0x80;
+
+// Dictionary values are stored whole in a tree payload, and logged behind their column number
+static_assert(Dictionary::MAX_VALUE_SIZE + sizeof(uint16_t) <= BTree::MAX_PAYLOAD_SIZE);
+
+class PageWriter {
+public:
+    explicit PageWriter(char* page) : page(page), offset(0) {}
+
+    template<typename T>
+    void write(T value) {
+        reserve(sizeof(T));
+        memcpy(page + offset, &value, sizeof(T));
+        offset += sizeof(T);
+    }
+
+    void write_string(const std::string& value) {
+        write<uint16_t>(static_cast<uint16_t>(value.size()));
+        reserve(value.size());
+        memcpy(page + offset, value.data(), value.size());
+        offset += value.size();
+    }
+
+private:
+    char* page;
+    size_t offset;
+
+    void reserve(size_t size) {
+        if (offset + size > PAGE_SIZE) {
+            throw std::runtime_error("Catalog is full");
+        }
+    }
+};
+
+class PageReader {
+public:
+    explicit PageReader(const char* page) : page(page), offset(0) {}
+
+    template<typename T>
+    T read() {
+        check(sizeof(T));
+        T value;
+        memcpy(&value, page + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    std::string read_string() {
+        uint16_t length = read<uint16_t>();
+        check(length);
+        std::string value(page + offset, length);
+        offset += length;
+        return value;
+    }
+
+private:
+    const char* page;
+    size_t offset;
+
+    void check(size_t size) {
+        if (offset + size > PAGE_SIZE) {
+            throw std::runtime_error("Corrupt catalog page");
+        }
+    }
+};
+
+// Comparisons that must all hold: the leaves of the top-level AND chain
+void collect_conjuncts(const Expression* expression, std::vector<const Expression*>& conjuncts) {
+    if (expression == nullptr) {
+        return;
+    }
+    if (expression->kind == Expression::AND) {
+        collect_conjuncts(expression->left.get(), conjuncts);
+        collect_conjuncts(expression->right.get(), conjuncts);
+    } else if (expression->kind == Expression::COMPARISON) {
+        conjuncts.push_back(expression);
+    }
+}
+
+// Binds a conjunct's literal for an index probe; false when the index can't
+// answer it (e.g. a fractional bound on an INTEGER column)
+bool bind_index_key(const Table& table, const Expression* conjunct, const std::vector<std::string>& parameters,
+                    int& column, Value& key) {
+    column = table.get_column_index(conjunct->column);
+    if (column == -1 || conjunct->op == Expression::NE) {
+        return false;
+    }
+    ColumnType type = table.get_schema()[column].type;
+    key = bind_literal(type, conjunct->get_literal(parameters));
+    return type != ColumnType::INTEGER || std::holds_alternative<int64_t>(key);
+}
+
+// Narrows [lower, upper] to the primary key bounds among the AND-ed
+// comparisons. Returns false when there are none.
+bool find_key_range(const Table& table, const Expression* condition, const std::vector<std::string>& parameters,
+                    int64_t& lower, int64_t& upper) {
+    std::vector<const Expression*> conjuncts;
+    collect_conjuncts(condition, conjuncts);
+
+    bool found = false;
+    int column;
+    Value key;
+    for (const Expression* conjunct : conjuncts) {
+        if (conjunct->op == Expression::EQ || !bind_index_key(table, conjunct, parameters, column, key) ||
+            column != 0) {
+            continue;
+        }
+        int64_t bound = std::get<int64_t>(key);
+        switch (conjunct->op) {
+            case Expression::GT:
+                if (bound == INT64_MAX) {
+                    lower = INT64_MAX;
+                    upper = INT64_MIN;
+                } else {
+                    lower = std::max(lower, bound + 1);
+                }
+                break;
+            case Expression::GE: lower = std::max(lower, bound); break;
+            case Expression::LT:
+                if (bound == INT64_MIN) {
+                    lower = INT64_MAX;
+                    upper = INT64_MIN;
+                } else {
+                    upper = std::min(upper, bound - 1);
+                }
+                break;
+            case Expression::LE: upper = std::min(upper, bound); break;
+            default: break;
+        }
+        found = true;
+    }
+    return found;
+}
+
+enum AccessPath { SCAN, PRIMARY_KEY_LOOKUP, INDEX_LOOKUP, INDEX_RANGE };
+
+// Access path choice over the AND-ed comparisons, best first: a primary key
+// point lookup, an index equality lookup, then (unless the caller has a
+// primary key range to scan instead) an ordered index range with both bounds
+// merged. Returns SCAN when a scan will do. Without keys it only says which
+// path applies; index, when given, is set to the index it would use.
+AccessPath find_candidate_keys(const Table& table, const Expression* condition,
+                               const std::vector<std::string>& parameters, bool use_index_range,
+                               std::vector<int64_t>* keys, const SecondaryIndex** index = nullptr) {
+    std::vector<const Expression*> conjuncts;
+    collect_conjuncts(condition, conjuncts);
+
+    int column;
+    Value key;
+    for (const Expression* conjunct : conjuncts) {
+        if (conjunct->op == Expression::EQ && bind_index_key(table, conjunct, parameters, column, key) && column == 0) {
+            if (keys != nullptr) {
+                keys->push_back(std::get<int64_t>(key));
+            }
+            return PRIMARY_KEY_LOOKUP;
+        }
+    }
+
+    for (const Expression* conjunct : conjuncts) {
+        if (conjunct->op != Expression::EQ || !bind_index_key(table, conjunct, parameters, column, key)) {
+            continue;
+        }
+        if (const SecondaryIndex* equal_index = table.find_index(column, false)) {
+            if (keys != nullptr) {
+                equal_index->find_equal(key, *keys);
+                std::sort(keys->begin(), keys->end());
+            }
+            if (index != nullptr) {
+                *index = equal_index;
+            }
+            return INDEX_LOOKUP;
+        }
+    }
+
+    if (!use_index_range) {
+        return SCAN;
+    }
+    const SecondaryIndex* range_index = nullptr;
+    Value lower, upper;
+    bool has_lower = false, has_upper = false, lower_inclusive = false, upper_inclusive = false;
+    for (const Expression* conjunct : conjuncts) {
+        if (conjunct->op == Expression::EQ || !bind_index_key(table, conjunct, parameters, column, key)) {
+            continue;
+        }
+        const SecondaryIndex* index = table.find_index(column, true);
+        if (index == nullptr || (range_index != nullptr && index != range_index)) {
+            continue;
+        }
+        range_index = index;
+        bool inclusive = conjunct->op == Expression::LE || conjunct->op == Expression::GE;
+        if (conjunct->op == Expression::GT || conjunct->op == Expression::GE) {
+            int cmp = has_lower ? compare_values(key, lower) : 1;
+            if (cmp > 0 || (cmp == 0 && !inclusive)) {
+                lower = key;
+                lower_inclusive = inclusive;
+            }
+            has_lower = true;
         } else {
-            throw std::runtime_error("Unknown command: " + command);
+            int cmp = has_upper ? compare_values(key, upper) : -1;
+            if (cmp < 0 || (cmp == 0 && !inclusive)) {
+                upper = key;
+                upper_inclusive = inclusive;
+            }
+            has_upper = true;
+        }
+    }
+    if (range_index == nullptr) {
+        return SCAN;
+    }
+    if (keys != nullptr) {
+        range_index->find_range(has_lower ? &lower : nullptr, lower_inclusive,
+                                has_upper ? &upper : nullptr, upper_inclusive, *keys);
+        // Visit rows in key order, which also keeps B+tree page accesses local
+        std::sort(keys->begin(), keys->end());
+    }
+    if (index != nullptr) {
+        *index = range_index;
+    }
+    return INDEX_RANGE;
+}
+
+// Adds the plan line for reading a table with the given condition when the
+// query is being explained: a lookup, or a scan over morsel_count morsels
+// when it runs in parallel
+void note_access(const std::string& name, const Table& table, const Expression* condition,
+                 const std::vector<std::string>& parameters, size_t morsel_count) {
+    QueryProfile* profile = QueryProfile::current();
+    if (profile == nullptr) {
+        return;
+    }
+    int64_t lower = INT64_MIN, upper = INT64_MAX;
+    bool key_range = find_key_range(table, condition, parameters, lower, upper);
+    const SecondaryIndex* index = nullptr;
+    std::string line;
+    switch (find_candidate_keys(table, condition, parameters, !key_range, nullptr, &index)) {
+        case PRIMARY_KEY_LOOKUP:
+            line = "SEARCH " + name + " USING PRIMARY KEY";
+            break;
+        case INDEX_LOOKUP:
+        case INDEX_RANGE:
+            line = "SEARCH " + name + " USING " + index_type_name(index->get_type()) + " INDEX ON " +
+                   index->get_column_name();
+            break;
+        case SCAN:
+            line = "SCAN " + name + (key_range ? " PRIMARY KEY RANGE" : "");
+            if (morsel_count > 0) {
+                line += " IN " + std::to_string(morsel_count) + " PARALLEL MORSELS";
+            }
+            break;
+    }
+    if (condition != nullptr) {
+        line += " WHERE " + condition->to_string();
+    }
+    profile->note(std::move(line));
+}
+
+// Scans keys in [lower, upper], filtering a whole leaf page of rows per predicate call
+void scan_matches(const Table& table, const CompiledPredicate& predicate, int64_t lower, int64_t upper,
+                  const BatchVisitor& visitor) {
+    QueryProfile* profile = QueryProfile::current();
+    if (profile != nullptr && profile->is_plan_only()) {
+        return;
+    }
+    QueryProfile::Phase phase(QueryProfile::SCAN);
+    auto pass_on = [&](const RecordView* rows, size_t count) {
+        QueryProfile::Phase consumer(phase.get_previous());
+        return visitor(rows, count);
+    };
+    std::pmr::vector<uint8_t> selection(&QueryArena::local());
+    std::pmr::vector<RecordView> matches(&QueryArena::local());
+    table.scan_batches([&](const RecordView* rows, size_t count) {
+        if (predicate.is_trivial()) {
+            if (profile != nullptr) {
+                profile->count_rows(count, count);
+            }
+            return pass_on(rows, count);
+        }
+        selection.assign(count, 1);
+        predicate.filter(rows, count, selection.data());
+        matches.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (selection[i]) {
+                matches.push_back(rows[i]);
+            }
+        }
+        if (profile != nullptr) {
+            profile->count_rows(count, matches.size());
+        }
+        return matches.empty() || pass_on(matches.data(), matches.size());
+    }, lower, upper);
+}
+
+// Hands the matching rows to the visitor a batch at a time, in primary key
+// order, until it returns false. Index lookups test candidates one row at a
+// time; scans filter a whole leaf page of rows per predicate call.
+void for_each_match_batch(const Table& table, const Expression* condition, const std::vector<std::string>& parameters,
+                          const BatchVisitor& visitor) {
+    QueryProfile* profile = QueryProfile::current();
+    if (profile != nullptr && profile->is_plan_only()) {
+        return;
+    }
+    const Schema& schema = table.get_schema();
+    CompiledPredicate predicate = CompiledPredicate::compile(condition, schema, parameters);
+    int64_t lower = INT64_MIN, upper = INT64_MAX;
+    bool key_range = find_key_range(table, condition, parameters, lower, upper);
+    std::vector<int64_t> keys;
+    AccessPath path;
+    {
+        QueryProfile::Phase phase(QueryProfile::SCAN);
+        path = find_candidate_keys(table, condition, parameters, !key_range, &keys);
+    }
+    if (path == SCAN) {
+        scan_matches(table, predicate, lower, upper, visitor);
+        return;
+    }
+
+    QueryProfile::Phase phase(QueryProfile::SCAN);
+    std::pmr::vector<RecordView> matches(&QueryArena::local());
+    std::vector<std::string> payloads(CompiledPredicate::BATCH_SIZE);
+    for (size_t start = 0; start < keys.size(); start += CompiledPredicate::BATCH_SIZE) {
+        size_t end = std::min(keys.size(), start + CompiledPredicate::BATCH_SIZE);
+        matches.clear();
+        for (size_t i = start; i < end; ++i) {
+            std::string& payload = payloads[i - start];
+            if (table.lookup(keys[i], payload) && predicate.matches(RecordView(schema, payload))) {
+                matches.emplace_back(schema, payload);
+            }
+        }
+        if (profile != nullptr) {
+            profile->count_rows(end - start, matches.size());
+        }
+        if (!matches.empty()) {
+            QueryProfile::Phase consumer(phase.get_previous());
+            if (!visitor(matches.data(), matches.size())) {
+                return;
+            }
+        }
+    }
+}
+
+using KeyRange = std::pair<int64_t, int64_t>;
+using MorselVisitor = std::function<void(size_t morsel, size_t participant, const RecordView* rows, size_t count)>;
+
+// A morsel is a key range of about this many leaves, large enough that
+// scheduling costs nothing next to scanning it
+constexpr size_t MORSEL_LEAVES = 32;
+
+// Cuts [lower, upper] into morsels along the leaf boundaries
+std::vector<KeyRange> split_into_morsels(const Table& table, int64_t lower, int64_t upper) {
+    std::vector<int64_t> separators;
+    table.get_leaf_separators(separators);
+    auto first = std::upper_bound(separators.begin(), separators.end(), lower);
+    auto last = std::upper_bound(first, separators.end(), upper);
+    std::vector<KeyRange> morsels;
+    int64_t start = lower;
+    for (auto cut = first; last - cut > static_cast<ptrdiff_t>(MORSEL_LEAVES); ) {
+        cut += MORSEL_LEAVES;
+        morsels.emplace_back(start, *cut - 1);
+        start = *cut;
+    }
+    morsels.emplace_back(start, upper);
+    return morsels;
+}
+
+// Scans the morsels on the pool. Rows of one morsel arrive in key order on one
+// participant; different morsels may be visited at the same time.
+void scan_morsels(ThreadPool& pool, const Table& table, const Expression* condition,
+                  const std::vector<std::string>& parameters, const std::vector<KeyRange>& morsels,
+                  const MorselVisitor& visitor) {
+    QueryProfile* profile = QueryProfile::current();
+    if (profile != nullptr && profile->is_plan_only()) {
+        return;
+    }
+    CompiledPredicate predicate = CompiledPredicate::compile(condition, table.get_schema(), parameters);
+    // The pool's threads work for the same profile, handing their rows to the
+    // caller's operator; the caller's own wait counts as scanning
+    QueryProfile::Operator consumer = QueryProfile::current_operator();
+    QueryProfile::Phase phase(QueryProfile::SCAN);
+    pool.run(morsels.size(), [&](size_t morsel, size_t participant) {
+        QueryArena::Scope arena_scope;
+        QueryProfile::Scope profile_scope(profile, consumer);
+        scan_matches(table, predicate, morsels[morsel].first, morsels[morsel].second,
+                     [&](const RecordView* rows, size_t count) {
+            visitor(morsel, participant, rows, count);
+            return true;
+        });
+    });
+}
+
+void for_each_match(const Table& table, const Expression* condition, const std::vector<std::string>& parameters,
+                    const std::function<bool(const RecordView& row)>& visitor) {
+    for_each_match_batch(table, condition, parameters, [&visitor](const RecordView* rows, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!visitor(rows[i])) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+// Reads the given columns of a row into values
+void read_row(const Schema& schema, const RecordView& row, const std::vector<int>& columns,
+              std::vector<Value>& values) {
+    values.resize(columns.size());
+    for (size_t i = 0; i < columns.size(); ++i) {
+        int column = columns[i];
+        switch (schema[column].type) {
+            case ColumnType::INTEGER: values[i] = row.get_integer(column); break;
+            case ColumnType::REAL: values[i] = row.get_real(column); break;
+            case ColumnType::TEXT:
+                // Reuse the capacity of the string already in the cell
+                if (auto* text = std::get_if<std::string>(&values[i])) {
+                    text->assign(row.get_text(column));
+                } else {
+                    values[i] = std::string(row.get_text(column));
+                }
+                break;
+        }
+    }
+}
+
+void project(const std::vector<Value>& row, const std::vector<int>& columns, std::vector<Value>& values) {
+    values.resize(columns.size());
+    for (size_t i = 0; i < columns.size(); ++i) {
+        values[i] = row[columns[i]];
+    }
+}
+
+// Comparison columns and directions for ORDER BY; earlier rows in scan order win ties
+bool comes_before(const std::vector<Value>& a, const std::vector<Value>& b,
+                  const std::vector<std::pair<int, bool>>& sort_columns) {
+    for (const auto& [column, descending] : sort_columns) {
+        int cmp = compare_values(a[column], b[column]);
+        if (cmp != 0) {
+            return descending ? cmp > 0 : cmp < 0;
+        }
+    }
+    return false;
+}
+
+void collect_columns(const Expression* expression, std::vector<std::string>& columns) {
+    if (expression == nullptr) {
+        return;
+    }
+    if (expression->kind == Expression::COMPARISON) {
+        columns.push_back(expression->column);
+    }
+    collect_columns(expression->left.get(), columns);
+    collect_columns(expression->right.get(), columns);
+}
+
+size_t parse_row_count(const std::string& text, const char* clause) {
+    int64_t count = std::get<int64_t>(parse_value(ColumnType::INTEGER, text));
+    if (count < 0) {
+        throw std::runtime_error(std::string(clause) + " must not be negative");
+    }
+    return static_cast<size_t>(count);
+}
+
+// Top-level AND-ed parts of a condition, each of any kind
+void split_conjuncts(const Expression* expression, std::vector<const Expression*>& conjuncts) {
+    if (expression == nullptr) {
+        return;
+    }
+    if (expression->kind == Expression::AND) {
+        split_conjuncts(expression->left.get(), conjuncts);
+        split_conjuncts(expression->right.get(), conjuncts);
+    } else {
+        conjuncts.push_back(expression);
+    }
+}
+
+// Runs a scan (or join) and passes its rows to the visitor in batches
+using BatchSource = std::function<void(const BatchVisitor& visitor)>;
+
+// Where a query's rows come from. scan visits them one batch at a time, in
+// order, until the visitor returns false. When morsel_count is set the rows
+// can also be visited as that many morsels by scan_morsels, spread over
+// participant_count threads.
+struct RowSource {
+    BatchSource scan;
+    size_t morsel_count = 0;
+    size_t participant_count = 1;
+    std::function<void(const MorselVisitor& visitor)> scan_morsels;
+};
+
+bool is_aggregate_query(const Statement& statement, const Schema& schema) {
+    bool aggregate = !statement.group_by.empty() || statement.having != nullptr;
+    Aggregator::Aggregate call;
+    for (const std::string& name : statement.columns) {
+        aggregate = aggregate || Aggregator::parse_aggregate(name, schema, call);
+    }
+    return aggregate;
+}
+
+// Schema columns of the selected names, with * expanded
+std::vector<int> resolve_projection(const Schema& schema, const Statement& statement) {
+    std::vector<int> projection;
+    for (const std::string& name : statement.columns) {
+        if (name == "*") {
+            for (size_t i = 0; i < schema.size(); ++i) {
+                projection.push_back(static_cast<int>(i));
+            }
+            continue;
+        }
+        int column = schema.get_column_index(name);
+        if (column == -1) {
+            throw std::runtime_error("Column not found: " + name);
+        }
+        projection.push_back(column);
+    }
+    return projection;
+}
+
+// Projects, orders and limits the rows of a source. key_ordered says that the
+// source produces rows in order of the first column, so ORDER BY on it
+// ascending costs nothing and the scan can stop as soon as the limit is met.
+size_t emit_rows(const Schema& schema, const RowSource& source, const Statement& statement, bool key_ordered,
+                 size_t limit, size_t offset, const RowSink& sink) {
+    std::vector<int> projection = resolve_projection(schema, statement);
+    std::vector<int> all_columns;
+    for (size_t i = 0; i < schema.size(); ++i) {
+        all_columns.push_back(static_cast<int>(i));
+    }
+    std::vector<std::pair<int, bool>> sort_columns;
+    for (const OrderTerm& term : statement.order_by) {
+        int column = schema.get_column_index(term.column);
+        if (column == -1) {
+            throw std::runtime_error("ORDER BY column not found: " + term.column);
+        }
+        sort_columns.emplace_back(column, term.descending);
+    }
+    bool sorted = !sort_columns.empty() &&
+                  !(key_ordered && sort_columns.size() == 1 && sort_columns[0] == std::make_pair(0, false));
+    size_t keep = limit > SIZE_MAX - offset ? SIZE_MAX : limit + offset;
+    if (QueryProfile* profile = QueryProfile::current(); profile != nullptr && sorted) {
+        std::string line = "SORT BY ";
+        for (size_t i = 0; i < statement.order_by.size(); ++i) {
+            const OrderTerm& term = statement.order_by[i];
+            line += (i > 0 ? ", " : "") + term.column + (term.descending ? " DESC" : "");
+        }
+        profile->note(keep == SIZE_MAX ? line : line + " KEEPING THE FIRST " + std::to_string(keep));
+    }
+    if (limit == 0) {
+        return 0;
+    }
+
+    QueryProfile::Phase phase(sorted ? QueryProfile::SORT : QueryProfile::OUTPUT);
+    if (!sorted) {
+        // One row buffer for the whole scan; TEXT cells reuse their capacity
+        std::vector<Value> row_values;
+        size_t skipped = 0, row_count = 0;
+        if (source.morsel_count > 0 && limit == SIZE_MAX) {
+            // Each morsel's rows are kept apart and sent in morsel order
+            std::vector<std::vector<std::vector<Value>>> morsel_rows(source.morsel_count);
+            source.scan_morsels([&](size_t morsel, size_t, const RecordView* rows, size_t count) {
+                for (size_t i = 0; i < count; ++i) {
+                    morsel_rows[morsel].emplace_back();
+                    read_row(schema, rows[i], projection, morsel_rows[morsel].back());
+                }
+            });
+            for (auto& rows : morsel_rows) {
+                for (const std::vector<Value>& row : rows) {
+                    if (skipped < offset) {
+                        skipped++;
+                        continue;
+                    }
+                    sink(row);
+                    row_count++;
+                }
+                rows = {};
+            }
+            return row_count;
+        }
+        source.scan([&](const RecordView* rows, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                if (skipped < offset) {
+                    skipped++;
+                    continue;
+                }
+                read_row(schema, rows[i], projection, row_values);
+                sink(row_values);
+                if (++row_count == limit) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        return row_count;
+    }
+
+    // Otherwise keep the best offset + limit rows in a heap whose top is the
+    // worst of them. Ties keep scan order.
+    struct RankedRow {
+        std::vector<Value> values;
+        size_t sequence;
+    };
+    auto before = [&sort_columns](const RankedRow& a, const RankedRow& b) {
+        if (comes_before(a.values, b.values, sort_columns)) {
+            return true;
+        }
+        return !comes_before(b.values, a.values, sort_columns) && a.sequence < b.sequence;
+    };
+    auto offer = [&](auto& ranked, RankedRow& candidate) {
+        if (ranked.size() < keep) {
+            ranked.push_back(candidate);
+            if (ranked.size() == keep) {
+                std::make_heap(ranked.begin(), ranked.end(), before);
+            }
+        } else if (before(candidate, ranked.front())) {
+            std::pop_heap(ranked.begin(), ranked.end(), before);
+            std::swap(ranked.back(), candidate);
+            std::push_heap(ranked.begin(), ranked.end(), before);
+        }
+    };
+    std::pmr::vector<RankedRow> ranked(&QueryArena::local());
+    if (source.morsel_count > 0) {
+        // One heap per participant, merged at the end. Sequences count within
+        // each morsel, with the morsel number above, so ties still keep scan order.
+        std::vector<std::vector<RankedRow>> heaps(source.participant_count);
+        std::vector<RankedRow> candidates(source.participant_count);
+        std::vector<size_t> sequences(source.morsel_count, 0);
+        source.scan_morsels([&](size_t morsel, size_t participant, const RecordView* rows, size_t count) {
+            RankedRow& candidate = candidates[participant];
+            for (size_t i = 0; i < count; ++i) {
+                read_row(schema, rows[i], all_columns, candidate.values);
+                candidate.sequence = (static_cast<size_t>(morsel) << 32) | sequences[morsel]++;
+                offer(heaps[participant], candidate);
+            }
+        });
+        for (std::vector<RankedRow>& heap : heaps) {
+            for (RankedRow& row : heap) {
+                ranked.push_back(std::move(row));
+            }
+        }
+    } else {
+        RankedRow candidate;
+        size_t sequence = 0;
+        source.scan([&](const RecordView* rows, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                read_row(schema, rows[i], all_columns, candidate.values);
+                candidate.sequence = sequence++;
+                offer(ranked, candidate);
+            }
+            return true;
+        });
+    }
+
+    std::sort(ranked.begin(), ranked.end(), before);
+    ranked.resize(std::min(ranked.size(), keep));
+    QueryProfile::Phase output(QueryProfile::OUTPUT);
+    std::vector<Value> row_values;
+    size_t row_count = 0;
+    for (size_t i = offset; i < ranked.size(); ++i) {
+        project(ranked[i].values, projection, row_values);
+        sink(row_values);
+        row_count++;
+    }
+    return row_count;
+}
+
+// Result rows of an aggregate query hold the GROUP BY columns followed by
+// every aggregate the select list, HAVING or ORDER BY mentions. HAVING is
+// compiled against that layout like a WHERE clause against a table.
+size_t aggregate_rows(const Schema& schema, const RowSource& source, const Statement& statement,
+                      const std::vector<std::string>& parameters, size_t limit, size_t offset, const RowSink& sink) {
+    std::vector<int> group_columns;
+    std::vector<std::string> result_names;
+    for (const std::string& name : statement.group_by) {
+        int column = schema.get_column_index(name);
+        if (column == -1) {
+            throw std::runtime_error("GROUP BY column not found: " + name);
+        }
+        group_columns.push_back(column);
+        result_names.push_back(name);
+    }
+
+    std::vector<Aggregator::Aggregate> aggregates;
+    auto add_aggregate = [&](const std::string& name) {
+        Aggregator::Aggregate aggregate;
+        if (std::find(result_names.begin(), result_names.end(), name) == result_names.end() &&
+            Aggregator::parse_aggregate(name, schema, aggregate)) {
+            aggregates.push_back(aggregate);
+            result_names.push_back(name);
+        }
+    };
+    std::vector<std::string> referenced = statement.columns;
+    collect_columns(statement.having.get(), referenced);
+    for (const OrderTerm& term : statement.order_by) {
+        referenced.push_back(term.column);
+    }
+    for (const std::string& name : referenced) {
+        if (name == "*") {
+            throw std::runtime_error("SELECT * can't be combined with aggregates or GROUP BY");
+        }
+        add_aggregate(name);
+    }
+
+    auto result_column = [&result_names](const std::string& name) {
+        auto found = std::find(result_names.begin(), result_names.end(), name);
+        if (found == result_names.end()) {
+            throw std::runtime_error("Column " + name + " must appear in GROUP BY or be used in an aggregate");
+        }
+        return static_cast<int>(found - result_names.begin());
+    };
+    std::vector<int> projection;
+    for (const std::string& name : statement.columns) {
+        projection.push_back(result_column(name));
+    }
+    std::vector<std::pair<int, bool>> sort_columns;
+    for (const OrderTerm& term : statement.order_by) {
+        sort_columns.emplace_back(result_column(term.column), term.descending);
+    }
+
+    if (QueryProfile* profile = QueryProfile::current()) {
+        std::string line = "AGGREGATE";
+        for (size_t i = 0; i < statement.group_by.size(); ++i) {
+            line += (i > 0 ? ", " : " GROUP BY ") + statement.group_by[i];
+        }
+        if (statement.having != nullptr) {
+            line += " HAVING " + statement.having->to_string();
+        }
+        if (source.morsel_count > 0) {
+            line += ", MERGING " + std::to_string(source.participant_count) + " PARTIAL RESULTS";
+        }
+        profile->note(std::move(line));
+    }
+
+    // Parallel scans aggregate per participant and merge the partial results
+    QueryProfile::Phase phase(QueryProfile::AGGREGATE);
+    std::vector<Aggregator> partials;
+    partials.reserve(source.morsel_count > 0 ? source.participant_count : 1);
+    partials.emplace_back(schema, group_columns, aggregates);
+    if (source.morsel_count > 0) {
+        while (partials.size() < source.participant_count) {
+            partials.emplace_back(schema, group_columns, aggregates);
+        }
+        source.scan_morsels([&partials](size_t, size_t participant, const RecordView* rows, size_t count) {
+            partials[participant].add_batch(rows, count);
+        });
+        for (size_t i = 1; i < partials.size(); ++i) {
+            partials[0].merge(partials[i]);
+        }
+    } else {
+        source.scan([&partials](const RecordView* rows, size_t count) {
+            partials[0].add_batch(rows, count);
+            return true;
+        });
+    }
+    Aggregator& aggregator = partials[0];
+
+    std::vector<std::string> aggregate_names(result_names.begin() + group_columns.size(), result_names.end());
+    Schema result_schema(aggregator.get_result_columns(aggregate_names));
+    CompiledPredicate having = CompiledPredicate::compile(statement.having.get(), result_schema, parameters);
+    std::pmr::vector<std::vector<Value>> rows(&QueryArena::local());
+    std::vector<Value> values;
+    for (size_t group = 0; group < aggregator.get_group_count(); ++group) {
+        aggregator.get_group(group, values);
+        if (!having.is_trivial()) {
+            std::string record = result_schema.encode_values(values);
+            if (!having.matches(RecordView(result_schema, record))) {
+                continue;
+            }
+        }
+        rows.push_back(values);
+    }
+
+    // Groups are numbered in order of first appearance, which stable sorting keeps for ties
+    if (!sort_columns.empty()) {
+        QueryProfile::Phase sort_phase(QueryProfile::SORT);
+        std::stable_sort(rows.begin(), rows.end(), [&sort_columns](const auto& a, const auto& b) {
+            return comes_before(a, b, sort_columns);
+        });
+    }
+    QueryProfile::Phase output(QueryProfile::OUTPUT);
+    size_t row_count = 0;
+    for (size_t i = offset; i < rows.size() && row_count < limit; ++i) {
+        project(rows[i], projection, values);
+        sink(values);
+        row_count++;
+    }
+    return row_count;
+}
+
+// Collects joined rows as records of the joined schema (left columns, then
+// right ones), drops those failing the conditions that span both tables and
+// passes the rest on a batch at a time
+class JoinedBatch {
+public:
+    // consumer is the profile operator the visitor works for
+    JoinedBatch(const Schema& schema, const CompiledPredicate& residual, const BatchVisitor& visitor,
+                QueryProfile::Operator consumer)
+            : schema(schema), residual(residual), visitor(visitor), consumer(consumer), stopped(false) {}
+
+    // Returns false once the visitor wants no more rows
+    bool add(const RecordView& left, const RecordView& right) {
+        if (stopped) {
+            return false;
+        }
+        size_t left_width = left.get_schema().size();
+        values.resize(schema.size());
+        for (size_t i = 0; i < schema.size(); ++i) {
+            values[i] = i < left_width ? left.get_value(i) : right.get_value(i - left_width);
+        }
+        records.push_back(schema.encode_values(values));
+        if (records.size() == CompiledPredicate::BATCH_SIZE) {
+            flush();
+        }
+        return !stopped;
+    }
+
+    void flush() {
+        if (records.empty() || stopped) {
+            return;
+        }
+        rows.clear();
+        for (const std::string& record : records) {
+            rows.emplace_back(schema, record);
+        }
+        selection.assign(rows.size(), 1);
+        residual.filter(rows.data(), rows.size(), selection.data());
+        size_t count = 0;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (selection[i]) {
+                rows[count++] = rows[i];
+            }
+        }
+        if (count > 0) {
+            QueryProfile::Phase phase(consumer);
+            stopped = !visitor(rows.data(), count);
+        }
+        records.clear();
+    }
+
+    bool is_stopped() const {
+        return stopped;
+    }
+
+private:
+    const Schema& schema;
+    const CompiledPredicate& residual;
+    const BatchVisitor& visitor;
+    QueryProfile::Operator consumer;
+    bool stopped;
+    std::vector<Value> values;
+    std::vector<std::string> records;
+    std::pmr::vector<RecordView> rows{&QueryArena::local()};
+    std::pmr::vector<uint8_t> selection{&QueryArena::local()};
+};
+
+// Index nested loop joins need the outer side to be this many times smaller
+// than the inner one; hash joins with at most NESTED_LOOP_ROWS build rows
+// compare every pair instead of hashing
+constexpr size_t INDEX_JOIN_RATIO = 8;
+constexpr size_t NESTED_LOOP_ROWS = 16;
+
+} // namespace
+
+Database::Database(const DatabaseConfig& config)
+        : pager(config.data_file), buffer_pool(pager, config.buffer_pool_size),
+          wal(config.data_file + "-wal", config.wal_sync_policy, config.wal_sync_interval_ms),
+          checkpoint_wal_size(config.checkpoint_wal_size), statement_cache(config.statement_cache_size),
+          scan_pool(config.scan_threads >= 0 ? config.scan_threads
+                                             : std::max(1u, std::thread::hardware_concurrency()) - 1),
+          parallel_scan_rows(config.parallel_scan_rows), shard_count(config.shard_count),
+          shard_index(config.shard_index), copy_dir(config.copy_dir) {
+    if (shard_count == 0 || shard_index >= shard_count) {
+        throw std::runtime_error("Shard index out of range");
+    }
+    load_catalog();
+    recover();
+    initialize_database();
+    if (config.save_interval_ms > 0) {
+        save_thread = std::thread(&Database::save_periodically, this, config.save_interval_ms);
+    }
+}
+
+Database::~Database() {
+    if (save_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(save_mutex);
+            stopping = true;
+        }
+        save_cv.notify_all();
+        save_thread.join();
+    }
+    try {
+        checkpoint();
+    } catch (const std::exception& e) {
+        std::cerr << "Error checkpointing database: " << e.what() << std::endl;
+    }
+}
+
+// Writes every dirty page back, then drops the log records they cover
+void Database::checkpoint() {
+    std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+    write_checkpoint();
+}
+
+// Checkpoints in the background whenever the log has grown, so a restart
+// finds the tree on disk up to date and has at most one interval to replay
+void Database::save_periodically(int interval_ms) {
+    std::unique_lock<std::mutex> lock(save_mutex);
+    while (!save_cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return stopping; })) {
+        lock.unlock();
+        try {
+            if (wal.get_size() > 0) {
+                checkpoint();
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error saving database: " << e.what() << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+void Database::write_checkpoint() {
+    save_catalog();
+    buffer_pool.flush_all();
+    pager.commit_checkpoint();
+    wal.truncate();
+}
+
+// The pager has already rolled the file back to the last checkpoint; replay the log on top of it
+void Database::recover() {
+    size_t replayed = 0;
+    wal.replay([this, &replayed](const WriteAheadLog::Record& record) {
+        auto it = tables.find(record.table_name);
+        if (it != tables.end()) {
+            it->second->apply_log_record(record);
+            replayed++;
+        }
+    });
+    if (replayed > 0) {
+        std::cout << "Recovered " << replayed << " log record(s)" << std::endl;
+        checkpoint();
+    }
+}
+
+void Database::load_catalog() {
+    if (pager.get_page_count() == 0) {
+        // Fresh file: page 0 is reserved for the catalog
+        PageHandle catalog = PageHandle::create(buffer_pool);
+        if (catalog.get_page_id() != CATALOG_PAGE_ID) {
+            throw std::runtime_error("Catalog must be the first page of the database file");
+        }
+        catalog.release();
+        save_catalog();
+        return;
+    }
+
+    PageHandle catalog(buffer_pool, CATALOG_PAGE_ID);
+    if (memcmp(catalog.get_data(), CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0) {
+        throw std::runtime_error("Not a database file");
+    }
+    PageReader reader(catalog.get_data() + sizeof(CATALOG_MAGIC));
+    uint32_t version = reader.read<uint32_t>();
+    if (version != CATALOG_VERSION && version != 3) {
+        throw std::runtime_error("Unsupported database file version");
+    }
+
+    uint32_t table_count = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < table_count; ++i) {
+        std::string name = reader.read_string();
+        page_id_t root_page_id = reader.read<uint32_t>();
+        int64_t row_count = reader.read<int64_t>();
+        uint16_t column_count = reader.read<uint16_t>();
+        std::vector<Column> columns;
+        std::vector<page_id_t> dictionary_root_page_ids;
+        for (uint16_t c = 0; c < column_count; ++c) {
+            std::string column_name = reader.read_string();
+            uint8_t type = reader.read<uint8_t>();
+            columns.push_back({column_name, static_cast<ColumnType>(type & ~DICT_COLUMN)});
+            if (type & DICT_COLUMN) {
+                columns.back().dictionary = std::make_shared<Dictionary>();
+                dictionary_root_page_ids.push_back(reader.read<uint32_t>());
+            }
+        }
+        auto table = std::make_shared<Table>(name, Schema(columns), buffer_pool, root_page_id, row_count, &wal,
+                                             dictionary_root_page_ids);
+        uint16_t index_count = reader.read<uint16_t>();
+        for (uint16_t x = 0; x < index_count; ++x) {
+            std::string column_name = reader.read_string();
+            table->create_index(column_name, static_cast<IndexType>(reader.read<uint8_t>()), false);
+        }
+        tables[name] = table;
+    }
+}
+
+void Database::save_catalog() {
+    PageHandle catalog(buffer_pool, CATALOG_PAGE_ID);
+    std::vector<char> page(PAGE_SIZE, 0);
+    memcpy(page.data(), CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+
+    PageWriter writer(page.data() + sizeof(CATALOG_MAGIC));
+    writer.write<uint32_t>(CATALOG_VERSION);
+    writer.write<uint32_t>(static_cast<uint32_t>(tables.size()));
+    for (const auto& entry : tables) {
+        const auto& table = entry.second;
+        writer.write_string(entry.first);
+        writer.write<uint32_t>(table->get_root_page_id());
+        writer.write<int64_t>(table->get_row_count());
+        const Schema& schema = table->get_schema();
+        writer.write<uint16_t>(static_cast<uint16_t>(schema.size()));
+        for (size_t c = 0; c < schema.size(); ++c) {
+            const Column& column = schema[c];
+            writer.write_string(column.name);
+            if (column.dictionary) {
+                writer.write<uint8_t>(static_cast<uint8_t>(column.type) | DICT_COLUMN);
+                writer.write<uint32_t>(table->get_dictionary_root_page_id(static_cast<int>(c)));
+            } else {
+                writer.write<uint8_t>(static_cast<uint8_t>(column.type));
+            }
+        }
+        writer.write<uint16_t>(static_cast<uint16_t>(table->get_indexes().size()));
+        for (const auto& index : table->get_indexes()) {
+            writer.write_string(index->get_column_name());
+            writer.write<uint8_t>(static_cast<uint8_t>(index->get_type()));
+        }
+    }
+
+    memcpy(catalog.get_data(), page.data(), PAGE_SIZE);
+    catalog.mark_dirty();
+}
+
+Table::Table(const std::string& name, const Schema& schema, BufferPool& pool, page_id_t root_page_id,
+             int64_t row_count, WriteAheadLog* wal, const std::vector<page_id_t>& dictionary_root_page_ids)
+        : name(name), schema(schema), tree(pool, root_page_id), row_count(row_count), wal(wal) {
+    for (const auto& column : schema.get_columns()) {
+        columns.push_back(column.name);
+    }
+    for (size_t c = 0; c < schema.size(); ++c) {
+        if (!schema[c].dictionary) {
+            continue;
+        }
+        if (dictionaries.size() == dictionary_root_page_ids.size()) {
+            throw std::runtime_error("Missing dictionary for column " + schema[c].name);
+        }
+        dictionaries.push_back({static_cast<int>(c), BTree(pool, dictionary_root_page_ids[dictionaries.size()])});
+        BTree::Cursor cursor(dictionaries.back().tree);
+        for (cursor.first(); cursor.valid(); cursor.next()) {
+            schema[c].dictionary->load(static_cast<uint32_t>(cursor.key()), cursor.payload());
+        }
+    }
+}
+
+void Table::insert(const std::vector<std::string>& values) {
+    std::string payload = schema.encode(values);
+    put(RecordView(schema, payload).get_integer(0), payload);
+}
+
+void Table::insert_rows(std::vector<BTree::Entry> rows) {
+    // Stable, so the last of several rows with the same key still wins
+    std::stable_sort(rows.begin(), rows.end(), [](const BTree::Entry& a, const BTree::Entry& b) {
+        return a.first < b.first;
+    });
+    for (const auto& row : rows) {
+        put(row.first, row.second);
+    }
+}
+
+void Table::bulk_load(const std::vector<BTree::Entry>& rows) {
+    save_dictionary_additions(false);
+    if (row_count != 0 || !tree.is_empty()) {
+        for (const auto& row : rows) {
+            store(row.first, row.second);
+        }
+        return;
+    }
+    tree.bulk_load(rows);
+    row_count = static_cast<int64_t>(rows.size());
+    version.fetch_add(1, std::memory_order_release);
+    if (!indexes_built) {
+        return;
+    }
+    for (auto& index : indexes) {
+        int column = index->get_column_index();
+        for (const auto& row : rows) {
+            index->insert(RecordView(schema, row.second).get_value(column), row.first);
         }
-    } catch (const QueryParseError& e) {
-        throw std::runtime_error("Query parse error: " + std::string(e.what()));
-    } catch (const std::exception& e) {
-        throw std::runtime_error("Error executing query: " + std::string(e.what()));
     }
+}
+
+std::vector<std::string> Table::select(int64_t key) const {
+    std::string payload;
+    return tree.find(key, payload) ? schema.decode(payload) : std::vector<std::string>();
+}
 
-    return {};
+void Table::update(int64_t key, const std::vector<std::string>& values) {
+    std::string payload;
+    if (tree.find(key, payload)) {
+        put(key, schema.encode(values));
+    }
 }
 
+void Table::remove(int64_t key) {
+    if (erase(key) && wal != nullptr) {
+        last_lsn = wal->append(WriteAheadLog::Record::REMOVE, name, key, "");
+    }
+}
 
-Table::Table(const std::string& name, const std::vector<std::string>& columns)
-        : name(name), columns(columns) {}
+// Writes out the dictionary values that encoding added, ahead of the first row that uses them
+void Table::save_dictionary_additions(bool logged) {
+    for (auto& dictionary : dictionaries) {
+        for (const auto& addition : schema[dictionary.column].dictionary->take_additions()) {
+            dictionary.tree.insert(addition.first, addition.second);
+            if (logged && wal != nullptr) {
+                std::string payload(sizeof(uint16_t), '\0');
+                uint16_t column = static_cast<uint16_t>(dictionary.column);
+                memcpy(&payload[0], &column, sizeof(column));
+                last_lsn = wal->append(WriteAheadLog::Record::DICTIONARY, name, addition.first,
+                                       payload + addition.second);
+            }
+        }
+    }
+}
 
-void Table::insert(const std::vector<std::string>& values) {
-    if (values.size() != columns.size()) {
-        throw std::runtime_error("Number of values doesn't match number of columns");
+void Table::put(int64_t key, const std::string& payload) {
+    save_dictionary_additions(true);
+    store(key, payload);
+    if (wal != nullptr) {
+        last_lsn = wal->append(WriteAheadLog::Record::PUT, name, key, payload);
+    }
+}
+
+// Writes a row image and keeps the secondary indexes in step once they are
+// built. Returns true for a new key.
+bool Table::store(int64_t key, const std::string& payload) {
+    bool indexed = indexes_built && !indexes.empty();
+    std::string old_payload;
+    bool replacing = indexed && tree.find(key, old_payload);
+
+    bool inserted = tree.insert(key, payload);
+    if (inserted) {
+        row_count++;
+    }
+    version.fetch_add(1, std::memory_order_release);
+    if (!indexed) {
+        return inserted;
+    }
+
+    for (auto& index : indexes) {
+        int column = index->get_column_index();
+        if (replacing) {
+            index->remove(RecordView(schema, old_payload).get_value(column), key);
+        }
+        index->insert(RecordView(schema, payload).get_value(column), key);
+    }
+    return inserted;
+}
+
+bool Table::erase(int64_t key) {
+    bool indexed = indexes_built && !indexes.empty();
+    std::string old_payload;
+    if (indexed && !tree.find(key, old_payload)) {
+        return false;
+    }
+    if (!tree.remove(key)) {
+        return false;
+    }
+    row_count--;
+    version.fetch_add(1, std::memory_order_release);
+    if (!indexed) {
+        return true;
+    }
+
+    for (auto& index : indexes) {
+        index->remove(RecordView(schema, old_payload).get_value(index->get_column_index()), key);
+    }
+    return true;
+}
+
+bool Table::lookup(int64_t key, std::string& payload) const {
+    return tree.find(key, payload);
+}
+
+// With build false the index starts empty and is filled along with the
+// others by the first build_indexes() call, as for indexes loaded from the catalog
+void Table::create_index(const std::string& column_name, IndexType type, bool build) {
+    int column = schema.get_column_index(column_name);
+    if (column == -1) {
+        throw std::runtime_error("Column not found: " + column_name);
+    }
+    if (column == 0) {
+        throw std::runtime_error("Column " + column_name + " is the primary key and is already indexed");
+    }
+    for (const auto& index : indexes) {
+        if (index->get_column_index() == column) {
+            throw std::runtime_error("Column " + column_name + " is already indexed");
+        }
+    }
+
+    std::unique_ptr<SecondaryIndex> index;
+    if (type == IndexType::HASH) {
+        index = std::make_unique<HashIndex>(column_name, column);
+    } else {
+        index = std::make_unique<OrderedIndex>(column_name, column);
+    }
+    if (build) {
+        build_indexes();
+        scan([&](const RecordView& row) {
+            index->insert(row.get_value(column), row.get_integer(0));
+            return true;
+        });
+    }
+    indexes.push_back(std::move(index));
+}
+
+// Fills the indexes with one scan of the table, the first time any is needed.
+// Until then writes leave them alone, so opening a database and replaying its
+// log costs nothing per index. Callers hold the table lock, at least shared.
+void Table::build_indexes() const {
+    std::call_once(index_build, [this] {
+        if (!indexes.empty()) {
+            scan([this](const RecordView& row) {
+                for (const auto& index : indexes) {
+                    int column = index->get_column_index();
+                    index->insert(row.get_value(column), row.get_integer(0));
+                }
+                return true;
+            });
+        }
+        indexes_built = true;
+    });
+}
+
+// Prefers a hash index for equality; range lookups need an ordered one
+const SecondaryIndex* Table::find_index(int column_index, bool needs_range) const {
+    build_indexes();
+    const SecondaryIndex* found = nullptr;
+    for (const auto& index : indexes) {
+        if (index->get_column_index() != column_index || (needs_range && !index->supports_range())) {
+            continue;
+        }
+        if (found == nullptr || index->get_type() == IndexType::HASH) {
+            found = index.get();
+        }
+    }
+    return found;
+}
+
+const std::vector<std::unique_ptr<SecondaryIndex>>& Table::get_indexes() const {
+    return indexes;
+}
+
+// Visits rows in key order straight from the leaf pages until the visitor returns false.
+// The visitor must not modify the table.
+void Table::scan(const std::function<bool(const RecordView& row)>& visitor) const {
+    BTree::Cursor cursor(tree);
+    for (cursor.first(); cursor.valid(); cursor.next()) {
+        if (!visitor(RecordView(schema, cursor.payload()))) {
+            break;
+        }
+    }
+}
+
+void Table::scan_batches(const std::function<bool(const RecordView* rows, size_t count)>& visitor,
+                         int64_t lower, int64_t upper) const {
+    if (lower > upper) {
+        return;
+    }
+    BTree::Cursor cursor(tree);
+    std::vector<std::string_view> payloads;
+    std::vector<RecordView> rows;
+    cursor.seek(lower);
+    while (cursor.next_batch(payloads) > 0) {
+        rows.clear();
+        for (std::string_view payload : payloads) {
+            rows.emplace_back(schema, payload);
+        }
+        // The batch is in key order, so only its tail can run past the range
+        size_t count = rows.size();
+        while (count > 0 && rows[count - 1].get_integer(0) > upper) {
+            count--;
+        }
+        if ((count > 0 && !visitor(rows.data(), count)) || count < rows.size()) {
+            break;
+        }
+    }
+}
+
+// Recovery path: applies a logged row image without logging it again
+void Table::apply_log_record(const WriteAheadLog::Record& record) {
+    if (record.type == WriteAheadLog::Record::PUT) {
+        store(record.key, record.payload);
+    } else if (record.type == WriteAheadLog::Record::REMOVE) {
+        erase(record.key);
+    } else if (record.type == WriteAheadLog::Record::DICTIONARY && record.payload.size() >= sizeof(uint16_t)) {
+        uint16_t column;
+        memcpy(&column, record.payload.data(), sizeof(column));
+        std::string value = record.payload.substr(sizeof(column));
+        for (auto& dictionary : dictionaries) {
+            if (dictionary.column == column) {
+                dictionary.tree.insert(record.key, value);
+                schema[column].dictionary->load(static_cast<uint32_t>(record.key), value);
+            }
+        }
     }
-    int key = std::stoi(values[0]);
-    data[key] = values;
 }
 
-std::vector<std::string> Table::select(int key) const {
-    auto it = data.find(key);
-    return it != data.end() ? it->second : std::vector<std::string>();
+void Table::get_leaf_separators(std::vector<int64_t>& separators) const {
+    tree.get_leaf_separators(separators);
+}
+
+std::shared_mutex& Table::get_mutex() const {
+    return mutex;
+}
+
+page_id_t Table::get_root_page_id() const {
+    return tree.get_root_page_id();
 }
 
-void Table::update(int key, const std::vector<std::string>& values) {
-    if (data.find(key) != data.end()) {
-        data[key] = values;
+uint64_t Table::get_version() const {
+    return version.load(std::memory_order_acquire);
+}
+
+uint64_t Table::get_last_lsn() const {
+    return last_lsn;
+}
+
+page_id_t Table::get_dictionary_root_page_id(int column_index) const {
+    for (const auto& dictionary : dictionaries) {
+        if (dictionary.column == column_index) {
+            return dictionary.tree.get_root_page_id();
+        }
     }
+    return INVALID_PAGE_ID;
 }
 
-void Table::remove(int key) {
-    data.erase(key);
+const Schema& Table::get_schema() const {
+    return schema;
 }
 
 int Table::get_row_count() const {
-    return data.size();
+    return static_cast<int>(row_count);
 }
 
 const std::vector<std::string>& Table::get_columns() const {
@@ -70,41 +1600,714 @@ const std::vector<std::string>& Table::get_columns() const {
 }
 
 int Table::get_column_index(const std::string& column_name) const {
-    auto it = std::find(columns.begin(), columns.end(), column_name);
-    return it != columns.end() ? std::distance(columns.begin(), it) : -1;
+    return schema.get_column_index(column_name);
 }
 
-void Database::create_table(const std::string& name, const std::vector<std::string>& columns) {
+void Database::create_table(const std::string& name, const std::vector<Column>& columns) {
+    std::unique_lock<std::shared_mutex> lock(catalog_mutex);
     if (tables.find(name) != tables.end()) {
         throw std::runtime_error("Table already exists: " + name);
     }
-    tables[name] = std::make_shared<Table>(name, columns);
-    std::cout << "Table created: " << name << std::endl;
+    if (columns.empty() || columns[0].type != ColumnType::INTEGER) {
+        throw std::runtime_error("The first column of a table must be its INTEGER primary key");
+    }
+    page_id_t root_page_id = BTree::create(buffer_pool);
+    std::vector<page_id_t> dictionary_root_page_ids;
+    for (const auto& column : columns) {
+        if (column.dictionary) {
+            dictionary_root_page_ids.push_back(BTree::create(buffer_pool));
+        }
+    }
+    tables[name] = std::make_shared<Table>(name, Schema(columns), buffer_pool, root_page_id, 0, &wal,
+                                           dictionary_root_page_ids);
+    // Log records refer to tables by name, so the catalog must be durable before any of them
+    write_checkpoint();
 }
 
-std::vector<std::vector<std::string>> Database::execute_select(const std::string& table_name, const std::vector<std::string>& columns, const std::string& condition) {
+size_t Database::execute_select(const Statement& statement, const std::vector<std::string>& parameters,
+                                const RowSink& sink) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
+    auto it = tables.find(statement.table_name);
+    if (it == tables.end()) {
+        throw std::runtime_error("Table not found: " + statement.table_name);
+    }
+
+    const Table& table = *it->second;
+    std::vector<std::string> values = statement.bind_values(parameters);
+    size_t limit = statement.limit_value < 0 ? SIZE_MAX : parse_row_count(values[statement.limit_value], "LIMIT");
+    size_t offset = statement.offset_value < 0 ? 0 : parse_row_count(values[statement.offset_value], "OFFSET");
+    if (!statement.join_table.empty()) {
+        return execute_join(table, statement, parameters, limit, offset, sink);
+    }
+
+    const Schema& schema = table.get_schema();
+    bool aggregate = is_aggregate_query(statement, schema);
+    RowSource source;
+    source.scan = [&](const BatchVisitor& visitor) {
+        std::shared_lock<std::shared_mutex> table_lock(table.get_mutex());
+        note_access(statement.table_name, table, statement.condition.get(), parameters, 0);
+        for_each_match_batch(table, statement.condition.get(), parameters, visitor);
+    };
+    // A plain SELECT without WHERE is bound by sending rows, not scanning them
+    std::vector<KeyRange> morsels;
+    if (aggregate || statement.condition != nullptr || !statement.order_by.empty()) {
+        std::shared_lock<std::shared_mutex> table_lock(table.get_mutex());
+        morsels = plan_parallel_scan(table, statement.condition.get(), parameters);
+    }
+    if (!morsels.empty()) {
+        source.morsel_count = morsels.size();
+        source.participant_count = scan_pool.get_thread_count() + 1;
+        source.scan_morsels = [&](const MorselVisitor& visitor) {
+            std::shared_lock<std::shared_mutex> table_lock(table.get_mutex());
+            note_access(statement.table_name, table, statement.condition.get(), parameters, morsels.size());
+            scan_morsels(scan_pool, table, statement.condition.get(), parameters, morsels, visitor);
+        };
+    }
+    if (aggregate) {
+        return aggregate_rows(schema, source, statement, parameters, limit, offset, sink);
+    }
+    return emit_rows(schema, source, statement, true, limit, offset, sink);
+}
+
+Schema Database::get_schema(const std::string& table_name) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
     auto it = tables.find(table_name);
     if (it == tables.end()) {
         throw std::runtime_error("Table not found: " + table_name);
     }
+    return it->second->get_schema();
+}
 
-    std::vector<std::vector<std::string>> results;
-    auto& table = it->second;
+void Database::scan_table(const std::string& table_name, const Expression* condition,
+                          const std::vector<std::string>& parameters, const BatchVisitor& visitor) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
+    auto it = tables.find(table_name);
+    if (it == tables.end()) {
+        throw std::runtime_error("Table not found: " + table_name);
+    }
+    const Table& table = *it->second;
+    std::shared_lock<std::shared_mutex> table_lock(table.get_mutex());
+    for_each_match_batch(table, condition, parameters, visitor);
+}
+
+// Every part counts as one morsel with a participant of its own, so the
+// parts are aggregated and sorted apart and merged at the end. Without ORDER
+// BY the parts' rows are merged by key, so they come out as from one table;
+// each part stops after the offset + limit rows that could make it.
+size_t Database::select_parts(const Statement& statement, const std::vector<std::string>& parameters,
+                              const Schema& schema, const PartedRows& parts, const RowSink& sink) {
+    check_parameter_count(statement, parameters);
+    if (!statement.join_table.empty()) {
+        throw std::runtime_error("JOIN is not supported on partitioned tables");
+    }
+    std::vector<std::string> values = statement.bind_values(parameters);
+    size_t limit = statement.limit_value < 0 ? SIZE_MAX : parse_row_count(values[statement.limit_value], "LIMIT");
+    size_t offset = statement.offset_value < 0 ? 0 : parse_row_count(values[statement.offset_value], "OFFSET");
+    bool aggregate = is_aggregate_query(statement, schema);
 
-    for (int i = 0; i < table->get_row_count(); ++i) {
-        auto row = table->select(i);
-        if (condition.empty() || row[0] == condition) {
-            results.push_back(row);
+    if (!aggregate && statement.order_by.empty()) {
+        std::vector<int> projection = resolve_projection(schema, statement);
+        size_t keep = limit > SIZE_MAX - offset ? SIZE_MAX : limit + offset;
+        if (limit == 0) {
+            return 0;
         }
+        using KeyedRow = std::pair<int64_t, std::vector<Value>>;
+        std::vector<std::vector<KeyedRow>> part_rows(parts.part_count);
+        parts.scan_all([&](size_t part, const RecordView* rows, size_t count) {
+            std::vector<KeyedRow>& kept = part_rows[part];
+            for (size_t i = 0; i < count && kept.size() < keep; ++i) {
+                kept.emplace_back(rows[i].get_integer(0), std::vector<Value>());
+                read_row(schema, rows[i], projection, kept.back().second);
+            }
+            return kept.size() < keep;
+        });
+        std::vector<KeyedRow> merged;
+        for (std::vector<KeyedRow>& rows : part_rows) {
+            size_t middle = merged.size();
+            std::move(rows.begin(), rows.end(), std::back_inserter(merged));
+            rows = {};
+            std::inplace_merge(merged.begin(), merged.begin() + static_cast<ptrdiff_t>(middle), merged.end(),
+                               [](const KeyedRow& a, const KeyedRow& b) { return a.first < b.first; });
+        }
+        size_t row_count = 0;
+        for (size_t i = offset; i < merged.size() && row_count < limit; ++i) {
+            sink(merged[i].second);
+            row_count++;
+        }
+        return row_count;
     }
 
-    return results;
+    RowSource source;
+    source.morsel_count = parts.part_count;
+    source.participant_count = parts.part_count;
+    source.scan_morsels = [&parts](const MorselVisitor& visitor) {
+        parts.scan_all([&visitor](size_t part, const RecordView* rows, size_t count) {
+            visitor(part, part, rows, count);
+            return true;
+        });
+    };
+    if (aggregate) {
+        return aggregate_rows(schema, source, statement, parameters, limit, offset, sink);
+    }
+    return emit_rows(schema, source, statement, false, limit, offset, sink);
+}
+
+// Streams a single-table SELECT in key order. Every next() takes the locks
+// afresh and carries on from where the last one stopped: past the last key
+// read, at the next candidate key of an index lookup, or with the next wave of
+// morsels for a parallel scan. Rows committed in between may or may not be
+// seen, so a multi-row UPDATE or DELETE that commits meanwhile can show up in
+// part. A snapshot would mean holding the table lock across next() calls,
+// which run on whichever worker is free and may be far apart.
+class Database::ScanCursor : public QueryCursor {
+public:
+    ScanCursor(Database& database, std::shared_ptr<Table> table, std::shared_ptr<const Statement> statement,
+               const std::vector<std::string>& parameters, size_t limit, size_t offset);
+    bool next(const RowSink& sink, size_t max_rows) override;
+    size_t get_row_count() const override;
+    void close() override;
+
+private:
+    Database& database;
+    std::shared_ptr<Table> table;
+    // The condition and the compiled predicate refer into the statement
+    std::shared_ptr<const Statement> statement;
+    std::vector<std::string> parameters;
+    CompiledPredicate predicate;
+    std::vector<int> projection;
+    size_t limit;
+    size_t offset;
+    size_t skipped = 0;
+    size_t row_count = 0;
+    bool exhausted = false;
+    // Index lookups: candidate keys found when opened and how many were tried
+    bool use_keys = false;
+    std::vector<int64_t> keys;
+    size_t key_position = 0;
+    // Scans: the part of the key range not read yet
+    int64_t lower = INT64_MIN;
+    int64_t upper = INT64_MAX;
+    // Parallel scans: morsels not run yet, and rows of a finished wave not sent yet
+    std::vector<KeyRange> morsels;
+    size_t morsel_position = 0;
+    std::vector<std::vector<Value>> pending;
+    size_t pending_position = 0;
+    std::vector<Value> row_values;
+
+    void run_wave();
+};
+
+Database::ScanCursor::ScanCursor(Database& database, std::shared_ptr<Table> table,
+                                 std::shared_ptr<const Statement> statement,
+                                 const std::vector<std::string>& parameters, size_t limit, size_t offset)
+        : database(database), table(std::move(table)), statement(std::move(statement)), parameters(parameters),
+          limit(limit), offset(offset) {
+    const Schema& schema = this->table->get_schema();
+    const Expression* condition = this->statement->condition.get();
+    projection = resolve_projection(schema, *this->statement);
+    predicate = CompiledPredicate::compile(condition, schema, parameters);
+    exhausted = limit == 0;
+
+    std::shared_lock<std::shared_mutex> table_lock(this->table->get_mutex());
+    bool key_range = find_key_range(*this->table, condition, parameters, lower, upper);
+    use_keys = find_candidate_keys(*this->table, condition, parameters, !key_range, &keys) != SCAN;
+    // Waves only pay off while the whole result is wanted
+    if (!use_keys && condition != nullptr && limit == SIZE_MAX) {
+        morsels = database.plan_parallel_scan(*this->table, condition, parameters);
+    }
+}
+
+bool Database::ScanCursor::next(const RowSink& sink, size_t max_rows) {
+    if (exhausted) {
+        return false;
+    }
+    QueryArena::Scope arena_scope;
+    size_t produced = 0;
+    // Returns false once this call has produced enough rows
+    auto emit = [&](const std::vector<Value>& row) {
+        if (skipped < offset) {
+            skipped++;
+            return true;
+        }
+        sink(row);
+        produced++;
+        return ++row_count < limit && produced < max_rows;
+    };
+
+    std::shared_lock<std::shared_mutex> catalog_lock(database.catalog_mutex);
+    std::shared_lock<std::shared_mutex> table_lock(table->get_mutex());
+    const Schema& schema = table->get_schema();
+    if (use_keys) {
+        std::string payload;
+        bool more = true;
+        while (more && key_position < keys.size()) {
+            if (table->lookup(keys[key_position++], payload)) {
+                RecordView row(schema, payload);
+                if (predicate.matches(row)) {
+                    read_row(schema, row, projection, row_values);
+                    more = emit(row_values);
+                }
+            }
+        }
+        exhausted = key_position == keys.size();
+    } else if (!morsels.empty()) {
+        bool more = true;
+        while (more) {
+            if (pending_position == pending.size()) {
+                if (morsel_position == morsels.size()) {
+                    exhausted = true;
+                    break;
+                }
+                run_wave();
+                continue;
+            }
+            more = emit(pending[pending_position++]);
+        }
+    } else {
+        bool stopped = false;
+        scan_matches(*table, predicate, lower, upper, [&](const RecordView* rows, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                int64_t key = rows[i].get_integer(0);
+                // An empty range once the last possible key is read
+                if (key < upper) {
+                    lower = key + 1;
+                } else {
+                    lower = INT64_MAX;
+                    upper = INT64_MIN;
+                }
+                read_row(schema, rows[i], projection, row_values);
+                if (!emit(row_values)) {
+                    stopped = true;
+                    return false;
+                }
+            }
+            return true;
+        });
+        exhausted = !stopped;
+    }
+    exhausted = exhausted || row_count >= limit;
+    if (exhausted) {
+        close();
+    }
+    return !exhausted;
+}
+
+// Scans the next morsel per participant and queues their rows in key order
+void Database::ScanCursor::run_wave() {
+    size_t wave = std::min(morsels.size() - morsel_position, database.scan_pool.get_thread_count() + 1);
+    std::vector<KeyRange> batch(morsels.begin() + morsel_position, morsels.begin() + morsel_position + wave);
+    morsel_position += wave;
+    std::vector<std::vector<std::vector<Value>>> morsel_rows(wave);
+    const Schema& schema = table->get_schema();
+    scan_morsels(database.scan_pool, *table, statement->condition.get(), parameters, batch,
+                 [&](size_t morsel, size_t, const RecordView* rows, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            morsel_rows[morsel].emplace_back();
+            read_row(schema, rows[i], projection, morsel_rows[morsel].back());
+        }
+    });
+    pending.clear();
+    pending_position = 0;
+    for (auto& rows : morsel_rows) {
+        std::move(rows.begin(), rows.end(), std::back_inserter(pending));
+    }
+}
+
+size_t Database::ScanCursor::get_row_count() const {
+    return row_count;
+}
+
+void Database::ScanCursor::close() {
+    exhausted = true;
+    keys = {};
+    morsels = {};
+    pending = {};
+    pending_position = 0;
+    predicate = CompiledPredicate();
+    statement.reset();
+    table.reset();
+}
+
+bool Database::get_result_key(const std::string& query, std::string& key,
+                              std::vector<std::shared_ptr<const Table>>& tables, PreparedQuery& prepared) {
+    QueryArena::Scope arena_scope;
+    std::string normalized;
+    prepared = {};
+    try {
+        prepared.statement = prepare_statement(query, prepared.parameters, &normalized);
+    } catch (const std::exception&) {
+        // Running the query reports the error
+        prepared = {};
+        return false;
+    }
+    tables.clear();
+    return make_result_key(*prepared.statement, normalized, prepared.parameters, key) &&
+           find_result_tables(*prepared.statement, tables);
+}
+
+// EXECUTE is left out: its prepared statement may be replaced under the same name
+bool Database::make_result_key(const Statement& statement, const std::string& normalized,
+                               const std::vector<std::string>& parameters, std::string& key) {
+    if (statement.command != "SELECT" || normalized.empty()) {
+        return false;
+    }
+    key = normalized;
+    for (const std::string& parameter : parameters) {
+        key += '\0';
+        key += std::to_string(parameter.size());
+        key += ':';
+        key += parameter;
+    }
+    return true;
+}
+
+bool Database::find_result_tables(const Statement& statement, std::vector<std::shared_ptr<const Table>>& tables) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
+    for (const std::string* name : {&statement.table_name, &statement.join_table}) {
+        if (name->empty()) {
+            continue;
+        }
+        auto it = this->tables.find(*name);
+        if (it == this->tables.end()) {
+            return false;
+        }
+        tables.push_back(it->second);
+    }
+    return true;
+}
+
+std::unique_ptr<QueryCursor> Database::open_query(const std::string& query) {
+    PreparedQuery prepared;
+    return open_query(query, prepared);
+}
+
+std::unique_ptr<QueryCursor> Database::open_query(const std::string& query, PreparedQuery& prepared) {
+    QueryArena::Scope arena_scope;
+    Metrics::add(Metrics::QUERIES);
+    try {
+        std::vector<std::string> parameters = std::move(prepared.parameters);
+        std::shared_ptr<const Statement> statement = std::move(prepared.statement);
+        if (statement == nullptr) {
+            statement = prepare_statement(query, parameters);
+        }
+        if (statement->command == "EXECUTE") {
+            check_parameter_count(*statement, parameters);
+            parameters = statement->bind_values(parameters);
+            statement = find_prepared_statement(statement->statement_name);
+        }
+        if (std::unique_ptr<QueryCursor> cursor = open_scan(statement, parameters)) {
+            return cursor;
+        }
+        auto cursor = std::make_unique<BufferedCursor>();
+        cursor->row_count = execute_statement(*statement, parameters, [&cursor](const std::vector<Value>& row) {
+            cursor->rows.push_back(row);
+        });
+        return cursor;
+    } catch (const QueryParseError& e) {
+        Metrics::add(Metrics::QUERY_ERRORS);
+        throw std::runtime_error("Query parse error: " + std::string(e.what()));
+    } catch (const std::exception& e) {
+        Metrics::add(Metrics::QUERY_ERRORS);
+        throw std::runtime_error("Error executing query: " + std::string(e.what()));
+    }
+}
+
+// A ScanCursor for SELECTs whose rows come straight off one table in key
+// order; nullptr for everything else
+std::unique_ptr<QueryCursor> Database::open_scan(const std::shared_ptr<const Statement>& statement,
+                                                 const std::vector<std::string>& parameters) {
+    if (statement->command != "SELECT" || !statement->join_table.empty()) {
+        return nullptr;
+    }
+    check_parameter_count(*statement, parameters);
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
+    auto it = tables.find(statement->table_name);
+    if (it == tables.end()) {
+        throw std::runtime_error("Table not found: " + statement->table_name);
+    }
+    const Schema& schema = it->second->get_schema();
+    const std::vector<OrderTerm>& order_by = statement->order_by;
+    bool key_ordered = order_by.empty() ||
+                       (order_by.size() == 1 && !order_by[0].descending &&
+                        schema.get_column_index(order_by[0].column) == 0);
+    if (!key_ordered || is_aggregate_query(*statement, schema)) {
+        return nullptr;
+    }
+    std::vector<std::string> values = statement->bind_values(parameters);
+    size_t limit = statement->limit_value < 0 ? SIZE_MAX : parse_row_count(values[statement->limit_value], "LIMIT");
+    size_t offset = statement->offset_value < 0 ? 0 : parse_row_count(values[statement->offset_value], "OFFSET");
+    return std::make_unique<ScanCursor>(*this, it->second, statement, parameters, limit, offset);
+}
+
+// Big table scans that no key range or index narrows much are cut into
+// morsels for the scan pool. Returns no morsels when the scan should stay on
+// the calling thread. The caller holds the table lock.
+std::vector<KeyRange> Database::plan_parallel_scan(const Table& table, const Expression* condition,
+                                                   const std::vector<std::string>& parameters) const {
+    if (scan_pool.get_thread_count() == 0 || static_cast<size_t>(table.get_row_count()) < parallel_scan_rows) {
+        return {};
+    }
+    int64_t lower = INT64_MIN, upper = INT64_MAX;
+    bool key_range = find_key_range(table, condition, parameters, lower, upper);
+    if (lower > upper || find_candidate_keys(table, condition, parameters, !key_range, nullptr) != SCAN) {
+        return {};
+    }
+    std::vector<KeyRange> morsels = split_into_morsels(table, lower, upper);
+    if (morsels.size() < 2) {
+        return {};
+    }
+    return morsels;
+}
+
+// Runs FROM left JOIN right ON ... by rewriting every column reference as
+// table.column against the joined schema. AND-ed conditions on a single table
+// are pushed down into that table's scan, so they can still use its keys and
+// indexes; the rest are checked on the joined rows.
+size_t Database::execute_join(const Table& left, const Statement& statement,
+                              const std::vector<std::string>& parameters, size_t limit, size_t offset,
+                              const RowSink& sink) {
+    auto it = tables.find(statement.join_table);
+    if (it == tables.end()) {
+        throw std::runtime_error("Table not found: " + statement.join_table);
+    }
+    const Table& right = *it->second;
+    if (&left == &right) {
+        throw std::runtime_error("A table can't be joined with itself");
+    }
+    const std::string& left_name = statement.table_name;
+    const std::string& right_name = statement.join_table;
+    const Schema& left_schema = left.get_schema();
+    const Schema& right_schema = right.get_schema();
+
+    std::vector<Column> joined_columns;
+    for (const Column& column : left_schema.get_columns()) {
+        joined_columns.push_back({left_name + "." + column.name, column.type});
+    }
+    for (const Column& column : right_schema.get_columns()) {
+        joined_columns.push_back({right_name + "." + column.name, column.type});
+    }
+    Schema joined(joined_columns);
+    int left_width = static_cast<int>(left_schema.size());
+
+    // Unknown names are left alone and reported where they are used
+    auto qualify_column = [&](const std::string& name) {
+        if (name.find('.') != std::string::npos) {
+            return name;
+        }
+        bool in_left = left_schema.get_column_index(name) != -1;
+        bool in_right = right_schema.get_column_index(name) != -1;
+        if (in_left && in_right) {
+            throw std::runtime_error("Column " + name + " is ambiguous");
+        }
+        return in_left ? left_name + "." + name : in_right ? right_name + "." + name : name;
+    };
+    // Also qualifies the column inside aggregate calls such as SUM(age)
+    auto qualify = [&](const std::string& name) {
+        size_t open = name.find('(');
+        if (open == std::string::npos || name.back() != ')') {
+            return name == "*" ? name : qualify_column(name);
+        }
+        std::string argument = name.substr(open + 1, name.size() - open - 2);
+        return name.substr(0, open + 1) + (argument == "*" ? argument : qualify_column(argument)) + ")";
+    };
+
+    Statement resolved;
+    resolved.command = statement.command;
+    for (const std::string& name : statement.columns) {
+        resolved.columns.push_back(qualify(name));
+    }
+    for (const std::string& name : statement.group_by) {
+        resolved.group_by.push_back(qualify_column(name));
+    }
+    if (statement.having) {
+        resolved.having = statement.having->clone(qualify);
+    }
+    for (const OrderTerm& term : statement.order_by) {
+        resolved.order_by.push_back({qualify(term.column), term.descending});
+    }
+
+    int left_key = joined.get_column_index(qualify_column(statement.join_left));
+    int right_key = joined.get_column_index(qualify_column(statement.join_right));
+    if (left_key == -1 || right_key == -1) {
+        throw std::runtime_error("Join column not found: " +
+                                 (left_key == -1 ? statement.join_left : statement.join_right));
+    }
+    if (left_key >= left_width) {
+        std::swap(left_key, right_key);
+    }
+    if (left_key >= left_width || right_key < left_width) {
+        throw std::runtime_error("JOIN must compare a column of each table");
+    }
+    right_key -= left_width;
+    ColumnType key_type = join_key_type(left_schema[left_key].type, right_schema[right_key].type);
+
+    std::vector<const Expression*> conjuncts;
+    split_conjuncts(statement.condition.get(), conjuncts);
+    std::vector<std::unique_ptr<Expression>> left_conjuncts, right_conjuncts, residual_conjuncts;
+    auto unqualify = [](const std::string& name) {
+        return name.substr(name.find('.') + 1);
+    };
+    for (const Expression* conjunct : conjuncts) {
+        std::unique_ptr<Expression> qualified = conjunct->clone(qualify_column);
+        std::vector<std::string> names;
+        collect_columns(qualified.get(), names);
+        auto all_from = [&names](const std::string& table_name) {
+            std::string prefix = table_name + ".";
+            return std::all_of(names.begin(), names.end(), [&prefix](const std::string& name) {
+                return name.compare(0, prefix.size(), prefix) == 0;
+            });
+        };
+        if (all_from(left_name)) {
+            left_conjuncts.push_back(qualified->clone(unqualify));
+        } else if (all_from(right_name)) {
+            right_conjuncts.push_back(qualified->clone(unqualify));
+        } else {
+            residual_conjuncts.push_back(std::move(qualified));
+        }
+    }
+    std::unique_ptr<Expression> left_condition = Expression::join(Expression::AND, std::move(left_conjuncts));
+    std::unique_ptr<Expression> right_condition = Expression::join(Expression::AND, std::move(right_conjuncts));
+    std::unique_ptr<Expression> residual = Expression::join(Expression::AND, std::move(residual_conjuncts));
+    CompiledPredicate residual_predicate = CompiledPredicate::compile(residual.get(), joined, parameters);
+
+    RowSource source;
+    source.scan = [&](const BatchVisitor& visitor) {
+        std::shared_lock<std::shared_mutex> left_lock(left.get_mutex());
+        std::shared_lock<std::shared_mutex> right_lock(right.get_mutex());
+        QueryProfile* profile = QueryProfile::current();
+        QueryProfile::Phase phase(QueryProfile::JOIN);
+        JoinedBatch output(joined, residual_predicate, visitor, phase.get_previous());
+        // How the tables are joined goes first in the plan, then how each one is read
+        auto note_join = [&](const std::string& line) {
+            if (profile != nullptr) {
+                profile->note(line + " ON " + left_name + "." + left_schema[left_key].name + " = " + right_name +
+                              "." + right_schema[right_key].name +
+                              (residual != nullptr ? " WHERE " + residual->to_string() : ""));
+            }
+        };
+
+        // Look inner rows up by key when the inner side is indexed on the
+        // join column and much bigger than the outer one
+        bool same_type = left_schema[left_key].type == right_schema[right_key].type;
+        auto can_look_up = [&](const Table& inner, int inner_key, const Table& outer) {
+            return same_type && (inner_key == 0 || inner.find_index(inner_key, false) != nullptr) &&
+                   static_cast<size_t>(outer.get_row_count()) * INDEX_JOIN_RATIO <=
+                   static_cast<size_t>(inner.get_row_count());
+        };
+        bool inner_is_right = can_look_up(right, right_key, left);
+        if (inner_is_right || can_look_up(left, left_key, right)) {
+            const Table& inner = inner_is_right ? right : left;
+            const Table& outer = inner_is_right ? left : right;
+            int inner_key = inner_is_right ? right_key : left_key;
+            int outer_key = inner_is_right ? left_key : right_key;
+            const Expression* outer_condition = inner_is_right ? left_condition.get() : right_condition.get();
+            const Expression* inner_condition = inner_is_right ? right_condition.get() : left_condition.get();
+            CompiledPredicate inner_predicate = CompiledPredicate::compile(inner_condition, inner.get_schema(),
+                                                                           parameters);
+            const SecondaryIndex* index = inner_key == 0 ? nullptr : inner.find_index(inner_key, false);
+            const std::string& inner_name = inner_is_right ? right_name : left_name;
+            note_join("NESTED LOOP JOIN");
+            note_access(inner_is_right ? left_name : right_name, outer, outer_condition, parameters, 0);
+            if (profile != nullptr) {
+                profile->note("SEARCH " + inner_name + " USING " +
+                              (index != nullptr ? std::string(index_type_name(index->get_type())) + " INDEX ON " +
+                                                  index->get_column_name()
+                                                : std::string("PRIMARY KEY")) +
+                              " FOR EACH ROW" +
+                              (inner_condition != nullptr ? " WHERE " + inner_condition->to_string() : ""));
+            }
+            std::vector<int64_t> keys;
+            std::string payload;
+            for_each_match_batch(outer, outer_condition, parameters, [&](const RecordView* rows, size_t count) {
+                for (size_t i = 0; i < count; ++i) {
+                    keys.clear();
+                    if (index != nullptr) {
+                        index->find_equal(rows[i].get_value(outer_key), keys);
+                    } else {
+                        keys.push_back(rows[i].get_integer(outer_key));
+                    }
+                    for (int64_t key : keys) {
+                        if (!inner.lookup(key, payload)) {
+                            continue;
+                        }
+                        RecordView inner_row(inner.get_schema(), payload);
+                        if (inner_predicate.matches(inner_row) &&
+                            !(inner_is_right ? output.add(rows[i], inner_row) : output.add(inner_row, rows[i]))) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            });
+            output.flush();
+            return;
+        }
+
+        // Hash join, building on the side with fewer rows
+        bool build_left = left.get_row_count() <= right.get_row_count();
+        const Table& build = build_left ? left : right;
+        const Table& probe = build_left ? right : left;
+        int build_key = build_left ? left_key : right_key;
+        int probe_key = build_left ? right_key : left_key;
+        const Expression* build_condition = build_left ? left_condition.get() : right_condition.get();
+        const Expression* probe_condition = build_left ? right_condition.get() : left_condition.get();
+        note_join("HASH JOIN");
+        note_access(build_left ? left_name : right_name, build, build_condition, parameters, 0);
+        note_access(build_left ? right_name : left_name, probe, probe_condition, parameters, 0);
+        JoinHashTable hash_table(build.get_schema(), build_key, key_type);
+        for_each_match_batch(build, build_condition, parameters, [&hash_table](const RecordView* rows, size_t count) {
+            hash_table.add(rows, count);
+            return true;
+        });
+        if (hash_table.size() == 0) {
+            return;
+        }
+        bool nested_loop = hash_table.size() <= NESTED_LOOP_ROWS;
+        if (!nested_loop) {
+            hash_table.build();
+        }
+        if (profile != nullptr) {
+            profile->note((nested_loop ? "COMPARED EACH PROBE ROW WITH " : "HASHED ") +
+                          std::to_string(hash_table.size()) + " BUILD ROWS");
+        }
+        auto emit = [&](const RecordView& probe_row, const RecordView& build_row) {
+            build_left ? output.add(build_row, probe_row) : output.add(probe_row, build_row);
+        };
+        for_each_match_batch(probe, probe_condition, parameters, [&](const RecordView* rows, size_t count) {
+            if (nested_loop) {
+                for (size_t i = 0; i < count; ++i) {
+                    Value key = join_key(rows[i], probe_key, key_type);
+                    for (size_t b = 0; b < hash_table.size(); ++b) {
+                        RecordView build_row = hash_table.get_row(b);
+                        if (join_key(build_row, build_key, key_type) == key) {
+                            emit(rows[i], build_row);
+                        }
+                    }
+                }
+            } else {
+                hash_table.probe(rows, count, probe_key, [&](size_t i, const RecordView& build_row) {
+                    emit(rows[i], build_row);
+                });
+            }
+            return !output.is_stopped();
+        });
+        output.flush();
+    };
+
+    if (is_aggregate_query(resolved, joined)) {
+        return aggregate_rows(joined, source, resolved, parameters, limit, offset, sink);
+    }
+    return emit_rows(joined, source, resolved, false, limit, offset, sink);
 }
 
 void Database::initialize_database() {
     try {
-        create_table("users", {"id", "name", "age"});
-        create_table("products", {"id", "name", "price"});
+        if (tables.find("users") == tables.end()) {
+            create_table("users", {{"id", ColumnType::INTEGER}, {"name", ColumnType::TEXT}, {"age", ColumnType::INTEGER}});
+        }
+        if (tables.find("products") == tables.end()) {
+            create_table("products", {{"id", ColumnType::INTEGER}, {"name", ColumnType::TEXT}, {"price", ColumnType::REAL}});
+        }
 
         // You can add more tables here as needed
     } catch (const std::exception& e) {
@@ -112,20 +2315,131 @@ void Database::initialize_database() {
     }
 }
 
-void Database::execute_insert(const std::string& table_name, const std::vector<std::string>& values) {
+size_t Database::execute_insert(const std::string& table_name, const std::vector<std::string>& values,
+                                size_t row_count, uint64_t& lsn) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
     auto it = tables.find(table_name);
     if (it == tables.end()) {
         throw std::runtime_error("Table not found: " + table_name);
     }
 
-    it->second->insert(values);
+    auto& table = it->second;
+    if (row_count == 1) {
+        if (values.empty() || !owns_key(values[0])) {
+            return 0;
+        }
+        std::unique_lock<std::shared_mutex> table_lock(table->get_mutex());
+        table->insert(values);
+        lsn = table->get_last_lsn();
+        return 1;
+    }
+
+    // Encode every row before taking the table lock; a bad row rejects the whole statement
+    const Schema& schema = table->get_schema();
+    size_t width = values.size() / row_count;
+    std::vector<BTree::Entry> rows;
+    rows.reserve(row_count);
+    std::vector<std::string> row(width);
+    for (size_t r = 0; r < row_count; ++r) {
+        if (width == 0 || !owns_key(values[r * width])) {
+            continue;
+        }
+        std::copy(values.begin() + r * width, values.begin() + (r + 1) * width, row.begin());
+        std::string payload = schema.encode(row);
+        int64_t key = RecordView(schema, payload).get_integer(0);
+        rows.emplace_back(key, std::move(payload));
+    }
+
+    size_t inserted = rows.size();
+    std::unique_lock<std::shared_mutex> table_lock(table->get_mutex());
+    table->insert_rows(std::move(rows));
+    lsn = table->get_last_lsn();
+    return inserted;
+}
+
+// A shard only keeps the rows of its own keys. Keys that don't parse as
+// integers are let through for encoding to reject.
+bool Database::owns_key(const std::string& key) const {
+    if (shard_count == 1) {
+        return true;
+    }
+    Value value = bind_literal(ColumnType::INTEGER, key);
+    const int64_t* integer = std::get_if<int64_t>(&value);
+    return integer == nullptr || get_shard(*integer, shard_count) == shard_index;
+}
+
+size_t get_shard(int64_t key, size_t shard_count) {
+    // Mixed first, so runs of consecutive keys spread over every shard
+    uint64_t x = static_cast<uint64_t>(key);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return static_cast<size_t>(x % shard_count);
+}
+
+// Parses the file in parallel without any lock, then loads it while no other
+// statement runs. The rows bypass the log: the checkpoint that follows makes
+// them durable, and a crash before it rolls the file back to the previous one.
+// Clients name the file relative to copy_dir, and may not leave it, not even
+// through a symlink. Errors name that path only and never quote the file.
+size_t Database::execute_copy(const std::string& table_name, const std::string& path, bool header) {
+    if (copy_dir.empty()) {
+        throw std::runtime_error("COPY is disabled; start the server with --copy-dir");
+    }
+    std::filesystem::path relative(path);
+    bool escapes = relative.empty() || relative.has_root_path();
+    for (const std::filesystem::path& part : relative) {
+        escapes = escapes || part == "..";
+    }
+    if (escapes) {
+        throw std::runtime_error("COPY takes a path inside the copy directory, without ..: " + path);
+    }
+    std::error_code error;
+    std::filesystem::path root = std::filesystem::canonical(copy_dir, error);
+    std::filesystem::path file = error ? root : std::filesystem::canonical(root / relative, error);
+    if (error) {
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+    if (std::mismatch(root.begin(), root.end(), file.begin(), file.end()).first != root.end()) {
+        throw std::runtime_error("COPY takes a path inside the copy directory: " + path);
+    }
+
+    std::shared_ptr<Table> table;
+    {
+        std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
+        auto it = tables.find(table_name);
+        if (it == tables.end()) {
+            throw std::runtime_error("Table not found: " + table_name);
+        }
+        table = it->second;
+    }
+
+    std::vector<BTree::Entry> rows;
+    try {
+        rows = CsvLoader::load(file.string(), table->get_schema(), header);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(path + ", " + e.what());
+    }
+    if (shard_count > 1) {
+        rows.erase(std::remove_if(rows.begin(), rows.end(), [this](const BTree::Entry& row) {
+            return get_shard(row.first, shard_count) != shard_index;
+        }), rows.end());
+    }
+
+    std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+    table->bulk_load(rows);
+    write_checkpoint();
+    return rows.size();
 }
 
-void Database::execute_update(const std::string& table_name,
-                              const std::vector<std::string>& columns,
-                              const std::vector<std::string>& values,
-                              const std::string& condition) {
+size_t Database::execute_update(const std::string& table_name,
+                                const std::vector<std::string>& columns,
+                                const std::vector<std::string>& values,
+                                const Expression* condition,
+                                const std::vector<std::string>& parameters,
+                                uint64_t& lsn) {
     // Check if the table exists
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
     auto it = tables.find(table_name);
     if (it == tables.end()) {
         throw std::runtime_error("Table not found: " + table_name);
@@ -144,81 +2458,107 @@ void Database::execute_update(const std::string& table_name,
         if (index == -1) {
             throw std::runtime_error("Column not found: " + col);
         }
+        // Rows are stored under their key, so changing it would strand the row
+        if (index == 0) {
+            throw std::runtime_error("The primary key column can't be updated: " + col);
+        }
         col_indices.push_back(index);
     }
 
-    // Parse the condition
-    std::string condition_column;
-    std::string condition_operator;
-    std::string condition_value;
-    if (!condition.empty()) {
-        std::istringstream iss(condition);
-        iss >> condition_column >> condition_operator >> condition_value;
-
-        // Remove quotes from condition value if present
-        if (condition_value.front() == '\'' && condition_value.back() == '\'') {
-            condition_value = condition_value.substr(1, condition_value.length() - 2);
-        }
-    }
-
-    int condition_col_index = -1;
-    if (!condition_column.empty()) {
-        condition_col_index = table->get_column_index(condition_column);
-        if (condition_col_index == -1) {
-            throw std::runtime_error("Condition column not found: " + condition_column);
-        }
-    }
-
-    // Update the rows
-    int updated_count = 0;
-    for (int row = 0; row < table->get_row_count(); ++row) {
-        auto row_data = table->select(row);
-
-        // Check if this row satisfies the condition
-        bool satisfies_condition = condition.empty();
-        if (!satisfies_condition) {
-            const std::string& cell_value = row_data[condition_col_index];
-            if (condition_operator == "=") {
-                satisfies_condition = (cell_value == condition_value);
-            } else if (condition_operator == ">") {
-                satisfies_condition = (std::stod(cell_value) > std::stod(condition_value));
-            } else if (condition_operator == "<") {
-                satisfies_condition = (std::stod(cell_value) < std::stod(condition_value));
-            } else if (condition_operator == ">=") {
-                satisfies_condition = (std::stod(cell_value) >= std::stod(condition_value));
-            } else if (condition_operator == "<=") {
-                satisfies_condition = (std::stod(cell_value) <= std::stod(condition_value));
-            } else if (condition_operator == "!=") {
-                satisfies_condition = (cell_value != condition_value);
-            } else {
-                throw std::runtime_error("Unknown operator in condition: " + condition_operator);
-            }
-        }
+    const Schema& schema = table->get_schema();
+    std::unique_lock<std::shared_mutex> table_lock(table->get_mutex());
 
-        if (satisfies_condition) {
-            // Update the values for this row
-            for (size_t i = 0; i < col_indices.size(); ++i) {
-                row_data[col_indices[i]] = values[i];
-            }
-            table->update(std::stoi(row_data[0]), row_data);
-            updated_count++;
+    // Collect the new row images first; the tree can't change under an open scan.
+    // A parallel scan collects them per morsel, which keeps key order overall.
+    std::vector<KeyRange> morsels = plan_parallel_scan(*table, condition, parameters);
+    if (QueryProfile* profile = QueryProfile::current()) {
+        profile->note("UPDATE " + table_name);
+    }
+    note_access(table_name, *table, condition, parameters, morsels.size());
+    QueryProfile::Phase output(QueryProfile::OUTPUT);
+    std::vector<std::vector<std::pair<int64_t, std::vector<std::string>>>> updated_rows(
+            std::max<size_t>(morsels.size(), 1));
+    auto collect = [&](size_t morsel, const RecordView& row) {
+        // Update the values for this row
+        std::vector<std::string> row_data = schema.decode(row.get_data());
+        for (size_t i = 0; i < col_indices.size(); ++i) {
+            row_data[col_indices[i]] = values[i];
         }
+        updated_rows[morsel].emplace_back(row.get_integer(0), std::move(row_data));
+    };
+    if (!morsels.empty()) {
+        scan_morsels(scan_pool, *table, condition, parameters, morsels,
+                     [&](size_t morsel, size_t, const RecordView* rows, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                collect(morsel, rows[i]);
+            }
+        });
+    } else {
+        for_each_match(*table, condition, parameters, [&](const RecordView& row) {
+            collect(0, row);
+            return true;
+        });
     }
 
-    std::cout << "Updated " << updated_count << " row(s)" << std::endl;
+    size_t row_count = 0;
+    for (const auto& rows : updated_rows) {
+        for (const auto& updated : rows) {
+            table->update(updated.first, updated.second);
+        }
+        row_count += rows.size();
+    }
+    lsn = table->get_last_lsn();
+    table_lock.unlock();
+    return row_count;
 }
 
-void Database::execute_delete(const std::string& table_name, const std::string& condition) {
+size_t Database::execute_delete(const std::string& table_name, const Expression* condition,
+                                const std::vector<std::string>& parameters, uint64_t& lsn) {
+    std::shared_lock<std::shared_mutex> catalog_lock(catalog_mutex);
     auto it = tables.find(table_name);
     if (it == tables.end()) {
         throw std::runtime_error("Table not found: " + table_name);
     }
 
     auto& table = it->second;
-    for (int i = table->get_row_count() - 1; i >= 0; --i) {
-        auto row = table->select(i);
-        if (condition.empty() || row[0] == condition) {
-            table->remove(std::stoi(row[0]));
+    std::unique_lock<std::shared_mutex> table_lock(table->get_mutex());
+    std::vector<KeyRange> morsels = plan_parallel_scan(*table, condition, parameters);
+    if (QueryProfile* profile = QueryProfile::current()) {
+        profile->note("DELETE FROM " + table_name);
+    }
+    note_access(table_name, *table, condition, parameters, morsels.size());
+    QueryProfile::Phase output(QueryProfile::OUTPUT);
+    std::vector<std::vector<int64_t>> keys(std::max<size_t>(morsels.size(), 1));
+    if (!morsels.empty()) {
+        scan_morsels(scan_pool, *table, condition, parameters, morsels,
+                     [&keys](size_t morsel, size_t, const RecordView* rows, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                keys[morsel].push_back(rows[i].get_integer(0));
+            }
+        });
+    } else {
+        for_each_match(*table, condition, parameters, [&keys](const RecordView& row) {
+            keys[0].push_back(row.get_integer(0));
+            return true;
+        });
+    }
+    size_t row_count = 0;
+    for (const std::vector<int64_t>& morsel_keys : keys) {
+        for (int64_t key : morsel_keys) {
+            table->remove(key);
         }
+        row_count += morsel_keys.size();
+    }
+    lsn = table->get_last_lsn();
+    return row_count;
+}
+
+void Database::create_index(const std::string& table_name, const std::string& column_name, IndexType type) {
+    std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+    auto it = tables.find(table_name);
+    if (it == tables.end()) {
+        throw std::runtime_error("Table not found: " + table_name);
     }
-}
\ No newline at end of file
+    it->second->create_index(column_name, type);
+    write_checkpoint();
+}
@@ -5,25 +5,91 @@
 #include "../include/database_client.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
-#include <sstream>
 #include <vector>
+#include <algorithm>
 
 std::vector<std::vector<std::string>> DatabaseClient::execute_query(const std::string& query) {
     try {
-        connect_to_server();
-        send_query(query);
-        return receive_results();
+        std::vector<std::vector<std::string>> results;
+        for (const auto& row : execute_typed_query(query)) {
+            std::vector<std::string> cells;
+            cells.reserve(row.size());
+            for (const Value& value : row) {
+                cells.push_back(value_to_string(value));
+            }
+            results.push_back(std::move(cells));
+        }
+        return results;
     } catch (const std::exception& e) {
         std::cerr << "Error executing query: " << e.what() << std::endl;
         return {};
     }
 }
 
-void DatabaseClient::connect_to_server() {
+std::vector<std::vector<Value>> DatabaseClient::execute_typed_query(const std::string& query) {
+    return submit(query).get().rows;
+}
+
+std::future<QueryResult> DatabaseClient::submit(const std::string& query) {
+    Connection& connection = *connections[next_connection++ % connections.size()];
+    std::lock_guard<std::mutex> lock(connection.write_mutex);
+    if (connection.sock < 0 || connection.broken) {
+        disconnect(connection);
+        connect_to_server(connection);
+    }
+
+    std::future<QueryResult> result;
+    {
+        std::lock_guard<std::mutex> pending_lock(connection.pending_mutex);
+        std::promise<QueryResult> promise;
+        result = promise.get_future();
+        if (connection.broken) {
+            // The reader already failed the queue and exited
+            promise.set_exception(std::make_exception_ptr(std::runtime_error("Connection lost")));
+            return result;
+        }
+        connection.pending.push_back(std::move(promise));
+    }
+    send_query(connection, query);
+    return result;
+}
+
+void DatabaseClient::prepare(const std::string& name, const std::string& query) {
+    execute_query("PREPARE " + name + " AS " + query);
+}
+
+std::vector<std::vector<std::string>> DatabaseClient::execute(const std::string& name,
+                                                              const std::vector<std::string>& parameters) {
+    return execute_query(format_execute(name, parameters));
+}
+
+std::future<QueryResult> DatabaseClient::submit_execute(const std::string& name,
+                                                        const std::vector<std::string>& parameters) {
+    return submit(format_execute(name, parameters));
+}
+
+// Quoted strings have no escapes: a value is quoted with whichever quote
+// character it doesn't contain, and a value containing both can't be sent
+std::string DatabaseClient::format_execute(const std::string& name, const std::vector<std::string>& parameters) {
+    std::string query = "EXECUTE " + name + " (";
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        bool single = parameters[i].find('\'') != std::string::npos;
+        if (single && parameters[i].find('"') != std::string::npos) {
+            throw std::runtime_error("Parameter " + std::to_string(i + 1) + " contains both ' and \"");
+        }
+        char quote = single ? '"' : '\'';
+        query += (i > 0 ? ", " : "") + std::string(1, quote) + parameters[i] + quote;
+    }
+    return query + ")";
+}
+
+void DatabaseClient::connect_to_server(Connection& connection) {
     sockaddr_in serv_addr;
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(server_port);
@@ -32,82 +98,136 @@ void DatabaseClient::connect_to_server() {
         throw std::runtime_error("Invalid address / Address not supported");
     }
 
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        throw std::runtime_error("Failed to create socket");
+    }
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        throw std::runtime_error("Connection failed: " + std::string(strerror(errno)));
+        std::string error = strerror(errno);
+        close(sock);
+        throw std::runtime_error("Connection failed: " + error);
     }
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    connection.sock = sock;
+    connection.broken = false;
+    connection.reader = std::thread(&DatabaseClient::receive_results, this, std::ref(connection));
 }
 
-void DatabaseClient::send_query(const std::string& query) {
-    int total_sent = 0;
-    int remaining = query.length();
-    const char* ptr = query.c_str();
+// Called with write_mutex held (or from the destructor). Shutting the socket
+// down wakes the reader thread, which fails whatever is still pending.
+void DatabaseClient::disconnect(Connection& connection) {
+    if (connection.sock >= 0) {
+        shutdown(connection.sock, SHUT_RDWR);
+    }
+    if (connection.reader.joinable()) {
+        connection.reader.join();
+    }
+    if (connection.sock >= 0) {
+        close(connection.sock);
+        connection.sock = -1;
+    }
+}
 
-    while (total_sent < query.length()) {
-        int sent = send(sock, ptr + total_sent, remaining, 0);
+void DatabaseClient::send_query(Connection& connection, const std::string& query) {
+    std::string frame;
+    frame.reserve(FRAME_HEADER_SIZE + query.size());
+    append_frame(frame, FrameType::QUERY, query);
+    size_t total_sent = 0;
+    size_t remaining = frame.length();
+    const char* ptr = frame.c_str();
+
+    while (total_sent < frame.length()) {
+        ssize_t sent = send(connection.sock, ptr + total_sent, remaining, MSG_NOSIGNAL);
         if (sent < 0) {
-            throw std::runtime_error("Error sending query: " + std::string(strerror(errno)));
+            if (errno == EINTR) {
+                continue;
+            }
+            // The reader notices the shutdown and fails this query's future
+            connection.broken = true;
+            shutdown(connection.sock, SHUT_RDWR);
+            return;
         }
         total_sent += sent;
         remaining -= sent;
     }
 }
 
-std::vector<std::vector<std::string>> DatabaseClient::receive_results() {
-    std::string response;
-    char buffer[1024];
-    int bytes_received;
+// Reader thread: collects ROW_BATCH frames until the END frame and completes
+// the oldest pending future; an ERROR frame completes it with an exception
+void DatabaseClient::receive_results(Connection& connection) {
+    std::string input;
+    QueryResult result;
+    char buffer[65536];
 
-    while ((bytes_received = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0) {
-        buffer[bytes_received] = '\0';
-        response += buffer;
+    try {
+        while (true) {
+            size_t offset = 0;
+            FrameType type;
+            std::string_view payload;
+            while (read_frame(input, offset, type, payload)) {
+                if (type == FrameType::ROW_BATCH) {
+                    decode_row_batch(payload, result.rows);
+                    continue;
+                }
+                if (type != FrameType::END && type != FrameType::ERROR) {
+                    throw std::runtime_error("Unexpected frame from server");
+                }
+                std::promise<QueryResult> promise;
+                {
+                    std::lock_guard<std::mutex> lock(connection.pending_mutex);
+                    if (connection.pending.empty()) {
+                        throw std::runtime_error("Response without a pending query");
+                    }
+                    promise = std::move(connection.pending.front());
+                    connection.pending.pop_front();
+                }
+                if (type == FrameType::ERROR) {
+                    promise.set_exception(std::make_exception_ptr(std::runtime_error(std::string(payload))));
+                } else {
+                    result.row_count = decode_end(payload);
+                    promise.set_value(std::move(result));
+                }
+                result = QueryResult();
+            }
+            input.erase(0, offset);
 
-        if (bytes_received < sizeof(buffer) - 1) {
-            break;
+            ssize_t bytes_received = recv(connection.sock, buffer, sizeof(buffer), 0);
+            if (bytes_received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_received <= 0) {
+                std::string error = bytes_received < 0 ? strerror(errno) : "connection closed";
+                throw std::runtime_error("Error receiving results: " + error);
+            }
+            input.append(buffer, bytes_received);
         }
+    } catch (const std::exception& e) {
+        connection.broken = true;
+        fail_pending(connection, e.what());
     }
+}
 
-    if (bytes_received < 0) {
-        throw std::runtime_error("Error receiving results: " + std::string(strerror(errno)));
-    }
-
-    if (response.substr(0, 6) == "Error:") {
-        throw std::runtime_error(response.substr(7));
+void DatabaseClient::fail_pending(Connection& connection, const std::string& error) {
+    std::lock_guard<std::mutex> lock(connection.pending_mutex);
+    for (auto& promise : connection.pending) {
+        promise.set_exception(std::make_exception_ptr(std::runtime_error(error)));
     }
-
-    return deserialize_results(response);
+    connection.pending.clear();
 }
 
-DatabaseClient::DatabaseClient(const std::string& ip, int port) : server_ip(ip), server_port(port) {
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        throw std::runtime_error("Failed to create socket");
+DatabaseClient::DatabaseClient(const std::string& ip, int port, size_t pool_size)
+        : server_ip(ip), server_port(port), next_connection(0) {
+    for (size_t i = 0; i < std::max<size_t>(pool_size, 1); ++i) {
+        connections.push_back(std::make_unique<Connection>());
     }
 }
 
 DatabaseClient::~DatabaseClient() {
-    close(sock);
-}
-
-std::vector<std::vector<std::string>> DatabaseClient::deserialize_results(const std::string& serialized) {
-    std::vector<std::vector<std::string>> results;
-    std::istringstream iss(serialized);
-    std::string line;
-
-    while (std::getline(iss, line)) {
-        std::vector<std::string> row;
-        std::istringstream line_stream(line);
-        std::string value;
-
-        while (std::getline(line_stream, value, '|')) {
-            if (!value.empty()) {
-                row.push_back(value);
-            }
-        }
-
-        if (!row.empty()) {
-            results.push_back(row);
-        }
+    for (auto& connection : connections) {
+        std::lock_guard<std::mutex> lock(connection->write_mutex);
+        disconnect(*connection);
+        fail_pending(*connection, "Client closed");
     }
-
-    return results;
-}
\ No newline at end of file
+}
@@ -4,86 +4,386 @@
 
 #include "../include/database_server.h"
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <csignal>
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
 void DatabaseServer::run() {
+    epoll_event events[256];
     while (running) {
-        try {
-            int client_socket = accept_connection();
-            if (client_socket >= 0) {
-                std::lock_guard<std::mutex> lock(queue_mutex);
-                client_queue.push(client_socket);
-                queue_cv.notify_one();
+        int count = epoll_wait(epoll_fd, events, 256, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error in main server loop: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            try {
+                if (fd == server_fd) {
+                    accept_connections();
+                } else if (fd == wake_fd) {
+                    uint64_t value;
+                    while (read(wake_fd, &value, sizeof(value)) > 0) {}
+                    process_completions();
+                } else {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                    std::shared_ptr<Connection> connection = it->second;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        close_connection(connection);
+                        continue;
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                        read_from(connection);
+                    }
+                    if (!connection->closed && (events[i].events & EPOLLOUT)) {
+                        write_to(connection);
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error handling client: " << e.what() << std::endl;
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error in main server loop: " << e.what() << std::endl;
-            // Optionally, add a short sleep to prevent tight error loops
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
     }
+
+    while (!connections.empty()) {
+        close_connection(connections.begin()->second);
+    }
 }
 
-void DatabaseServer::worker_function() {
-    while (running) {
-        int client_socket = -1;
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            queue_cv.wait(lock, [this] { return !client_queue.empty() || !running; });
-            if (!running) return;
-            client_socket = client_queue.front();
-            client_queue.pop();
+void DatabaseServer::accept_connections() {
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        int client_socket = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // e.g. EMFILE: leave the rest in the backlog until a descriptor frees up
+                std::cerr << "Error accepting connection: " << strerror(errno) << std::endl;
+            }
+            return;
         }
 
-        try {
-            handle_client(client_socket);
-        } catch (const std::exception& e) {
-            std::cerr << "Error handling client: " << e.what() << std::endl;
-        }
+        // Responses are small and often pipelined; don't let Nagle hold them back
+        int opt = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
 
-        close(client_socket);
+        auto connection = std::make_shared<Connection>();
+        connection->fd = client_socket;
+        connection->events = EPOLLIN | EPOLLRDHUP;
+        epoll_event event = {};
+        event.events = connection->events;
+        event.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            close(client_socket);
+            throw std::runtime_error("Failed to register connection: " + std::string(strerror(errno)));
+        }
+        connections[client_socket] = connection;
+        Metrics::add(Metrics::CONNECTIONS_ACCEPTED);
+        Metrics::record(Metrics::ACCEPT, start);
     }
 }
 
-void DatabaseServer::handle_client(int client_socket) {
-    char buffer[1024] = {0};
-    int valread = read(client_socket, buffer, 1024);
-    if (valread < 0) {
-        throw std::runtime_error("Error reading from socket");
+// Drains the socket and queues every complete QUERY frame. Anything else is a
+// protocol error: the client gets an ERROR frame and the connection closes.
+void DatabaseServer::read_from(const std::shared_ptr<Connection>& connection) {
+    auto start = std::chrono::steady_clock::now();
+    char buffer[16384];
+    size_t budget = READ_BUDGET;
+    while (budget > 0) {
+        ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            connection->input.append(buffer, n);
+            budget -= std::min(budget, static_cast<size_t>(n));
+            Metrics::add(Metrics::BYTES_RECEIVED, n);
+            continue;
+        }
+        if (n == 0) {
+            connection->eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_connection(connection);
+            return;
+        }
+        break;
     }
-    std::string query(buffer);
 
+    size_t offset = 0;
     try {
-        auto results = db.execute_query(query);
-        std::string response = serialize_results(results);
-        send_response(client_socket, response);
+        FrameType type;
+        std::string_view payload;
+        while (read_frame(connection->input, offset, type, payload)) {
+            if (type != FrameType::QUERY) {
+                throw std::runtime_error("Expected a QUERY frame");
+            }
+            connection->pending.emplace_back(payload);
+        }
+        connection->input.erase(0, offset);
     } catch (const std::exception& e) {
-        std::string error_msg = "Error: " + std::string(e.what());
-        send_response(client_socket, error_msg);
+        append_frame(connection->output, FrameType::ERROR, std::string("Protocol error: ") + e.what());
+        connection->input.clear();
+        connection->pending.clear();
+        connection->eof = true;
     }
+    Metrics::record(Metrics::READ, start);
+
+    dispatch(connection);
+    write_to(connection);
 }
 
-void DatabaseServer::send_response(int client_socket, const std::string& response) {
-    int total_sent = 0;
-    int remaining = response.length();
-    const char* ptr = response.c_str();
+void DatabaseServer::write_to(const std::shared_ptr<Connection>& connection) {
+    auto start = std::chrono::steady_clock::now();
+    size_t written = 0;
+    while (written < connection->output.size()) {
+        ssize_t n = send(connection->fd, connection->output.data() + written,
+                         connection->output.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close_connection(connection);
+            return;
+        }
+        written += n;
+    }
+    connection->output.erase(0, written);
+    if (written > 0) {
+        Metrics::add(Metrics::BYTES_SENT, written);
+        Metrics::record(Metrics::SEND, start);
+    }
+
+    if (connection->eof && !connection->busy && !connection->cursor && connection->pending.empty() &&
+        connection->output.empty()) {
+        close_connection(connection);
+        return;
+    }
+    // Freed buffer space may let a held-back query run or continue
+    dispatch(connection);
+    update_events(connection);
+}
 
-    while (total_sent < response.length()) {
-        int sent = send(client_socket, ptr + total_sent, remaining, 0);
-        if (sent < 0) {
-            throw std::runtime_error("Error sending response: " + std::string(strerror(errno)));
+// Hands the connection's running query or else its next one to the workers,
+// unless a worker has it already or the client isn't reading its responses
+void DatabaseServer::dispatch(const std::shared_ptr<Connection>& connection) {
+    if (connection->busy) {
+        return;
+    }
+    Task task;
+    task.connection = connection;
+    if (connection->cursor) {
+        if (connection->output.size() >= STREAM_OUTPUT_BUFFER) {
+            return;
+        }
+        task.cursor = std::move(connection->cursor);
+        task.cache_fill = std::move(connection->cache_fill);
+    } else {
+        if (connection->pending.empty() || connection->output.size() >= MAX_OUTPUT_BUFFER) {
+            return;
         }
-        total_sent += sent;
-        remaining -= sent;
+        task.query = std::move(connection->pending.front());
+        connection->pending.pop_front();
+        if (slow_query_log != nullptr) {
+            connection->query = task.query;
+        }
+        connection->query_start = std::chrono::steady_clock::now();
+        connection->query_queued = {};
+        connection->query_executed = {};
+        connection->query_bytes = 0;
+    }
+    connection->busy = true;
+    task.queued_at = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        task_queue.push(std::move(task));
     }
+    queue_cv.notify_one();
 }
 
+// Stops reading from clients that have too much queued up, and asks for
+// EPOLLOUT only while there is output the socket didn't take
+void DatabaseServer::update_events(const std::shared_ptr<Connection>& connection) {
+    uint32_t events = 0;
+    if (!connection->eof && connection->pending.size() < MAX_PENDING_QUERIES &&
+        connection->output.size() < MAX_OUTPUT_BUFFER) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (!connection->output.empty()) {
+        events |= EPOLLOUT;
+    }
+    if (events == connection->events) {
+        return;
+    }
+    connection->events = events;
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = connection->fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+}
 
+void DatabaseServer::close_connection(const std::shared_ptr<Connection>& connection) {
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    connections.erase(connection->fd);
+}
 
-DatabaseServer::DatabaseServer(int port) : running(true) {
+void DatabaseServer::process_completions() {
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        done.swap(completions);
+    }
+    for (auto& completion : done) {
+        const std::shared_ptr<Connection>& connection = completion.connection;
+        if (connection->closed) {
+            continue;
+        }
+        connection->busy = false;
+        connection->cursor = std::move(completion.cursor);
+        connection->cache_fill = std::move(completion.cache_fill);
+        connection->query_queued += completion.queued;
+        connection->query_executed += completion.executed;
+        connection->query_bytes += completion.output.size();
+        if (!connection->cursor) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - connection->query_start);
+            Metrics::record(Metrics::QUERY, static_cast<uint64_t>(elapsed.count()));
+            if (slow_query_log != nullptr && slow_query_log->is_slow(elapsed)) {
+                slow_query_log->record({std::move(connection->query), std::chrono::system_clock::now(), elapsed,
+                                        connection->query_queued, connection->query_executed, completion.row_count,
+                                        connection->query_bytes, completion.failed});
+            }
+        }
+        connection->output += completion.output;
+        write_to(connection);
+    }
+}
+
+void DatabaseServer::worker_function() {
+    while (running) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return !task_queue.empty() || !running; });
+            if (!running) return;
+            task = std::move(task_queue.front());
+            task_queue.pop();
+        }
+        execute(task);
+    }
+}
+
+// Encodes the next batch of the task's query and hands it to the reactor,
+// together with the cursor while the query has rows left. A cached response
+// is handed over whole instead of opening the query.
+void DatabaseServer::execute(Task& task) {
+    auto start = std::chrono::steady_clock::now();
+    Completion completion;
+    completion.connection = task.connection;
+    completion.queued = start - task.queued_at;
+    Metrics::record(Metrics::QUEUE, static_cast<uint64_t>(completion.queued.count()));
+    std::shared_ptr<QueryCursor> cursor = std::move(task.cursor);
+    std::unique_ptr<ResultCache::Fill> fill = std::move(task.cache_fill);
+    RowBatchEncoder batch;
+    try {
+        std::shared_ptr<const std::string> cached;
+        PreparedQuery prepared;
+        if (!cursor && result_cache) {
+            cached = result_cache->find(task.query, completion.row_count, fill, prepared);
+        }
+        if (cached) {
+            Metrics::add(Metrics::QUERIES);
+            Metrics::add(Metrics::ROWS_RETURNED, completion.row_count);
+            completion.output = *cached;
+        } else {
+            if (!cursor) {
+                cursor = sharded_db ? sharded_db->open_query(task.query, prepared)
+                                    : db->open_query(task.query, prepared);
+            }
+            bool more = true;
+            while (more && batch.get_size() < ROW_BATCH_TARGET_SIZE) {
+                more = cursor->next([&batch](const std::vector<Value>& row) { batch.add_row(row); },
+                                    CURSOR_STEP_ROWS);
+            }
+            Metrics::add(Metrics::ROWS_RETURNED, batch.get_row_count());
+            batch.flush_to(completion.output);
+            if (more) {
+                completion.cursor = std::move(cursor);
+            } else {
+                completion.row_count = cursor->get_row_count();
+                append_frame(completion.output, FrameType::END, encode_end(completion.row_count));
+            }
+            if (fill && !result_cache->capture(*fill, completion.output)) {
+                fill.reset();
+            }
+            if (fill && !completion.cursor) {
+                result_cache->insert(*fill, completion.row_count);
+            } else if (fill) {
+                completion.cache_fill = std::move(fill);
+            }
+        }
+    } catch (const std::exception& e) {
+        completion.output.clear();
+        completion.cursor = nullptr;
+        completion.failed = true;
+        append_frame(completion.output, FrameType::ERROR, e.what());
+    }
+    completion.executed = std::chrono::steady_clock::now() - start;
+    Metrics::record(Metrics::EXECUTE, static_cast<uint64_t>(completion.executed.count()));
+    post(std::move(completion));
+}
+
+void DatabaseServer::post(Completion completion) {
+    {
+        std::lock_guard<std::mutex> lock(completion_mutex);
+        completions.push_back(std::move(completion));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        std::cerr << "Error waking reactor: " << strerror(errno) << std::endl;
+    }
+}
+
+
+
+DatabaseServer::DatabaseServer(int port, const DatabaseConfig& config, SlowQueryLog* slow_query_log,
+                               size_t result_cache_size)
+        : slow_query_log(slow_query_log), server_fd(-1), epoll_fd(-1), wake_fd(-1), running(true) {
+    if (config.shard_count > 1) {
+        sharded_db = std::make_unique<ShardedDatabase>(config);
+    } else {
+        db = std::make_unique<Database>(config);
+    }
+    if (result_cache_size > 0) {
+        result_cache = std::make_unique<ResultCache>(
+                [this](const std::string& query, std::string& key, std::vector<std::shared_ptr<const Table>>& tables,
+                       PreparedQuery& prepared) {
+                    return sharded_db ? sharded_db->get_result_key(query, key, tables, prepared)
+                                      : db->get_result_key(query, key, tables, prepared);
+                }, result_cache_size);
+    }
     setup_server(port);
     start_workers();
 }
@@ -94,22 +394,50 @@ DatabaseServer::~DatabaseServer() {
 
 void DatabaseServer::stop() {
     running = false;
-    close(server_fd);
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The reactor also notices running == false on its next wakeup
+        }
+    }
     queue_cv.notify_all();
     for (auto& thread : worker_threads) {
-        thread.join();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    if (server_fd >= 0) {
+        close(server_fd);
+        server_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
     }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+}
+
+// Only flips the flag, so it is safe to call from a signal handler
+void DatabaseServer::request_stop() {
+    running = false;
 }
 
 void DatabaseServer::setup_server(int port) {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == 0) {
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd < 0) {
         throw std::runtime_error("Failed to create socket");
     }
 
+    // Separate calls: option names are numbers, not flags that can be OR'ed
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        throw std::runtime_error("Failed to set socket options");
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        throw std::runtime_error("Failed to set SO_REUSEADDR: " + std::string(strerror(errno)));
+    }
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        throw std::runtime_error("Failed to set SO_REUSEPORT: " + std::string(strerror(errno)));
     }
 
     sockaddr_in address;
@@ -121,31 +449,35 @@ void DatabaseServer::setup_server(int port) {
         throw std::runtime_error("Failed to bind to port");
     }
 
-    if (listen(server_fd, 3) < 0) {
+    // The kernel caps this at net.core.somaxconn
+    if (listen(server_fd, SOMAXCONN) < 0) {
         throw std::runtime_error("Failed to listen");
     }
-}
 
-int DatabaseServer::accept_connection() {
-    sockaddr_in address;
-    int addrlen = sizeof(address);
-    int client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen);
-    return client_socket;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        throw std::runtime_error("Failed to create event loop: " + std::string(strerror(errno)));
+    }
+    for (int fd : {server_fd, wake_fd}) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::runtime_error("Failed to register with epoll: " + std::string(strerror(errno)));
+        }
+    }
 }
 
 void DatabaseServer::start_workers() {
+    // Keep shutdown signals on the reactor thread so they interrupt epoll_wait()
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
     for (int i = 0; i < num_workers; ++i) {
         worker_threads.emplace_back(&DatabaseServer::worker_function, this);
     }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
 }
-
-std::string DatabaseServer::serialize_results(const std::vector<std::vector<std::string>>& results) {
-    std::string serialized;
-    for (const auto& row : results) {
-        for (const auto& value : row) {
-            serialized += value + "|";
-        }
-        serialized += "\n";
-    }
-    return serialized;
-}
\ No newline at end of file
@@ -0,0 +1,301 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/expression.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+using RowFunction = std::function<bool(const RecordView&)>;
+using BatchFunction = std::function<void(const RecordView*, size_t, uint8_t*)>;
+
+// Gathers one numeric column of a block into a local array, then compares the
+// whole array against the literal without branches
+template<typename T, typename Getter, typename Compare>
+BatchFunction gather_filter(Getter get, T literal, Compare compare) {
+    return [get, literal, compare](const RecordView* rows, size_t count, uint8_t* selection) {
+        T values[CompiledPredicate::BATCH_SIZE];
+        for (size_t base = 0; base < count; base += CompiledPredicate::BATCH_SIZE) {
+            size_t block = std::min(CompiledPredicate::BATCH_SIZE, count - base);
+            for (size_t i = 0; i < block; ++i) {
+                values[i] = get(rows[base + i]);
+            }
+            uint8_t* block_selection = selection + base;
+            for (size_t i = 0; i < block; ++i) {
+                block_selection[i] &= static_cast<uint8_t>(compare(values[i], literal));
+            }
+        }
+    };
+}
+
+template<typename Compare>
+void compile_comparison(int column, ColumnType type, const Value& literal, Compare compare,
+                        RowFunction& row_function, BatchFunction& batch_function) {
+    if (type == ColumnType::TEXT) {
+        std::string text = std::get<std::string>(literal);
+        row_function = [column, text, compare](const RecordView& row) {
+            return compare(row.get_text(column), std::string_view(text));
+        };
+        batch_function = [column, text, compare](const RecordView* rows, size_t count, uint8_t* selection) {
+            std::string_view value(text);
+            for (size_t i = 0; i < count; ++i) {
+                if (selection[i]) {
+                    selection[i] = compare(rows[i].get_text(column), value);
+                }
+            }
+        };
+    } else if (type == ColumnType::INTEGER && std::holds_alternative<int64_t>(literal)) {
+        int64_t value = std::get<int64_t>(literal);
+        auto get = [column](const RecordView& row) { return row.get_integer(column); };
+        row_function = [get, value, compare](const RecordView& row) { return compare(get(row), value); };
+        batch_function = gather_filter<int64_t>(get, value, compare);
+    } else if (type == ColumnType::INTEGER) {
+        double value = std::get<double>(literal);
+        auto get = [column](const RecordView& row) { return static_cast<double>(row.get_integer(column)); };
+        row_function = [get, value, compare](const RecordView& row) { return compare(get(row), value); };
+        batch_function = gather_filter<double>(get, value, compare);
+    } else {
+        double value = std::get<double>(literal);
+        auto get = [column](const RecordView& row) { return row.get_real(column); };
+        row_function = [get, value, compare](const RecordView& row) { return compare(get(row), value); };
+        batch_function = gather_filter<double>(get, value, compare);
+    }
+}
+
+} // namespace
+
+std::unique_ptr<Expression> Expression::comparison(const std::string& column, Operator op, const std::string& literal,
+                                                  int parameter) {
+    auto expression = std::make_unique<Expression>();
+    expression->kind = COMPARISON;
+    expression->column = column;
+    expression->op = op;
+    expression->literal = literal;
+    expression->parameter = parameter;
+    return expression;
+}
+
+std::unique_ptr<Expression> Expression::logical(Kind kind, std::unique_ptr<Expression> left,
+                                                std::unique_ptr<Expression> right) {
+    auto expression = std::make_unique<Expression>();
+    expression->kind = kind;
+    expression->left = std::move(left);
+    expression->right = std::move(right);
+    return expression;
+}
+
+std::unique_ptr<Expression> Expression::join(Kind kind, std::vector<std::unique_ptr<Expression>> terms) {
+    if (terms.empty()) {
+        return nullptr;
+    }
+    // Pairs neighbours up level by level, which keeps the terms in order
+    while (terms.size() > 1) {
+        std::vector<std::unique_ptr<Expression>> level;
+        for (size_t i = 0; i + 1 < terms.size(); i += 2) {
+            level.push_back(logical(kind, std::move(terms[i]), std::move(terms[i + 1])));
+        }
+        if (terms.size() % 2 != 0) {
+            level.push_back(std::move(terms.back()));
+        }
+        terms = std::move(level);
+    }
+    return std::move(terms.front());
+}
+
+const std::string& Expression::get_literal(const std::vector<std::string>& parameters) const {
+    if (parameter < 0) {
+        return literal;
+    }
+    if (static_cast<size_t>(parameter) >= parameters.size()) {
+        throw std::runtime_error("No value bound for parameter " + std::to_string(parameter + 1));
+    }
+    return parameters[parameter];
+}
+
+std::string Expression::to_string() const {
+    switch (kind) {
+        case COMPARISON:
+            return column + " " + operator_name(op) + (parameter < 0 ? " '" + literal + "'" : " ?");
+        case AND:
+            return "(" + left->to_string() + " AND " + right->to_string() + ")";
+        case OR:
+            return "(" + left->to_string() + " OR " + right->to_string() + ")";
+        case NOT:
+            return "NOT " + left->to_string();
+    }
+    return "";
+}
+
+std::unique_ptr<Expression> Expression::clone(const std::function<std::string(const std::string&)>& rename) const {
+    if (kind == COMPARISON) {
+        return comparison(rename(column), op, literal, parameter);
+    }
+    return logical(kind, left->clone(rename), right ? right->clone(rename) : nullptr);
+}
+
+Expression::Operator parse_operator(std::string_view op) {
+    if (op == "=") return Expression::EQ;
+    if (op == "!=") return Expression::NE;
+    if (op == "<") return Expression::LT;
+    if (op == ">") return Expression::GT;
+    if (op == "<=") return Expression::LE;
+    if (op == ">=") return Expression::GE;
+    throw std::runtime_error("Unknown operator in condition: " + std::string(op));
+}
+
+// Operator to use when the operands are swapped, e.g. 5 < age becomes age > 5
+Expression::Operator flip_operator(Expression::Operator op) {
+    switch (op) {
+        case Expression::LT: return Expression::GT;
+        case Expression::GT: return Expression::LT;
+        case Expression::LE: return Expression::GE;
+        case Expression::GE: return Expression::LE;
+        default: return op;
+    }
+}
+
+const char* operator_name(Expression::Operator op) {
+    switch (op) {
+        case Expression::EQ: return "=";
+        case Expression::NE: return "!=";
+        case Expression::LT: return "<";
+        case Expression::GT: return ">";
+        case Expression::LE: return "<=";
+        case Expression::GE: return ">=";
+    }
+    return "?";
+}
+
+Value bind_literal(ColumnType type, const std::string& literal) {
+    if (type == ColumnType::TEXT) {
+        return literal;
+    }
+    if (type == ColumnType::INTEGER && literal.find_first_of(".eE") == std::string::npos) {
+        return parse_value(ColumnType::INTEGER, literal);
+    }
+    return parse_value(ColumnType::REAL, literal);
+}
+
+CompiledPredicate::CompiledPredicate() : trivial(true) {}
+
+CompiledPredicate CompiledPredicate::compile(const Expression* expression, const Schema& schema,
+                                             const std::vector<std::string>& parameters) {
+    CompiledPredicate predicate;
+    if (expression != nullptr) {
+        compile_node(expression, schema, parameters, predicate.row_function, predicate.batch_function);
+        predicate.trivial = false;
+    }
+    return predicate;
+}
+
+bool CompiledPredicate::is_trivial() const {
+    return trivial;
+}
+
+bool CompiledPredicate::matches(const RecordView& row) const {
+    return trivial || row_function(row);
+}
+
+// Clears selection[i] for every row that fails the predicate; rows already
+// deselected stay deselected
+void CompiledPredicate::filter(const RecordView* rows, size_t count, uint8_t* selection) const {
+    if (!trivial) {
+        batch_function(rows, count, selection);
+    }
+}
+
+void CompiledPredicate::compile_node(const Expression* expression, const Schema& schema,
+                                     const std::vector<std::string>& parameters,
+                                     RowFunction& row_function, BatchFunction& batch_function) {
+    if (expression->kind == Expression::COMPARISON) {
+        int column = schema.get_column_index(expression->column);
+        if (column == -1) {
+            throw std::runtime_error("Condition column not found: " + expression->column);
+        }
+        ColumnType type = schema[column].type;
+        Value literal = bind_literal(type, expression->get_literal(parameters));
+        // Equality on a DICT column compares codes. A value missing from the
+        // dictionary is still compared as text, as an insert may add it while
+        // the predicate is in use.
+        uint32_t code;
+        const Dictionary* dictionary = schema[column].dictionary.get();
+        bool equality = expression->op == Expression::EQ || expression->op == Expression::NE;
+        if (dictionary != nullptr && equality && dictionary->find(std::get<std::string>(literal), code)) {
+            type = ColumnType::INTEGER;
+            literal = static_cast<int64_t>(code);
+        }
+        switch (expression->op) {
+            case Expression::EQ:
+                compile_comparison(column, type, literal, std::equal_to<>(), row_function, batch_function);
+                break;
+            case Expression::NE:
+                compile_comparison(column, type, literal, std::not_equal_to<>(), row_function, batch_function);
+                break;
+            case Expression::LT:
+                compile_comparison(column, type, literal, std::less<>(), row_function, batch_function);
+                break;
+            case Expression::GT:
+                compile_comparison(column, type, literal, std::greater<>(), row_function, batch_function);
+                break;
+            case Expression::LE:
+                compile_comparison(column, type, literal, std::less_equal<>(), row_function, batch_function);
+                break;
+            case Expression::GE:
+                compile_comparison(column, type, literal, std::greater_equal<>(), row_function, batch_function);
+                break;
+        }
+        return;
+    }
+
+    RowFunction left_row, right_row;
+    BatchFunction left_batch, right_batch;
+    compile_node(expression->left.get(), schema, parameters, left_row, left_batch);
+    if (expression->kind != Expression::NOT) {
+        compile_node(expression->right.get(), schema, parameters, right_row, right_batch);
+    }
+
+    switch (expression->kind) {
+        case Expression::AND:
+            row_function = [left_row, right_row](const RecordView& row) { return left_row(row) && right_row(row); };
+            batch_function = [left_batch, right_batch](const RecordView* rows, size_t count, uint8_t* selection) {
+                left_batch(rows, count, selection);
+                right_batch(rows, count, selection);
+            };
+            break;
+        case Expression::OR:
+            row_function = [left_row, right_row](const RecordView& row) { return left_row(row) || right_row(row); };
+            batch_function = [left_batch, right_batch](const RecordView* rows, size_t count, uint8_t* selection) {
+                uint8_t left_selection[BATCH_SIZE], right_selection[BATCH_SIZE];
+                for (size_t base = 0; base < count; base += BATCH_SIZE) {
+                    size_t block = std::min(BATCH_SIZE, count - base);
+                    memcpy(left_selection, selection + base, block);
+                    memcpy(right_selection, selection + base, block);
+                    left_batch(rows + base, block, left_selection);
+                    right_batch(rows + base, block, right_selection);
+                    for (size_t i = 0; i < block; ++i) {
+                        selection[base + i] = left_selection[i] | right_selection[i];
+                    }
+                }
+            };
+            break;
+        case Expression::NOT:
+            row_function = [left_row](const RecordView& row) { return !left_row(row); };
+            batch_function = [left_batch](const RecordView* rows, size_t count, uint8_t* selection) {
+                uint8_t child_selection[BATCH_SIZE];
+                for (size_t base = 0; base < count; base += BATCH_SIZE) {
+                    size_t block = std::min(BATCH_SIZE, count - base);
+                    memcpy(child_selection, selection + base, block);
+                    left_batch(rows + base, block, child_selection);
+                    for (size_t i = 0; i < block; ++i) {
+                        selection[base + i] &= static_cast<uint8_t>(!child_selection[i]);
+                    }
+                }
+            };
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,145 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/hash_join.h"
+#include <stdexcept>
+
+namespace {
+
+// std::hash leaves integers as they are; spread them so the high bits can pick partitions
+uint64_t hash_key(const Value& key) {
+    return static_cast<uint64_t>(std::hash<Value>()(key)) * 0x9E3779B97F4A7C15ULL;
+}
+
+} // namespace
+
+ColumnType join_key_type(ColumnType left, ColumnType right) {
+    if (left == right) {
+        return left;
+    }
+    if (left == ColumnType::TEXT || right == ColumnType::TEXT) {
+        throw std::runtime_error("Cannot join TEXT with a number");
+    }
+    return ColumnType::REAL;
+}
+
+Value join_key(const RecordView& row, int column, ColumnType key_type) {
+    if (key_type == ColumnType::REAL && row.get_schema()[column].type == ColumnType::INTEGER) {
+        return static_cast<double>(row.get_integer(column));
+    }
+    return row.get_value(column);
+}
+
+JoinHashTable::JoinHashTable(const Schema& schema, int key_column, ColumnType key_type)
+        : schema(schema), key_column(key_column), key_type(key_type), partition_bits(0) {}
+
+void JoinHashTable::add(const RecordView* rows, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        std::string_view data = rows[i].get_data();
+        if (arena.size() + data.size() > UINT32_MAX) {
+            throw std::runtime_error("Join input too large to build a hash table on");
+        }
+        Value key = join_key(rows[i], key_column, key_type);
+        entries.push_back({hash_key(key), static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(data.size())});
+        keys.push_back(std::move(key));
+        arena.append(data);
+    }
+}
+
+void JoinHashTable::build() {
+    size_t bytes = arena.size() + entries.size() * (sizeof(Entry) + sizeof(Value) + 2 * sizeof(uint32_t));
+    partition_bits = 0;
+    while ((bytes >> partition_bits) > PARTITION_BYTES && partition_bits < 10) {
+        partition_bits++;
+    }
+
+    // Counting sort of the entries (and their keys) by partition
+    size_t partitions = size_t(1) << partition_bits;
+    partition_starts.assign(partitions + 1, 0);
+    for (const Entry& entry : entries) {
+        partition_starts[partition_of(entry.hash) + 1]++;
+    }
+    for (size_t p = 0; p < partitions; ++p) {
+        partition_starts[p + 1] += partition_starts[p];
+    }
+    std::vector<uint32_t> positions(partition_starts.begin(), partition_starts.end() - 1);
+    std::vector<Entry> sorted_entries(entries.size());
+    std::vector<Value> sorted_keys(keys.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        uint32_t position = positions[partition_of(entries[i].hash)]++;
+        sorted_entries[position] = entries[i];
+        sorted_keys[position] = std::move(keys[i]);
+    }
+    entries.swap(sorted_entries);
+    keys.swap(sorted_keys);
+
+    // Rows are copied in partition order too, so a partition's rows sit together
+    std::string sorted_arena;
+    sorted_arena.reserve(arena.size());
+    for (Entry& entry : entries) {
+        uint32_t offset = static_cast<uint32_t>(sorted_arena.size());
+        sorted_arena.append(arena, entry.offset, entry.length);
+        entry.offset = offset;
+    }
+    arena.swap(sorted_arena);
+
+    buckets.assign(partitions, {});
+    next.assign(entries.size(), 0);
+    for (size_t p = 0; p < partitions; ++p) {
+        size_t begin = partition_starts[p], end = partition_starts[p + 1];
+        size_t bucket_count = 1;
+        while (bucket_count < 2 * (end - begin)) {
+            bucket_count *= 2;
+        }
+        std::vector<uint32_t>& heads = buckets[p];
+        heads.assign(bucket_count, 0);
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t& head = heads[entries[i].hash & (bucket_count - 1)];
+            next[i] = head;
+            head = static_cast<uint32_t>(i + 1);
+        }
+    }
+}
+
+size_t JoinHashTable::size() const {
+    return entries.size();
+}
+
+RecordView JoinHashTable::get_row(size_t index) const {
+    return RecordView(schema, std::string_view(arena).substr(entries[index].offset, entries[index].length));
+}
+
+void JoinHashTable::probe(const RecordView* rows, size_t count, int probe_column,
+                          const std::function<void(size_t index, const RecordView& build_row)>& visitor) {
+    size_t partitions = buckets.size();
+    probe_hashes.resize(count);
+    probe_keys.resize(count);
+    probe_counts.assign(partitions + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        probe_keys[i] = join_key(rows[i], probe_column, key_type);
+        probe_hashes[i] = hash_key(probe_keys[i]);
+        probe_counts[partition_of(probe_hashes[i]) + 1]++;
+    }
+    for (size_t p = 0; p < partitions; ++p) {
+        probe_counts[p + 1] += probe_counts[p];
+    }
+    probe_order.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        probe_order[probe_counts[partition_of(probe_hashes[i])]++] = static_cast<uint32_t>(i);
+    }
+
+    for (uint32_t i : probe_order) {
+        uint64_t hash = probe_hashes[i];
+        const std::vector<uint32_t>& heads = buckets[partition_of(hash)];
+        for (uint32_t entry = heads[hash & (heads.size() - 1)]; entry != 0; entry = next[entry - 1]) {
+            if (entries[entry - 1].hash == hash && keys[entry - 1] == probe_keys[i]) {
+                visitor(i, get_row(entry - 1));
+            }
+        }
+    }
+}
+
+uint32_t JoinHashTable::partition_of(uint64_t hash) const {
+    return partition_bits == 0 ? 0 : static_cast<uint32_t>(hash >> (64 - partition_bits));
+}
@@ -0,0 +1,114 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/index.h"
+#include <algorithm>
+#include <stdexcept>
+
+IndexType parse_index_type(const std::string& name) {
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (upper == "HASH") {
+        return IndexType::HASH;
+    } else if (upper == "BTREE" || upper == "ORDERED") {
+        return IndexType::ORDERED;
+    }
+    throw std::runtime_error("Unknown index type: " + name);
+}
+
+const char* index_type_name(IndexType type) {
+    return type == IndexType::HASH ? "HASH" : "BTREE";
+}
+
+SecondaryIndex::SecondaryIndex(const std::string& column_name, int column_index)
+        : column_name(column_name), column_index(column_index) {}
+
+bool SecondaryIndex::supports_range() const {
+    return false;
+}
+
+void SecondaryIndex::find_range(const Value*, bool, const Value*, bool, std::vector<int64_t>&) const {
+    throw std::runtime_error("Index on " + column_name + " does not support range lookups");
+}
+
+const std::string& SecondaryIndex::get_column_name() const {
+    return column_name;
+}
+
+int SecondaryIndex::get_column_index() const {
+    return column_index;
+}
+
+IndexType HashIndex::get_type() const {
+    return IndexType::HASH;
+}
+
+void HashIndex::insert(const Value& value, int64_t key) {
+    entries.emplace(value, key);
+}
+
+void HashIndex::remove(const Value& value, int64_t key) {
+    auto range = entries.equal_range(value);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == key) {
+            entries.erase(it);
+            return;
+        }
+    }
+}
+
+void HashIndex::find_equal(const Value& value, std::vector<int64_t>& keys) const {
+    auto range = entries.equal_range(value);
+    for (auto it = range.first; it != range.second; ++it) {
+        keys.push_back(it->second);
+    }
+}
+
+IndexType OrderedIndex::get_type() const {
+    return IndexType::ORDERED;
+}
+
+void OrderedIndex::insert(const Value& value, int64_t key) {
+    entries.emplace(value, key);
+}
+
+void OrderedIndex::remove(const Value& value, int64_t key) {
+    auto range = entries.equal_range(value);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == key) {
+            entries.erase(it);
+            return;
+        }
+    }
+}
+
+void OrderedIndex::find_equal(const Value& value, std::vector<int64_t>& keys) const {
+    auto range = entries.equal_range(value);
+    for (auto it = range.first; it != range.second; ++it) {
+        keys.push_back(it->second);
+    }
+}
+
+bool OrderedIndex::supports_range() const {
+    return true;
+}
+
+void OrderedIndex::find_range(const Value* lower, bool lower_inclusive, const Value* upper, bool upper_inclusive,
+                              std::vector<int64_t>& keys) const {
+    if (lower != nullptr && upper != nullptr &&
+        (*upper < *lower || (*upper == *lower && !(lower_inclusive && upper_inclusive)))) {
+        return;
+    }
+    auto it = entries.begin();
+    if (lower != nullptr) {
+        it = lower_inclusive ? entries.lower_bound(*lower) : entries.upper_bound(*lower);
+    }
+    auto end = entries.end();
+    if (upper != nullptr) {
+        end = upper_inclusive ? entries.upper_bound(*upper) : entries.lower_bound(*upper);
+    }
+    for (; it != end; ++it) {
+        keys.push_back(it->second);
+    }
+}
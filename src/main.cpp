@@ -1,13 +1,117 @@
 #include "../include/database_server.h"
 #include "../include/database_client.h"
 #include <iostream>
+#include <memory>
 #include <string>
+#include <csignal>
 
-void run_server(int port) {
+namespace {
+DatabaseServer* active_server = nullptr;
+
+void handle_shutdown_signal(int) {
+    if (active_server != nullptr) {
+        active_server->request_stop();
+    }
+}
+
+void install_signal_handlers() {
+    struct sigaction action = {};
+    action.sa_handler = handle_shutdown_signal;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART, so a blocked accept() returns and the server shuts down cleanly
+    action.sa_flags = 0;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+// Options of the server itself rather than of its database
+struct ServerOptions {
+    std::string metrics_file;
+    int metrics_interval_ms = 10000;
+    SlowQueryLog::Options slow_query_log;
+    size_t result_cache_size = 0;
+};
+
+DatabaseConfig parse_server_options(int argc, char* argv[], int first, ServerOptions& server) {
+    DatabaseConfig config;
+    for (int i = first; i < argc; ++i) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for option " + option);
+        }
+        std::string value = argv[++i];
+        if (option == "--data-file") {
+            config.data_file = value;
+        } else if (option == "--cache-mb") {
+            config.buffer_pool_size = std::stoul(value) * 1024 * 1024;
+        } else if (option == "--wal-sync") {
+            if (value == "commit") {
+                config.wal_sync_policy = SyncPolicy::EVERY_COMMIT;
+            } else if (value == "interval") {
+                config.wal_sync_policy = SyncPolicy::INTERVAL;
+            } else if (value == "off") {
+                config.wal_sync_policy = SyncPolicy::OFF;
+            } else {
+                throw std::runtime_error("--wal-sync must be commit, interval or off");
+            }
+        } else if (option == "--wal-sync-interval-ms") {
+            config.wal_sync_interval_ms = std::stoi(value);
+        } else if (option == "--checkpoint-mb") {
+            config.checkpoint_wal_size = std::stoul(value) * 1024 * 1024;
+        } else if (option == "--statement-cache") {
+            config.statement_cache_size = std::stoul(value);
+        } else if (option == "--scan-threads") {
+            config.scan_threads = std::stoi(value);
+        } else if (option == "--parallel-scan-rows") {
+            config.parallel_scan_rows = std::stoul(value);
+        } else if (option == "--shards") {
+            config.shard_count = std::stoul(value);
+            if (config.shard_count == 0) {
+                throw std::runtime_error("--shards must be at least 1");
+            }
+        } else if (option == "--copy-dir") {
+            config.copy_dir = value;
+        } else if (option == "--save-interval") {
+            config.save_interval_ms = std::stoi(value) * 1000;
+        } else if (option == "--metrics-file") {
+            server.metrics_file = value;
+        } else if (option == "--metrics-interval") {
+            server.metrics_interval_ms = std::stoi(value) * 1000;
+        } else if (option == "--slow-query-log") {
+            server.slow_query_log.path = value;
+        } else if (option == "--slow-query-ms") {
+            server.slow_query_log.threshold_ms = std::stoi(value);
+        } else if (option == "--slow-query-log-mb") {
+            server.slow_query_log.max_file_bytes = std::stoul(value) * 1024 * 1024;
+        } else if (option == "--slow-query-log-files") {
+            server.slow_query_log.max_files = std::stoi(value);
+        } else if (option == "--result-cache-mb") {
+            server.result_cache_size = std::stoul(value) * 1024 * 1024;
+        } else {
+            throw std::runtime_error("Unknown option " + option);
+        }
+    }
+    return config;
+}
+}
+
+void run_server(int port, const DatabaseConfig& config, const ServerOptions& options) {
     try {
-        DatabaseServer server(port);
+        std::unique_ptr<MetricsDumper> metrics_dumper;
+        if (!options.metrics_file.empty()) {
+            metrics_dumper = std::make_unique<MetricsDumper>(options.metrics_file, options.metrics_interval_ms);
+        }
+        std::unique_ptr<SlowQueryLog> slow_query_log;
+        if (!options.slow_query_log.path.empty()) {
+            slow_query_log = std::make_unique<SlowQueryLog>(options.slow_query_log);
+        }
+        DatabaseServer server(port, config, slow_query_log.get(), options.result_cache_size);
+        active_server = &server;
+        install_signal_handlers();
         server.run();
+        active_server = nullptr;
     } catch (const std::exception& e) {
+        active_server = nullptr;
         std::cerr << "Server error: " << e.what() << std::endl;
     }
 }
@@ -45,6 +149,12 @@ void run_client(const std::string& ip, int port) {
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cerr << "Usage: " << argv[0] << " [server|client] [port] [ip]" << std::endl;
+        std::cerr << "Server options: --data-file <path> --cache-mb <megabytes> --wal-sync <commit|interval|off>"
+                  << " --wal-sync-interval-ms <ms> --checkpoint-mb <megabytes> --statement-cache <entries>"
+                  << " --scan-threads <count> --parallel-scan-rows <rows> --shards <count> --save-interval <seconds>"
+                  << " --metrics-file <path> --metrics-interval <seconds> --slow-query-log <path>"
+                  << " --slow-query-ms <ms> --slow-query-log-mb <megabytes> --slow-query-log-files <count>"
+                  << " --result-cache-mb <megabytes> --copy-dir <path>" << std::endl;
         return 1;
     }
 
@@ -56,7 +166,15 @@ int main(int argc, char* argv[]) {
     }
 
     if (mode == "server") {
-        run_server(port);
+        DatabaseConfig config;
+        ServerOptions options;
+        try {
+            config = parse_server_options(argc, argv, 3, options);
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid server options: " << e.what() << std::endl;
+            return 1;
+        }
+        run_server(port, config, options);
     } else if (mode == "client") {
         std::string ip = "127.0.0.1";  // Default IP
         if (argc >= 4) {
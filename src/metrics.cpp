@@ -0,0 +1,203 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+const char* const COUNTER_NAMES[] = {
+        "connections_accepted", "queries", "query_errors", "rows_returned", "rows_changed", "bytes_received",
+        "bytes_sent", "result_cache_hits", "result_cache_misses"
+};
+const char* const TIMER_NAMES[] = {
+        "accept", "read", "queue", "normalize", "tokenize", "parse", "execute", "send", "query"
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == Metrics::COUNTER_COUNT);
+static_assert(sizeof(TIMER_NAMES) / sizeof(TIMER_NAMES[0]) == Metrics::TIMER_COUNT);
+
+// Only the owning thread writes a shard, so an update needs no atomic read-modify-write
+void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+} // namespace
+
+struct Metrics::Shard {
+    struct TimerData {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    };
+
+    alignas(64) std::atomic<uint64_t> counters[COUNTER_COUNT];
+    TimerData timers[TIMER_COUNT];
+};
+
+// Shards outlive their threads, so nothing recorded is lost when one exits
+struct Metrics::Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+Metrics::Registry& Metrics::registry() {
+    static Registry instance;
+    return instance;
+}
+
+Metrics::Shard& Metrics::local() {
+    thread_local Shard* shard = nullptr;
+    if (shard == nullptr) {
+        Registry& shared = registry();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        // Value-initialized, so every atomic starts at zero
+        shared.shards.push_back(std::unique_ptr<Shard>(new Shard()));
+        shard = shared.shards.back().get();
+    }
+    return *shard;
+}
+
+void Metrics::add(Counter counter, uint64_t amount) {
+    bump(local().counters[counter], amount);
+}
+
+void Metrics::record(Timer timer, uint64_t nanoseconds) {
+    Shard::TimerData& data = local().timers[timer];
+    bump(data.count, 1);
+    bump(data.sum, nanoseconds);
+    bump(data.buckets[get_bucket(nanoseconds)], 1);
+    if (nanoseconds > data.max.load(std::memory_order_relaxed)) {
+        data.max.store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::record(Timer timer, std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record(timer, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+Metrics::Snapshot Metrics::snapshot() {
+    Snapshot snapshot;
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (const auto& shard : shared.shards) {
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            snapshot.counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        for (int t = 0; t < TIMER_COUNT; ++t) {
+            const Shard::TimerData& data = shard->timers[t];
+            Histogram& histogram = snapshot.timers[t];
+            histogram.count += data.count.load(std::memory_order_relaxed);
+            histogram.sum += data.sum.load(std::memory_order_relaxed);
+            histogram.max = std::max(histogram.max, data.max.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < BUCKET_COUNT; ++b) {
+                histogram.buckets[b] += data.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return snapshot;
+}
+
+size_t Metrics::get_bucket(uint64_t value) {
+    if (value < (uint64_t(1) << SUB_BUCKET_BITS)) {
+        return static_cast<size_t>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    uint64_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) - (uint64_t(1) << SUB_BUCKET_BITS);
+    return (static_cast<size_t>(exponent - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+// The middle of the values the bucket holds
+uint64_t Metrics::get_bucket_value(size_t bucket) {
+    if (bucket < (size_t(1) << SUB_BUCKET_BITS)) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket >> SUB_BUCKET_BITS) - 1;
+    uint64_t lower = ((uint64_t(1) << SUB_BUCKET_BITS) + (bucket & ((size_t(1) << SUB_BUCKET_BITS) - 1))) << shift;
+    return lower + ((uint64_t(1) << shift) >> 1);
+}
+
+uint64_t Metrics::Histogram::percentile(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); ++b) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return std::min(get_bucket_value(b), max);
+        }
+    }
+    return max;
+}
+
+const char* Metrics::get_name(Counter counter) {
+    return COUNTER_NAMES[counter];
+}
+
+const char* Metrics::get_name(Timer timer) {
+    return TIMER_NAMES[timer];
+}
+
+void Metrics::write_text(std::ostream& out) {
+    Snapshot current = snapshot();
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        out << COUNTER_NAMES[c] << " " << current.counters[c] << "\n";
+    }
+    out << std::fixed << std::setprecision(1);
+    for (int t = 0; t < TIMER_COUNT; ++t) {
+        const Histogram& histogram = current.timers[t];
+        if (histogram.count == 0) {
+            continue;
+        }
+        out << TIMER_NAMES[t] << "_us count=" << histogram.count
+            << " mean=" << static_cast<double>(histogram.sum) / static_cast<double>(histogram.count) / 1000.0
+            << " p50=" << static_cast<double>(histogram.percentile(0.5)) / 1000.0
+            << " p90=" << static_cast<double>(histogram.percentile(0.9)) / 1000.0
+            << " p99=" << static_cast<double>(histogram.percentile(0.99)) / 1000.0
+            << " p999=" << static_cast<double>(histogram.percentile(0.999)) / 1000.0
+            << " max=" << static_cast<double>(histogram.max) / 1000.0 << "\n";
+    }
+}
+
+MetricsDumper::MetricsDumper(const std::string& path, int interval_ms) : path(path), stopping(false) {
+    thread = std::thread([this, interval_ms] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return stopping; })) {
+            write_dump();
+        }
+    });
+}
+
+MetricsDumper::~MetricsDumper() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+    write_dump();
+}
+
+void MetricsDumper::write_dump() {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        Metrics::write_text(out);
+        if (!out) {
+            std::cerr << "Error writing metrics to " << temporary << std::endl;
+            return;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error replacing metrics file " << path << std::endl;
+    }
+}
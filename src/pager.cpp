@@ -0,0 +1,216 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/pager.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Journal layout: [magic][u32 checkpoint_page_count] followed by [u32 page_id][page image] records
+constexpr char JOURNAL_MAGIC[8] = {'S', 'Q', 'L', 'J', 'R', 'N', 'L', '1'};
+constexpr size_t JOURNAL_HEADER_SIZE = sizeof(JOURNAL_MAGIC) + sizeof(uint32_t);
+constexpr size_t JOURNAL_RECORD_SIZE = sizeof(uint32_t) + PAGE_SIZE;
+
+void pwrite_all(int fd, const char* data, size_t size, off_t offset, const char* what) {
+    size_t total_written = 0;
+    while (total_written < size) {
+        ssize_t n = pwrite(fd, data + total_written, size - total_written, offset + total_written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Error writing ") + what + ": " + std::string(strerror(errno)));
+        }
+        total_written += n;
+    }
+}
+
+} // namespace
+
+Pager::Pager(const std::string& path) : path(path), mapping(nullptr), mapped_page_count(0) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open database file " + path + ": " + std::string(strerror(errno)));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat database file " + path + ": " + std::string(strerror(errno)));
+    }
+    // A torn trailing page still counts; read_page zero-fills the missing part
+    page_count = (st.st_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    std::string journal_path = path + "-journal";
+    journal_fd = open(journal_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (journal_fd < 0) {
+        close(fd);
+        throw std::runtime_error("Failed to open journal " + journal_path + ": " + std::string(strerror(errno)));
+    }
+    rollback_journal();
+    checkpoint_page_count = page_count;
+    map_file();
+}
+
+Pager::~Pager() {
+    if (mapping != nullptr) {
+        munmap(const_cast<char*>(mapping), static_cast<size_t>(mapped_page_count) * PAGE_SIZE);
+    }
+    close(journal_fd);
+    close(fd);
+}
+
+void Pager::read_page(page_id_t page_id, char* buffer) {
+    // Writes go through the same page cache, so the mapping is never stale
+    if (page_id < mapped_page_count) {
+        memcpy(buffer, mapping + static_cast<size_t>(page_id) * PAGE_SIZE, PAGE_SIZE);
+        return;
+    }
+    size_t total_read = 0;
+    off_t offset = static_cast<off_t>(page_id) * PAGE_SIZE;
+
+    while (total_read < PAGE_SIZE) {
+        ssize_t n = pread(fd, buffer + total_read, PAGE_SIZE - total_read, offset + total_read);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Error reading page " + std::to_string(page_id) + ": " + std::string(strerror(errno)));
+        }
+        if (n == 0) {
+            // Allocated but never written pages read back as zeroes
+            memset(buffer + total_read, 0, PAGE_SIZE - total_read);
+            break;
+        }
+        total_read += n;
+    }
+}
+
+void Pager::write_page(page_id_t page_id, const char* buffer) {
+    journal_pages({page_id});
+    pwrite_all(fd, buffer, PAGE_SIZE, static_cast<off_t>(page_id) * PAGE_SIZE, "database file");
+}
+
+// Saves the checkpointed image of every page that is about to be overwritten
+// for the first time since the last checkpoint, with a single sync for the batch.
+void Pager::journal_pages(const std::vector<page_id_t>& page_ids) {
+    std::string records;
+    std::vector<page_id_t> added;
+    for (page_id_t page_id : page_ids) {
+        // Pages allocated after the checkpoint are dropped by truncation instead
+        if (page_id >= checkpoint_page_count || journaled_pages.count(page_id) != 0) {
+            continue;
+        }
+        char image[PAGE_SIZE];
+        read_page(page_id, image);
+        records.append(reinterpret_cast<const char*>(&page_id), sizeof(page_id));
+        records.append(image, PAGE_SIZE);
+        added.push_back(page_id);
+    }
+    if (added.empty()) {
+        return;
+    }
+
+    off_t offset = JOURNAL_HEADER_SIZE + journaled_pages.size() * JOURNAL_RECORD_SIZE;
+    if (journaled_pages.empty()) {
+        std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        header.append(reinterpret_cast<const char*>(&checkpoint_page_count), sizeof(checkpoint_page_count));
+        records.insert(0, header);
+        offset = 0;
+    }
+    pwrite_all(journal_fd, records.data(), records.size(), offset, "journal");
+    if (fdatasync(journal_fd) < 0) {
+        throw std::runtime_error("Error syncing journal: " + std::string(strerror(errno)));
+    }
+    journaled_pages.insert(added.begin(), added.end());
+}
+
+page_id_t Pager::allocate_page() {
+    return page_count++;
+}
+
+page_id_t Pager::get_page_count() const {
+    return page_count;
+}
+
+void Pager::sync() {
+    if (fdatasync(fd) < 0) {
+        throw std::runtime_error("Error syncing database file: " + std::string(strerror(errno)));
+    }
+}
+
+// Called once every dirty page is written and synced. Emptying the journal is
+// the point at which the new checkpoint becomes the recovery baseline.
+void Pager::commit_checkpoint() {
+    if (ftruncate(journal_fd, 0) < 0 || fdatasync(journal_fd) < 0) {
+        throw std::runtime_error("Error resetting journal: " + std::string(strerror(errno)));
+    }
+    journaled_pages.clear();
+    checkpoint_page_count = page_count;
+    map_file();
+}
+
+// Maps every whole page of the file. The file only shrinks when the journal is
+// rolled back on open, before the first mapping, so mapped pages stay valid.
+void Pager::map_file() {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throw std::runtime_error("Failed to stat database file " + path + ": " + std::string(strerror(errno)));
+    }
+    page_id_t whole_pages = static_cast<page_id_t>(st.st_size / PAGE_SIZE);
+    if (whole_pages <= mapped_page_count) {
+        return;
+    }
+    if (mapping != nullptr) {
+        munmap(const_cast<char*>(mapping), static_cast<size_t>(mapped_page_count) * PAGE_SIZE);
+        mapping = nullptr;
+        mapped_page_count = 0;
+    }
+    void* address = mmap(nullptr, static_cast<size_t>(whole_pages) * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        // Reads fall back to pread
+        return;
+    }
+    mapping = static_cast<const char*>(address);
+    mapped_page_count = whole_pages;
+}
+
+void Pager::rollback_journal() {
+    struct stat st;
+    if (fstat(journal_fd, &st) < 0 || static_cast<size_t>(st.st_size) < JOURNAL_HEADER_SIZE) {
+        return;
+    }
+
+    char header[JOURNAL_HEADER_SIZE];
+    if (pread(journal_fd, header, JOURNAL_HEADER_SIZE, 0) != static_cast<ssize_t>(JOURNAL_HEADER_SIZE) ||
+        memcmp(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        return;
+    }
+    uint32_t original_page_count;
+    memcpy(&original_page_count, header + sizeof(JOURNAL_MAGIC), sizeof(original_page_count));
+
+    // A torn trailing record was never synced, so its page was never overwritten
+    size_t record_count = (st.st_size - JOURNAL_HEADER_SIZE) / JOURNAL_RECORD_SIZE;
+    char record[JOURNAL_RECORD_SIZE];
+    for (size_t i = 0; i < record_count; ++i) {
+        off_t offset = JOURNAL_HEADER_SIZE + i * JOURNAL_RECORD_SIZE;
+        if (pread(journal_fd, record, JOURNAL_RECORD_SIZE, offset) != static_cast<ssize_t>(JOURNAL_RECORD_SIZE)) {
+            break;
+        }
+        page_id_t page_id;
+        memcpy(&page_id, record, sizeof(page_id));
+        pwrite_all(fd, record + sizeof(page_id), PAGE_SIZE, static_cast<off_t>(page_id) * PAGE_SIZE, "database file");
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(original_page_count) * PAGE_SIZE) < 0) {
+        throw std::runtime_error("Error truncating database file: " + std::string(strerror(errno)));
+    }
+    sync();
+    page_count = original_page_count;
+    if (ftruncate(journal_fd, 0) < 0 || fdatasync(journal_fd) < 0) {
+        throw std::runtime_error("Error resetting journal: " + std::string(strerror(errno)));
+    }
+}
@@ -0,0 +1,143 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/protocol.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+template<typename T>
+void append_value(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+T read_value(std::string_view data, size_t& offset) {
+    if (offset + sizeof(T) > data.size()) {
+        throw std::runtime_error("Truncated row batch");
+    }
+    T value;
+    memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+// The frame header is written up front and patched once the payload is known
+constexpr size_t ROW_COUNT_OFFSET = FRAME_HEADER_SIZE;
+
+} // namespace
+
+void append_frame(std::string& out, FrameType type, std::string_view payload) {
+    append_value<uint32_t>(out, static_cast<uint32_t>(payload.size()));
+    append_value<uint8_t>(out, static_cast<uint8_t>(type));
+    out.append(payload.data(), payload.size());
+}
+
+bool read_frame(const std::string& buffer, size_t& offset, FrameType& type, std::string_view& payload) {
+    if (buffer.size() - offset < FRAME_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t length;
+    memcpy(&length, buffer.data() + offset, sizeof(length));
+    uint8_t raw_type = static_cast<uint8_t>(buffer[offset + 4]);
+    if (length > MAX_FRAME_SIZE) {
+        throw std::runtime_error("Frame too large: " + std::to_string(length) + " bytes");
+    }
+    if (raw_type < static_cast<uint8_t>(FrameType::QUERY) || raw_type > static_cast<uint8_t>(FrameType::ERROR)) {
+        throw std::runtime_error("Unknown frame type: " + std::to_string(raw_type));
+    }
+    if (buffer.size() - offset - FRAME_HEADER_SIZE < length) {
+        return false;
+    }
+    type = static_cast<FrameType>(raw_type);
+    payload = std::string_view(buffer.data() + offset + FRAME_HEADER_SIZE, length);
+    offset += FRAME_HEADER_SIZE + length;
+    return true;
+}
+
+std::string encode_end(uint64_t row_count) {
+    std::string payload;
+    append_value<uint64_t>(payload, row_count);
+    return payload;
+}
+
+uint64_t decode_end(std::string_view payload) {
+    size_t offset = 0;
+    return read_value<uint64_t>(payload, offset);
+}
+
+RowBatchEncoder::RowBatchEncoder() : row_count(0) {
+    frame.reserve(ROW_BATCH_TARGET_SIZE + 1024);
+    frame.resize(FRAME_HEADER_SIZE + sizeof(uint32_t));
+}
+
+void RowBatchEncoder::add_row(const std::vector<Value>& row) {
+    append_value<uint16_t>(frame, static_cast<uint16_t>(row.size()));
+    for (const Value& value : row) {
+        if (std::holds_alternative<int64_t>(value)) {
+            append_value<uint8_t>(frame, static_cast<uint8_t>(ColumnType::INTEGER));
+            append_value<int64_t>(frame, std::get<int64_t>(value));
+        } else if (std::holds_alternative<double>(value)) {
+            append_value<uint8_t>(frame, static_cast<uint8_t>(ColumnType::REAL));
+            append_value<double>(frame, std::get<double>(value));
+        } else {
+            const std::string& text = std::get<std::string>(value);
+            append_value<uint8_t>(frame, static_cast<uint8_t>(ColumnType::TEXT));
+            append_value<uint32_t>(frame, static_cast<uint32_t>(text.size()));
+            frame.append(text);
+        }
+    }
+    row_count++;
+}
+
+size_t RowBatchEncoder::get_row_count() const {
+    return row_count;
+}
+
+size_t RowBatchEncoder::get_size() const {
+    return frame.size();
+}
+
+void RowBatchEncoder::flush_to(std::string& out) {
+    if (row_count == 0) {
+        return;
+    }
+    uint32_t length = static_cast<uint32_t>(frame.size() - FRAME_HEADER_SIZE);
+    uint8_t type = static_cast<uint8_t>(FrameType::ROW_BATCH);
+    memcpy(&frame[0], &length, sizeof(length));
+    memcpy(&frame[4], &type, sizeof(type));
+    memcpy(&frame[ROW_COUNT_OFFSET], &row_count, sizeof(row_count));
+    out.append(frame);
+    frame.resize(FRAME_HEADER_SIZE + sizeof(uint32_t));
+    row_count = 0;
+}
+
+void decode_row_batch(std::string_view payload, std::vector<std::vector<Value>>& rows) {
+    size_t offset = 0;
+    uint32_t row_count = read_value<uint32_t>(payload, offset);
+    for (uint32_t r = 0; r < row_count; ++r) {
+        uint16_t cell_count = read_value<uint16_t>(payload, offset);
+        std::vector<Value> row;
+        row.reserve(cell_count);
+        for (uint16_t c = 0; c < cell_count; ++c) {
+            auto type = static_cast<ColumnType>(read_value<uint8_t>(payload, offset));
+            if (type == ColumnType::INTEGER) {
+                row.emplace_back(read_value<int64_t>(payload, offset));
+            } else if (type == ColumnType::REAL) {
+                row.emplace_back(read_value<double>(payload, offset));
+            } else if (type == ColumnType::TEXT) {
+                uint32_t length = read_value<uint32_t>(payload, offset);
+                if (offset + length > payload.size()) {
+                    throw std::runtime_error("Truncated row batch");
+                }
+                row.emplace_back(std::string(payload.substr(offset, length)));
+                offset += length;
+            } else {
+                throw std::runtime_error("Unknown cell type in row batch");
+            }
+        }
+        rows.push_back(std::move(row));
+    }
+}
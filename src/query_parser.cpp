@@ -3,57 +3,201 @@
 //
 
 #include "../include/query_parser.h"
-#include <sstream>
 #include <algorithm>
-#include <unordered_set>
-
-std::vector<QueryParser::Token> QueryParser::tokenize(const std::string& query) {
-    std::vector<Token> tokens;
-    std::istringstream iss(query);
-    std::string word;
-
-    while (iss >> word) {
-        if (is_keyword(word)) {
-            tokens.emplace_back(Token::KEYWORD, word);
-        } else if (is_operator(word)) {
-            tokens.emplace_back(Token::OPERATOR, word);
-        } else if (word[0] == '\'' || word[0] == '"') {
-            std::string value;
-            char quote = word[0];
-            value += word.substr(1);
-            if (word.back() != quote) {
-                std::string more;
-                while (iss >> more) {
-                    value += " " + more;
-                    if (more.back() == quote) break;
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+
+namespace {
+
+constexpr std::string_view KEYWORDS[] = {
+        "SELECT", "INSERT", "UPDATE", "DELETE", "FROM", "WHERE", "VALUES", "SET", "INTO", "CREATE", "TABLE",
+        "INDEX", "ON", "USING", "AND", "OR", "NOT", "PREPARE", "AS", "EXECUTE", "DEALLOCATE", "SHOW",
+        "COPY", "WITH", "ORDER", "BY", "ASC", "DESC", "LIMIT", "OFFSET", "BETWEEN",
+        "GROUP", "HAVING", "JOIN", "INNER", "SAVE", "STATS", "EXPLAIN", "ANALYZE",
+        "DICT", "IN"
+};
+constexpr size_t KEYWORD_TABLE_SIZE = 128;
+// Bounds on a WHERE clause: parentheses and NOTs nested, and comparisons in all
+constexpr size_t MAX_WHERE_DEPTH = 100;
+constexpr size_t MAX_WHERE_TERMS = 10000;
+
+// Perfect hash over KEYWORDS: a keyword is recognized with one hash and one
+// comparison. The table is built at compile time, which also rejects collisions.
+constexpr size_t keyword_hash(std::string_view word) {
+    return (word.size() * 5 + static_cast<unsigned char>(word.front()) * 12 +
+            static_cast<unsigned char>(word.back()) * 5) % KEYWORD_TABLE_SIZE;
+}
+
+struct KeywordTable {
+    std::string_view slots[KEYWORD_TABLE_SIZE] = {};
+    bool collision = false;
+};
+
+constexpr KeywordTable build_keyword_table() {
+    KeywordTable table;
+    for (std::string_view keyword : KEYWORDS) {
+        std::string_view& slot = table.slots[keyword_hash(keyword)];
+        table.collision = table.collision || !slot.empty();
+        slot = keyword;
+    }
+    return table;
+}
+
+constexpr KeywordTable KEYWORD_TABLE = build_keyword_table();
+static_assert(!KEYWORD_TABLE.collision, "Two keywords share a hash slot; adjust keyword_hash()");
+
+// Character classes for the lexer, looked up without going through the locale
+constexpr uint8_t DIGIT = 1;
+constexpr uint8_t WORD = 2;
+
+struct CharacterTable {
+    uint8_t classes[256] = {};
+};
+
+constexpr CharacterTable build_character_table() {
+    CharacterTable table;
+    for (int c = 0; c < 256; ++c) {
+        bool digit = c >= '0' && c <= '9';
+        bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        table.classes[c] = (digit ? DIGIT : 0) | (digit || letter || c == '_' || c == '.' ? WORD : 0);
+    }
+    return table;
+}
+
+constexpr CharacterTable CHARACTER_TABLE = build_character_table();
+
+bool is_word_char(char c) {
+    return CHARACTER_TABLE.classes[static_cast<unsigned char>(c)] & WORD;
+}
+
+bool is_digit(char c) {
+    return CHARACTER_TABLE.classes[static_cast<unsigned char>(c)] & DIGIT;
+}
+
+} // namespace
+
+// Single pass over the query. Punctuation and operators end a word, so
+// VALUES('1','bob',30) and id=5 need no spaces. Words are names, keywords or
+// numbers (with an optional sign and exponent) and may contain dots, as in
+// users.id. The tokens point into the query and live in the thread's query arena.
+QueryParser::TokenList QueryParser::tokenize(std::string_view query) {
+    QueryArena& arena = QueryArena::local();
+    TokenList tokens(&arena);
+    tokens.reserve(query.size() / 4 + 2);
+    int parameter_count = 0;
+    size_t i = 0;
+    while (i < query.size()) {
+        size_t start = i;
+        char c = query[i];
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n':
+                ++i;
+                continue;
+            case '(': case ')': case ',':
+                tokens.emplace_back(Token::PUNCTUATION, query.substr(i++, 1));
+                continue;
+            case '*':
+                tokens.emplace_back(Token::IDENTIFIER, query.substr(i++, 1));
+                continue;
+            case '=': case '<': case '>': case '!':
+                i += i + 1 < query.size() && query[i + 1] == '=' ? 2 : 1;
+                if (c == '!' && i - start == 1) {
+                    throw QueryParseError("Unexpected character: !");
                 }
+                tokens.emplace_back(Token::OPERATOR, query.substr(start, i - start));
+                continue;
+            case '\'': case '"': {
+                size_t end = query.find(c, i + 1);
+                if (end == std::string_view::npos) {
+                    throw QueryParseError("Unterminated string literal");
+                }
+                tokens.emplace_back(Token::VALUE, query.substr(i + 1, end - i - 1));
+                i = end + 1;
+                continue;
             }
-            value = value.substr(0, value.length() - 1);
-            tokens.emplace_back(Token::VALUE, value);
-        } else {
-            tokens.emplace_back(Token::IDENTIFIER, word);
+            case '?': {
+                // Placeholders carry their number, written into the arena
+                char* text = static_cast<char*>(arena.allocate(16, 1));
+                size_t length = std::to_chars(text, text + 16, parameter_count++).ptr - text;
+                tokens.emplace_back(Token::PARAMETER, std::string_view(text, length));
+                ++i;
+                continue;
+            }
+            case ';':
+                // A trailing semicolon is allowed and ignored
+                if (query.find_first_not_of(" \t\r\n", i + 1) != std::string_view::npos) {
+                    throw QueryParseError("Only one statement per query is allowed");
+                }
+                i = query.size();
+                continue;
+            default:
+                break;
+        }
+
+        bool signed_number = (c == '-' || c == '+') && i + 1 < query.size() &&
+                             (is_digit(query[i + 1]) || query[i + 1] == '.');
+        if (!is_word_char(c) && !signed_number) {
+            throw QueryParseError(std::string("Unexpected character: ") + c);
         }
+        bool number = signed_number || is_digit(c) || c == '.';
+        ++i;
+        while (i < query.size()) {
+            char n = query[i];
+            bool exponent_sign = number && (n == '-' || n == '+') && (query[i - 1] == 'e' || query[i - 1] == 'E');
+            if (!is_word_char(n) && !exponent_sign) {
+                break;
+            }
+            ++i;
+        }
+        std::string_view word = query.substr(start, i - start);
+        tokens.emplace_back(!number && is_keyword(word) ? Token::KEYWORD : Token::IDENTIFIER, word);
     }
-    tokens.emplace_back(Token::END, "");
+    tokens.emplace_back(Token::END, std::string_view());
     return tokens;
 }
 
-void QueryParser::parse(const std::vector<Token>& tokens, std::string& command, std::string& table_name,
-                        std::vector<std::string>& columns, std::vector<std::string>& values, std::string& condition) {
+std::string_view QueryParser::first_word(std::string_view query) {
+    size_t start = query.find_first_not_of(" \t\r\n");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = start;
+    while (end < query.size() && is_word_char(query[end])) {
+        ++end;
+    }
+    return query.substr(start, end - start);
+}
+
+Statement QueryParser::parse(const TokenList& tokens) {
     if (tokens.empty() || tokens[0].type != Token::KEYWORD) {
         throw QueryParseError("Query must start with a keyword");
     }
 
+    Statement statement;
+    std::string& command = statement.command;
+    std::string& table_name = statement.table_name;
+    std::vector<std::string>& columns = statement.columns;
+    std::vector<std::string>& values = statement.values;
     command = tokens[0].value;
     size_t i = 1;
+    for (const Token& token : tokens) {
+        if (token.type == Token::PARAMETER) {
+            statement.parameter_count++;
+        }
+    }
 
     if (command == "SELECT") {
-        while (i < tokens.size() && tokens[i].type != Token::KEYWORD) {
-            if (tokens[i].type == Token::IDENTIFIER) {
-                columns.push_back(tokens[i].value);
+        while (tokens[i].type == Token::IDENTIFIER) {
+            columns.push_back(parse_column_reference(tokens, i));
+            if (tokens[i].value != ",") {
+                break;
             }
             ++i;
         }
+        if (columns.empty()) {
+            throw QueryParseError("SELECT needs at least one column");
+        }
         if (i >= tokens.size() || tokens[i].value != "FROM") {
             throw QueryParseError("SELECT query must have a FROM clause");
         }
@@ -63,13 +207,48 @@ void QueryParser::parse(const std::vector<Token>& tokens, std::string& command,
         }
         table_name = tokens[i].value;
         ++i;
+        if (tokens[i].value == "INNER" || tokens[i].value == "JOIN") {
+            if (tokens[i].value == "INNER" && tokens[++i].value != "JOIN") {
+                throw QueryParseError("INNER must be followed by JOIN");
+            }
+            ++i;
+            if (tokens[i].type != Token::IDENTIFIER) {
+                throw QueryParseError("Table name expected after JOIN");
+            }
+            statement.join_table = tokens[i++].value;
+            if (tokens[i].value != "ON" || tokens[i + 1].type != Token::IDENTIFIER || tokens[i + 2].value != "=" ||
+                tokens[i + 3].type != Token::IDENTIFIER) {
+                throw QueryParseError("JOIN expects ON column = column");
+            }
+            statement.join_left = tokens[i + 1].value;
+            statement.join_right = tokens[i + 3].value;
+            i += 4;
+        }
         if (i < tokens.size() && tokens[i].value == "WHERE") {
             ++i;
-            while (i < tokens.size() && tokens[i].type != Token::END) {
-                condition += tokens[i].value + " ";
+            statement.condition = parse_where(tokens, i);
+        }
+        if (tokens[i].value == "GROUP") {
+            if (tokens[i + 1].value != "BY") {
+                throw QueryParseError("GROUP must be followed by BY");
+            }
+            i += 2;
+            while (true) {
+                if (tokens[i].type != Token::IDENTIFIER) {
+                    throw QueryParseError("Column expected in GROUP BY");
+                }
+                statement.group_by.emplace_back(tokens[i++].value);
+                if (tokens[i].value != ",") {
+                    break;
+                }
                 ++i;
             }
         }
+        if (tokens[i].value == "HAVING") {
+            ++i;
+            statement.having = parse_where(tokens, i);
+        }
+        parse_order_and_limit(tokens, i, statement);
     } else if (command == "INSERT") {
         if (i >= tokens.size() || tokens[i].value != "INTO") {
             throw QueryParseError("INSERT query must have an INTO clause");
@@ -84,12 +263,46 @@ void QueryParser::parse(const std::vector<Token>& tokens, std::string& command,
             throw QueryParseError("INSERT query must have a VALUES clause");
         }
         ++i;
+        // Either one bare list of values or parenthesized rows: VALUES (...), (...)
+        size_t row_start = 0;
+        size_t row_width = 0;
+        bool in_row = false;
+        statement.row_count = 0;
         while (i < tokens.size() && tokens[i].type != Token::END) {
-            if (tokens[i].type == Token::VALUE) {
-                values.push_back(tokens[i].value);
+            if (tokens[i].type == Token::VALUE || tokens[i].type == Token::PARAMETER) {
+                add_value(statement, tokens[i]);
+            } else if (tokens[i].type == Token::IDENTIFIER && is_number(tokens[i].value)) {
+                // Only PREPARE bodies keep unquoted numbers; normalize() lifts all others
+                add_value(statement, Token(Token::VALUE, tokens[i].value));
+            } else if (tokens[i].value == "(") {
+                if (in_row) {
+                    throw QueryParseError("Nested parentheses in VALUES");
+                }
+                in_row = true;
+                row_start = values.size();
+            } else if (tokens[i].value == ")") {
+                if (!in_row) {
+                    throw QueryParseError("Unbalanced ) in VALUES");
+                }
+                in_row = false;
+                size_t width = values.size() - row_start;
+                if (statement.row_count > 0 && width != row_width) {
+                    throw QueryParseError("Every row in VALUES must have the same number of values");
+                }
+                row_width = width;
+                statement.row_count++;
             }
             ++i;
         }
+        if (in_row) {
+            throw QueryParseError("Missing ) in VALUES");
+        }
+        if (statement.row_count == 0 || values.size() != row_width * statement.row_count) {
+            if (statement.row_count > 1) {
+                throw QueryParseError("Values outside the parenthesized rows of VALUES");
+            }
+            statement.row_count = 1;
+        }
     } else if (command == "UPDATE") {
         if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
             throw QueryParseError("Table name expected after UPDATE");
@@ -101,18 +314,20 @@ void QueryParser::parse(const std::vector<Token>& tokens, std::string& command,
         }
         ++i;
         while (i < tokens.size() && tokens[i].value != "WHERE") {
-            if (tokens[i].type == Token::IDENTIFIER) {
-                columns.push_back(tokens[i].value);
-            } else if (tokens[i].type == Token::VALUE) {
-                values.push_back(tokens[i].value);
+            if (tokens[i].type == Token::IDENTIFIER && is_number(tokens[i].value)) {
+                add_value(statement, Token(Token::VALUE, tokens[i].value));
+            } else if (tokens[i].type == Token::IDENTIFIER) {
+                columns.emplace_back(tokens[i].value);
+            } else if (tokens[i].type == Token::VALUE || tokens[i].type == Token::PARAMETER) {
+                add_value(statement, tokens[i]);
             }
             ++i;
         }
         if (i < tokens.size() && tokens[i].value == "WHERE") {
             ++i;
-            while (i < tokens.size() && tokens[i].type != Token::END) {
-                condition += tokens[i].value + " ";
-                ++i;
+            statement.condition = parse_where(tokens, i);
+            if (tokens[i].type != Token::END) {
+                throw QueryParseError("ORDER BY and LIMIT are only supported in SELECT");
             }
         }
     } else if (command == "DELETE") {
@@ -127,26 +342,458 @@ void QueryParser::parse(const std::vector<Token>& tokens, std::string& command,
         ++i;
         if (i < tokens.size() && tokens[i].value == "WHERE") {
             ++i;
-            while (i < tokens.size() && tokens[i].type != Token::END) {
-                condition += tokens[i].value + " ";
+            statement.condition = parse_where(tokens, i);
+            if (tokens[i].type != Token::END) {
+                throw QueryParseError("ORDER BY and LIMIT are only supported in SELECT");
+            }
+        }
+    } else if (command == "CREATE" && i < tokens.size() && tokens[i].value == "INDEX") {
+        command = "CREATE INDEX";
+        ++i;
+        // The index name is optional; indexes are identified by their column
+        if (i < tokens.size() && tokens[i].type == Token::IDENTIFIER) {
+            ++i;
+        }
+        if (i >= tokens.size() || tokens[i].value != "ON") {
+            throw QueryParseError("CREATE INDEX must have an ON clause");
+        }
+        ++i;
+        if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+            throw QueryParseError("Table name expected after ON");
+        }
+        table_name = tokens[i].value;
+        ++i;
+        if (i + 2 >= tokens.size() || tokens[i].value != "(" || tokens[i + 1].type != Token::IDENTIFIER ||
+            tokens[i + 2].value != ")") {
+            throw QueryParseError("Indexed column expected in parentheses after the table name");
+        }
+        columns.emplace_back(tokens[i + 1].value);
+        i += 3;
+        // Index type goes to values: USING HASH or USING BTREE, ordered by default
+        add_value(statement, Token(Token::VALUE, "BTREE"));
+        if (i < tokens.size() && tokens[i].value == "USING") {
+            ++i;
+            if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+                throw QueryParseError("Index type expected after USING");
+            }
+            values[0] = tokens[i].value;
+        }
+    } else if (command == "CREATE") {
+        if (i >= tokens.size() || tokens[i].value != "TABLE") {
+            throw QueryParseError("CREATE must be followed by TABLE or INDEX");
+        }
+        command = "CREATE TABLE";
+        ++i;
+        if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+            throw QueryParseError("Table name expected after CREATE TABLE");
+        }
+        table_name = tokens[i].value;
+        ++i;
+        if (i >= tokens.size() || tokens[i].value != "(") {
+            throw QueryParseError("Column definitions expected after table name");
+        }
+        ++i;
+        // Column names go to columns and their declared types to values, with
+        // " DICT" appended for dictionary-encoded columns
+        while (i < tokens.size() && tokens[i].value != ")") {
+            if (tokens[i].type != Token::IDENTIFIER || i + 1 >= tokens.size() ||
+                tokens[i + 1].type != Token::IDENTIFIER) {
+                throw QueryParseError("Column definition must be a name followed by a type");
+            }
+            columns.emplace_back(tokens[i].value);
+            add_value(statement, tokens[i + 1]);
+            i += 2;
+            if (i < tokens.size() && tokens[i].type == Token::KEYWORD && tokens[i].value == "DICT") {
+                statement.values.back() += " DICT";
+                ++i;
+            }
+            if (i < tokens.size() && tokens[i].value == ",") {
                 ++i;
             }
         }
+        if (i >= tokens.size() || tokens[i].value != ")") {
+            throw QueryParseError("Missing ) after column definitions");
+        }
+        if (columns.empty()) {
+            throw QueryParseError("CREATE TABLE needs at least one column");
+        }
+    } else if (command == "PREPARE") {
+        if (i + 1 >= tokens.size() || tokens[i].type != Token::IDENTIFIER || tokens[i + 1].value != "AS") {
+            throw QueryParseError("PREPARE expects a statement name followed by AS");
+        }
+        statement.statement_name = tokens[i].value;
+        TokenList body(tokens.begin() + i + 2, tokens.end(), tokens.get_allocator());
+        auto prepared = std::make_shared<Statement>(parse(body));
+        if (prepared->command != "SELECT" && prepared->command != "INSERT" && prepared->command != "UPDATE" &&
+            prepared->command != "DELETE") {
+            throw QueryParseError("Only data statements can be prepared");
+        }
+        statement.prepared = std::move(prepared);
+        statement.parameter_count = 0;
+    } else if (command == "EXECUTE") {
+        if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+            throw QueryParseError("Statement name expected after EXECUTE");
+        }
+        statement.statement_name = tokens[i].value;
+        ++i;
+        // Arguments may be wrapped in parentheses and separated by commas
+        while (i < tokens.size() && tokens[i].type != Token::END) {
+            if (tokens[i].type == Token::VALUE || tokens[i].type == Token::PARAMETER) {
+                add_value(statement, tokens[i]);
+            } else if (tokens[i].type != Token::PUNCTUATION) {
+                throw QueryParseError("Unexpected EXECUTE argument: " + std::string(tokens[i].value));
+            }
+            ++i;
+        }
+    } else if (command == "DEALLOCATE") {
+        if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+            throw QueryParseError("Statement name expected after DEALLOCATE");
+        }
+        statement.statement_name = tokens[i].value;
+    } else if (command == "COPY") {
+        if (i >= tokens.size() || tokens[i].type != Token::IDENTIFIER) {
+            throw QueryParseError("Table name expected after COPY");
+        }
+        table_name = tokens[i].value;
+        ++i;
+        if (i + 1 >= tokens.size() || tokens[i].value != "FROM" ||
+            (tokens[i + 1].type != Token::VALUE && tokens[i + 1].type != Token::PARAMETER)) {
+            throw QueryParseError("COPY expects FROM followed by a quoted file name");
+        }
+        add_value(statement, tokens[i + 1]);
+        i += 2;
+        // A header line is skipped with WITH HEADER
+        add_value(statement, Token(Token::VALUE, ""));
+        if (i < tokens.size() && tokens[i].value == "WITH") {
+            if (i + 1 >= tokens.size() || tokens[i + 1].value != "HEADER") {
+                throw QueryParseError("COPY supports only WITH HEADER");
+            }
+            values[1] = "HEADER";
+        }
+    } else if (command == "SHOW") {
+        if (i >= tokens.size() || tokens[i].value != "CACHE") {
+            throw QueryParseError("SHOW supports only CACHE");
+        }
+        command = "SHOW CACHE";
+    } else if (command == "EXPLAIN") {
+        if (tokens[i].value == "ANALYZE") {
+            command = "EXPLAIN ANALYZE";
+            ++i;
+        }
+        TokenList body(tokens.begin() + i, tokens.end(), tokens.get_allocator());
+        auto explained = std::make_shared<Statement>(parse(body));
+        if (explained->command != "SELECT" && explained->command != "UPDATE" && explained->command != "DELETE" &&
+            explained->command != "EXECUTE") {
+            throw QueryParseError("Only SELECT, UPDATE, DELETE and EXECUTE can be explained");
+        }
+        statement.prepared = std::move(explained);
+    } else if (command == "SAVE" || command == "STATS") {
+        if (tokens[i].type != Token::END) {
+            throw QueryParseError(command + " takes no arguments");
+        }
     } else {
         throw QueryParseError("Unknown command: " + command);
     }
+    return statement;
+}
+
+bool QueryParser::is_keyword(std::string_view word) {
+    return !word.empty() && KEYWORD_TABLE.slots[keyword_hash(word)] == word;
+}
+
+void QueryParser::add_value(Statement& statement, const Token& token) {
+    if (token.type == Token::PARAMETER) {
+        statement.values.emplace_back();
+        statement.value_parameters.push_back(std::stoi(std::string(token.value)));
+    } else {
+        statement.values.emplace_back(token.value);
+        statement.value_parameters.push_back(-1);
+    }
+}
+
+void QueryParser::parse_order_and_limit(const TokenList& tokens, size_t& i, Statement& statement) {
+    if (tokens[i].value == "ORDER") {
+        if (tokens[i + 1].value != "BY") {
+            throw QueryParseError("ORDER must be followed by BY");
+        }
+        i += 2;
+        while (true) {
+            if (tokens[i].type != Token::IDENTIFIER || is_number(tokens[i].value)) {
+                throw QueryParseError("Column expected in ORDER BY");
+            }
+            OrderTerm term;
+            term.column = parse_column_reference(tokens, i);
+            if (tokens[i].value == "ASC" || tokens[i].value == "DESC") {
+                term.descending = tokens[i++].value == "DESC";
+            }
+            statement.order_by.push_back(term);
+            if (tokens[i].value != ",") {
+                break;
+            }
+            ++i;
+        }
+    }
+    // Unquoted numbers are identifiers until normalize() lifts them into parameters
+    auto add_count = [&](const char* clause) {
+        const Token& token = tokens[i + 1];
+        if (token.type == Token::VALUE || token.type == Token::PARAMETER) {
+            add_value(statement, token);
+        } else if (token.type == Token::IDENTIFIER && is_number(token.value)) {
+            add_value(statement, Token(Token::VALUE, token.value));
+        } else {
+            throw QueryParseError(std::string("Row count expected after ") + clause);
+        }
+        i += 2;
+        return static_cast<int>(statement.values.size()) - 1;
+    };
+    if (tokens[i].value == "LIMIT") {
+        statement.limit_value = add_count("LIMIT");
+        if (tokens[i].value == "OFFSET") {
+            statement.offset_value = add_count("OFFSET");
+        }
+    }
+    if (tokens[i].type != Token::END) {
+        throw QueryParseError("Unexpected token after SELECT: " + std::string(tokens[i].value));
+    }
+}
+
+// Unquoted numbers such as 42, -3 or .5 are literals; other words name columns
+bool QueryParser::is_number(std::string_view word) {
+    size_t start = (word[0] == '-' || word[0] == '+') ? 1 : 0;
+    if (start < word.size() && word[start] == '.') {
+        ++start;
+    }
+    return start < word.size() && isdigit(static_cast<unsigned char>(word[start]));
+}
+
+std::unique_ptr<Expression> QueryParser::parse_where(const TokenList& tokens, size_t& i) {
+    WhereLimits limits;
+    auto expression = parse_or(tokens, i, limits);
+    std::string_view next = tokens[i].value;
+    bool clause_follows = tokens[i].type == Token::KEYWORD &&
+                          (next == "GROUP" || next == "HAVING" || next == "ORDER" || next == "LIMIT");
+    if (tokens[i].type != Token::END && !clause_follows) {
+        throw QueryParseError("Unexpected token in WHERE clause: " + std::string(tokens[i].value));
+    }
+    return expression;
+}
+
+std::unique_ptr<Expression> QueryParser::parse_or(const TokenList& tokens, size_t& i, WhereLimits& limits) {
+    std::vector<std::unique_ptr<Expression>> terms;
+    terms.push_back(parse_and(tokens, i, limits));
+    while (tokens[i].type == Token::KEYWORD && tokens[i].value == "OR") {
+        ++i;
+        terms.push_back(parse_and(tokens, i, limits));
+    }
+    return Expression::join(Expression::OR, std::move(terms));
+}
+
+std::unique_ptr<Expression> QueryParser::parse_and(const TokenList& tokens, size_t& i, WhereLimits& limits) {
+    std::vector<std::unique_ptr<Expression>> terms;
+    terms.push_back(parse_not(tokens, i, limits));
+    while (tokens[i].type == Token::KEYWORD && tokens[i].value == "AND") {
+        ++i;
+        terms.push_back(parse_not(tokens, i, limits));
+    }
+    return Expression::join(Expression::AND, std::move(terms));
+}
+
+std::unique_ptr<Expression> QueryParser::parse_not(const TokenList& tokens, size_t& i, WhereLimits& limits) {
+    bool is_not = tokens[i].type == Token::KEYWORD && tokens[i].value == "NOT";
+    bool is_group = tokens[i].type == Token::PUNCTUATION && tokens[i].value == "(";
+    if (!is_not && !is_group) {
+        return parse_comparison(tokens, i, limits);
+    }
+    if (++limits.depth > MAX_WHERE_DEPTH) {
+        throw QueryParseError("WHERE clause nested too deeply");
+    }
+    ++i;
+    std::unique_ptr<Expression> expression;
+    if (is_not) {
+        expression = Expression::logical(Expression::NOT, parse_not(tokens, i, limits), nullptr);
+    } else {
+        expression = parse_or(tokens, i, limits);
+        if (tokens[i].value != ")") {
+            throw QueryParseError("Missing ) in WHERE clause");
+        }
+        ++i;
+    }
+    --limits.depth;
+    return expression;
 }
 
-bool QueryParser::is_keyword(const std::string& word) {
-    static const std::unordered_set<std::string> keywords = {
-            "SELECT", "INSERT", "UPDATE", "DELETE", "FROM", "WHERE", "VALUES", "SET", "INTO"
+// One side must be a column and the other a literal; "5 < age" is stored as "age > 5",
+// "age BETWEEN 5 AND 9" as "age >= 5 AND age <= 9" and "age IN (5, 9)" as "age = 5 OR age = 9"
+std::unique_ptr<Expression> QueryParser::parse_comparison(const TokenList& tokens, size_t& i, WhereLimits& limits) {
+    auto is_literal = [](const Token& token) {
+        return token.type == Token::VALUE || token.type == Token::PARAMETER ||
+               (token.type == Token::IDENTIFIER && is_number(token.value));
     };
-    return keywords.find(word) != keywords.end();
+    auto parameter = [](const Token& token) {
+        return token.type == Token::PARAMETER ? std::stoi(std::string(token.value)) : -1;
+    };
+    auto is_column = [&](const Token& token) {
+        return token.type == Token::IDENTIFIER && !is_literal(token);
+    };
+    auto add_terms = [&limits](size_t count) {
+        limits.terms += count;
+        if (limits.terms > MAX_WHERE_TERMS) {
+            throw QueryParseError("WHERE clause has more than " + std::to_string(MAX_WHERE_TERMS) + " comparisons");
+        }
+    };
+    // Aggregate calls collapse into a single column operand, whose name is kept in name
+    auto operand = [&](std::string& name) {
+        if (tokens[i].type == Token::IDENTIFIER && tokens[i + 1].value == "(") {
+            name = parse_column_reference(tokens, i);
+            return Token(Token::IDENTIFIER, name);
+        }
+        return tokens[i].type == Token::END ? tokens[i] : tokens[i++];
+    };
+
+    std::string left_name, right_name;
+    Token left = operand(left_name);
+    const Token& op_token = tokens[i];
+    bool between = op_token.type == Token::KEYWORD && op_token.value == "BETWEEN";
+    if (op_token.type == Token::KEYWORD && op_token.value == "IN") {
+        if (!is_column(left) || tokens[i + 1].value != "(") {
+            throw QueryParseError("IN expects a column followed by a list of values");
+        }
+        i += 2;
+        std::vector<std::unique_ptr<Expression>> any;
+        while (true) {
+            if (!is_literal(tokens[i])) {
+                throw QueryParseError("IN list must hold values only");
+            }
+            add_terms(1);
+            any.push_back(Expression::comparison(std::string(left.value), Expression::EQ,
+                                                 std::string(tokens[i].value), parameter(tokens[i])));
+            ++i;
+            if (tokens[i].value == ")") {
+                ++i;
+                return Expression::join(Expression::OR, std::move(any));
+            }
+            if (tokens[i].value != ",") {
+                throw QueryParseError("Missing ) after IN list");
+            }
+            ++i;
+        }
+    }
+    if (op_token.type != Token::OPERATOR && !between) {
+        throw QueryParseError("Comparison expected in WHERE clause");
+    }
+    ++i;
+    Token right = operand(right_name);
+
+    if (between) {
+        if (tokens[i].value != "AND" || !is_column(left) || !is_literal(right) || !is_literal(tokens[i + 1])) {
+            throw QueryParseError("BETWEEN expects a column followed by value AND value");
+        }
+        const Token& upper = tokens[i + 1];
+        i += 2;
+        add_terms(2);
+        return Expression::logical(Expression::AND,
+                                   Expression::comparison(std::string(left.value), Expression::GE,
+                                                          std::string(right.value), parameter(right)),
+                                   Expression::comparison(std::string(left.value), Expression::LE,
+                                                          std::string(upper.value), parameter(upper)));
+    }
+
+    Expression::Operator op = parse_operator(op_token.value);
+    add_terms(1);
+    if (is_column(left) && is_literal(right)) {
+        return Expression::comparison(std::string(left.value), op, std::string(right.value), parameter(right));
+    }
+    if (is_literal(left) && is_column(right)) {
+        return Expression::comparison(std::string(right.value), flip_operator(op), std::string(left.value),
+                                      parameter(left));
+    }
+    throw QueryParseError("Comparison must be between a column and a value: " + std::string(left.value) + " " +
+                          std::string(op_token.value) + " " + std::string(right.value));
+}
+
+// A column name, or an aggregate call such as count(*) which is returned in
+// its canonical form COUNT(*)
+std::string QueryParser::parse_column_reference(const TokenList& tokens, size_t& i) {
+    if (tokens[i].type != Token::IDENTIFIER) {
+        throw QueryParseError("Column expected, got: " + std::string(tokens[i].value));
+    }
+    std::string name(tokens[i++].value);
+    if (tokens[i].value != "(") {
+        return name;
+    }
+    if (tokens[i + 1].type != Token::IDENTIFIER || tokens[i + 2].value != ")") {
+        throw QueryParseError("Function " + name + " expects one column or *");
+    }
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    name += "(" + std::string(tokens[i + 1].value) + ")";
+    i += 3;
+    return name;
 }
 
-bool QueryParser::is_operator(const std::string& word) {
-    static const std::unordered_set<std::string> operators = {
-            "=", "<", ">", "<=", ">=", "!="
+// Replaces every literal with ? and collects the literals in order, so that
+// queries differing only in their constants share one normalized text (and
+// one cached statement). Runs of whitespace collapse to a single space.
+std::string QueryParser::normalize(const std::string& query, std::vector<std::string>& literals) {
+    std::string result;
+    result.reserve(query.size());
+    auto is_word_char = [](char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
     };
-    return operators.find(word) != operators.end();
-}
\ No newline at end of file
+    size_t i = 0;
+    while (i < query.size()) {
+        char c = query[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            while (i < query.size() && isspace(static_cast<unsigned char>(query[i]))) {
+                ++i;
+            }
+            if (!result.empty() && i < query.size()) {
+                result += ' ';
+            }
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            size_t end = query.find(c, i + 1);
+            if (end == std::string::npos) {
+                throw QueryParseError("Unterminated string literal");
+            }
+            literals.push_back(query.substr(i + 1, end - i - 1));
+            result += '?';
+            i = end + 1;
+            continue;
+        }
+        bool starts_word = result.empty() || !is_word_char(result.back());
+        bool signed_number = (c == '-' || c == '+' || c == '.') && i + 1 < query.size() &&
+                             (isdigit(static_cast<unsigned char>(query[i + 1])) || query[i + 1] == '.');
+        if (starts_word && (isdigit(static_cast<unsigned char>(c)) || signed_number)) {
+            size_t end = i + 1;
+            while (end < query.size()) {
+                char n = query[end];
+                bool exponent_sign = (n == '-' || n == '+') && (query[end - 1] == 'e' || query[end - 1] == 'E');
+                if (!isalnum(static_cast<unsigned char>(n)) && n != '.' && !exponent_sign) {
+                    break;
+                }
+                ++end;
+            }
+            literals.push_back(query.substr(i, end - i));
+            result += '?';
+            i = end;
+            continue;
+        }
+        result += c;
+        ++i;
+    }
+    return result;
+}
+
+std::vector<std::string> Statement::bind_values(const std::vector<std::string>& parameters) const {
+    std::vector<std::string> bound = values;
+    for (size_t i = 0; i < bound.size(); ++i) {
+        if (value_parameters[i] >= 0) {
+            if (static_cast<size_t>(value_parameters[i]) >= parameters.size()) {
+                throw std::runtime_error("No value bound for parameter " + std::to_string(value_parameters[i] + 1));
+            }
+            bound[i] = parameters[value_parameters[i]];
+        }
+    }
+    return bound;
+}
@@ -0,0 +1,130 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/query_profile.h"
+#include "../include/arena.h"
+
+namespace {
+
+const char* const OPERATOR_NAMES[] = {"plan", "scan", "join", "aggregate", "sort", "output"};
+static_assert(sizeof(OPERATOR_NAMES) / sizeof(OPERATOR_NAMES[0]) == QueryProfile::OPERATOR_COUNT);
+
+// The profile a thread works for, the operator it is charging and since when
+struct ThreadState {
+    QueryProfile* profile = nullptr;
+    QueryProfile::Operator op = QueryProfile::PLAN;
+    std::chrono::steady_clock::time_point since;
+    size_t arena_start = 0;
+};
+
+thread_local ThreadState state;
+
+} // namespace
+
+QueryProfile::Scope::Scope(QueryProfile* profile, Operator op)
+        : saved_profile(state.profile), saved_operator(state.op) {
+    if (state.profile != nullptr) {
+        switch_to(state.op);
+    }
+    state.profile = profile;
+    state.op = op;
+    if (profile != nullptr) {
+        state.since = std::chrono::steady_clock::now();
+        state.arena_start = QueryArena::local().get_allocated_bytes();
+    }
+}
+
+// The time spent inside is not charged again to the operator restored here
+QueryProfile::Scope::~Scope() {
+    if (state.profile != nullptr) {
+        switch_to(state.op);
+    }
+    state.profile = saved_profile;
+    state.op = saved_operator;
+    if (saved_profile != nullptr) {
+        state.since = std::chrono::steady_clock::now();
+        state.arena_start = QueryArena::local().get_allocated_bytes();
+    }
+}
+
+QueryProfile::Phase::Phase(Operator op) : active(state.profile != nullptr), previous(state.op) {
+    if (active) {
+        switch_to(op);
+    }
+}
+
+QueryProfile::Phase::~Phase() {
+    if (active) {
+        switch_to(previous);
+    }
+}
+
+QueryProfile::Operator QueryProfile::Phase::get_previous() const {
+    return previous;
+}
+
+QueryProfile::QueryProfile(bool plan_only) : plan_only(plan_only) {}
+
+QueryProfile* QueryProfile::current() {
+    return state.profile;
+}
+
+QueryProfile::Operator QueryProfile::current_operator() {
+    return state.op;
+}
+
+const char* QueryProfile::get_name(Operator op) {
+    return OPERATOR_NAMES[op];
+}
+
+// Charges the time and arena memory used since the last switch to the
+// operator that ran, then starts on op
+void QueryProfile::switch_to(Operator op) {
+    auto now = std::chrono::steady_clock::now();
+    size_t allocated = QueryArena::local().get_allocated_bytes();
+    QueryProfile& profile = *state.profile;
+    profile.nanoseconds[state.op].fetch_add(
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - state.since).count()),
+            std::memory_order_relaxed);
+    // The arena only shrinks when its thread's outermost query ends
+    if (allocated > state.arena_start) {
+        profile.arena_bytes.fetch_add(allocated - state.arena_start, std::memory_order_relaxed);
+    }
+    state.op = op;
+    state.since = now;
+    state.arena_start = allocated;
+}
+
+bool QueryProfile::is_plan_only() const {
+    return plan_only;
+}
+
+void QueryProfile::note(std::string line) {
+    plan.push_back(std::move(line));
+}
+
+void QueryProfile::count_rows(uint64_t examined, uint64_t matched) {
+    rows_examined.fetch_add(examined, std::memory_order_relaxed);
+    rows_matched.fetch_add(matched, std::memory_order_relaxed);
+}
+
+const std::vector<std::string>& QueryProfile::get_plan() const {
+    return plan;
+}
+
+uint64_t QueryProfile::get_rows_examined() const {
+    return rows_examined.load(std::memory_order_relaxed);
+}
+
+uint64_t QueryProfile::get_rows_matched() const {
+    return rows_matched.load(std::memory_order_relaxed);
+}
+
+uint64_t QueryProfile::get_nanoseconds(Operator op) const {
+    return nanoseconds[op].load(std::memory_order_relaxed);
+}
+
+uint64_t QueryProfile::get_arena_bytes() const {
+    return arena_bytes.load(std::memory_order_relaxed);
+}
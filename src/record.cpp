@@ -0,0 +1,306 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/record.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+ColumnType parse_column_type(const std::string& name) {
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (upper == "INTEGER" || upper == "INT") {
+        return ColumnType::INTEGER;
+    } else if (upper == "REAL" || upper == "FLOAT" || upper == "DOUBLE") {
+        return ColumnType::REAL;
+    } else if (upper == "TEXT" || upper == "VARCHAR") {
+        return ColumnType::TEXT;
+    }
+    throw std::runtime_error("Unknown column type: " + name);
+}
+
+Column make_column(const std::string& name, const std::string& declared_type) {
+    size_t space = declared_type.find(' ');
+    if (space == std::string::npos) {
+        return {name, parse_column_type(declared_type)};
+    }
+    ColumnType type = parse_column_type(declared_type.substr(0, space));
+    if (declared_type.substr(space + 1) != "DICT") {
+        throw std::runtime_error("Unknown column type: " + declared_type);
+    }
+    if (type != ColumnType::TEXT) {
+        throw std::runtime_error("DICT only applies to TEXT columns: " + name);
+    }
+    return {name, type, std::make_shared<Dictionary>()};
+}
+
+const char* column_type_name(ColumnType type) {
+    switch (type) {
+        case ColumnType::INTEGER: return "INTEGER";
+        case ColumnType::REAL: return "REAL";
+        case ColumnType::TEXT: return "TEXT";
+    }
+    return "UNKNOWN";
+}
+
+Value parse_value(ColumnType type, const std::string& text) {
+    size_t consumed = 0;
+    try {
+        if (type == ColumnType::INTEGER) {
+            int64_t value = std::stoll(text, &consumed);
+            if (consumed == text.size()) {
+                return value;
+            }
+        } else if (type == ColumnType::REAL) {
+            double value = std::stod(text, &consumed);
+            if (consumed == text.size()) {
+                return value;
+            }
+        } else {
+            return text;
+        }
+    } catch (const std::logic_error&) {
+        // Reported below
+    }
+    throw std::runtime_error("Invalid " + std::string(column_type_name(type)) + " value: '" + text + "'");
+}
+
+std::string value_to_string(const Value& value) {
+    if (std::holds_alternative<int64_t>(value)) {
+        return std::to_string(std::get<int64_t>(value));
+    }
+    if (std::holds_alternative<double>(value)) {
+        // Shortest form that still round-trips
+        double number = std::get<double>(value);
+        char buffer[32];
+        for (int precision = 15; precision <= 17; ++precision) {
+            snprintf(buffer, sizeof(buffer), "%.*g", precision, number);
+            if (std::strtod(buffer, nullptr) == number) {
+                break;
+            }
+        }
+        return buffer;
+    }
+    return std::get<std::string>(value);
+}
+
+int compare_values(const Value& a, const Value& b) {
+    if (std::holds_alternative<std::string>(a) || std::holds_alternative<std::string>(b)) {
+        if (!std::holds_alternative<std::string>(a) || !std::holds_alternative<std::string>(b)) {
+            throw std::runtime_error("Cannot compare TEXT with a number");
+        }
+        return std::get<std::string>(a).compare(std::get<std::string>(b));
+    }
+    if (std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)) {
+        int64_t x = std::get<int64_t>(a), y = std::get<int64_t>(b);
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+    double x = std::holds_alternative<int64_t>(a) ? static_cast<double>(std::get<int64_t>(a)) : std::get<double>(a);
+    double y = std::holds_alternative<int64_t>(b) ? static_cast<double>(std::get<int64_t>(b)) : std::get<double>(b);
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+uint32_t Dictionary::encode(std::string_view text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = codes.find(text);
+    if (it != codes.end()) {
+        return it->second;
+    }
+    if (text.size() > MAX_VALUE_SIZE) {
+        throw std::runtime_error("DICT values are limited to " + std::to_string(MAX_VALUE_SIZE) + " bytes");
+    }
+    if (next_code == MAX_CODES) {
+        throw std::runtime_error("DICT column has more than " + std::to_string(MAX_CODES) + " distinct values");
+    }
+    uint32_t code = next_code;
+    store(code, text);
+    additions.emplace_back(code, std::string(text));
+    return code;
+}
+
+bool Dictionary::find(std::string_view text, uint32_t& code) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = codes.find(text);
+    if (it == codes.end()) {
+        return false;
+    }
+    code = it->second;
+    return true;
+}
+
+void Dictionary::load(uint32_t code, std::string_view text) {
+    if (code >= MAX_CODES) {
+        throw std::runtime_error("Corrupt dictionary code " + std::to_string(code));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    store(code, text);
+}
+
+std::vector<std::pair<uint32_t, std::string>> Dictionary::take_additions() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<uint32_t, std::string>> taken;
+    taken.swap(additions);
+    return taken;
+}
+
+size_t Dictionary::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return codes.size();
+}
+
+// Codes below next_code always have their chunk; the map keys view the stored strings
+void Dictionary::store(uint32_t code, std::string_view text) {
+    for (uint32_t chunk = next_code >> CHUNK_BITS; chunk <= code >> CHUNK_BITS; ++chunk) {
+        if (!chunks[chunk]) {
+            chunks[chunk] = std::make_unique<std::string[]>(CHUNK_SIZE);
+        }
+    }
+    std::string& value = chunks[code >> CHUNK_BITS][code & (CHUNK_SIZE - 1)];
+    auto it = codes.find(value);
+    if (it != codes.end() && it->second == code) {
+        codes.erase(it);
+    }
+    value.assign(text);
+    codes[value] = code;
+    next_code = std::max(next_code, code + 1);
+}
+
+Schema::Schema(std::vector<Column> columns) : columns(std::move(columns)) {}
+
+size_t Schema::size() const {
+    return columns.size();
+}
+
+const Column& Schema::operator[](size_t index) const {
+    return columns[index];
+}
+
+const std::vector<Column>& Schema::get_columns() const {
+    return columns;
+}
+
+int Schema::get_column_index(const std::string& column_name) const {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].name == column_name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+std::string Schema::encode(const std::vector<std::string>& values) const {
+    if (values.size() != columns.size()) {
+        throw std::runtime_error("Number of values doesn't match number of columns");
+    }
+    std::vector<Value> typed;
+    typed.reserve(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        try {
+            typed.push_back(parse_value(columns[i].type, values[i]));
+        } catch (const std::exception& e) {
+            throw std::runtime_error(std::string(e.what()) + " for column " + columns[i].name);
+        }
+    }
+    return encode_values(typed);
+}
+
+std::string Schema::encode_values(const std::vector<Value>& values) const {
+    size_t record_size = columns.size() * SLOT_SIZE;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].type == ColumnType::TEXT && !columns[i].dictionary) {
+            record_size += std::get<std::string>(values[i]).size();
+        }
+    }
+
+    std::string record(record_size, '\0');
+    char* data = &record[0];
+    uint32_t heap_offset = static_cast<uint32_t>(columns.size() * SLOT_SIZE);
+    for (size_t i = 0; i < columns.size(); ++i) {
+        char* slot = data + i * SLOT_SIZE;
+        switch (columns[i].type) {
+            case ColumnType::INTEGER: {
+                int64_t value = std::holds_alternative<double>(values[i])
+                                ? static_cast<int64_t>(std::get<double>(values[i]))
+                                : std::get<int64_t>(values[i]);
+                memcpy(slot, &value, sizeof(value));
+                break;
+            }
+            case ColumnType::REAL: {
+                double value = std::holds_alternative<int64_t>(values[i])
+                               ? static_cast<double>(std::get<int64_t>(values[i]))
+                               : std::get<double>(values[i]);
+                memcpy(slot, &value, sizeof(value));
+                break;
+            }
+            case ColumnType::TEXT: {
+                const std::string& text = std::get<std::string>(values[i]);
+                if (columns[i].dictionary) {
+                    int64_t code = columns[i].dictionary->encode(text);
+                    memcpy(slot, &code, sizeof(code));
+                    break;
+                }
+                uint32_t length = static_cast<uint32_t>(text.size());
+                memcpy(slot, &heap_offset, sizeof(heap_offset));
+                memcpy(slot + 4, &length, sizeof(length));
+                memcpy(data + heap_offset, text.data(), text.size());
+                heap_offset += length;
+                break;
+            }
+        }
+    }
+    return record;
+}
+
+std::vector<std::string> Schema::decode(std::string_view record) const {
+    RecordView view(*this, record);
+    std::vector<std::string> values;
+    values.reserve(columns.size());
+    for (size_t i = 0; i < columns.size(); ++i) {
+        values.push_back(view.get_string(i));
+    }
+    return values;
+}
+
+int64_t RecordView::get_integer(size_t column) const {
+    int64_t value;
+    memcpy(&value, data.data() + column * Schema::SLOT_SIZE, sizeof(value));
+    return value;
+}
+
+double RecordView::get_real(size_t column) const {
+    double value;
+    memcpy(&value, data.data() + column * Schema::SLOT_SIZE, sizeof(value));
+    return value;
+}
+
+double RecordView::get_number(size_t column) const {
+    return (*schema)[column].type == ColumnType::REAL ? get_real(column) : static_cast<double>(get_integer(column));
+}
+
+std::string_view RecordView::get_text(size_t column) const {
+    if (const Dictionary* dictionary = (*schema)[column].dictionary.get()) {
+        return dictionary->decode(static_cast<uint32_t>(get_integer(column)));
+    }
+    uint32_t offset, length;
+    memcpy(&offset, data.data() + column * Schema::SLOT_SIZE, sizeof(offset));
+    memcpy(&length, data.data() + column * Schema::SLOT_SIZE + 4, sizeof(length));
+    return data.substr(offset, length);
+}
+
+Value RecordView::get_value(size_t column) const {
+    switch ((*schema)[column].type) {
+        case ColumnType::INTEGER: return get_integer(column);
+        case ColumnType::REAL: return get_real(column);
+        case ColumnType::TEXT: return std::string(get_text(column));
+    }
+    return std::string();
+}
+
+std::string RecordView::get_string(size_t column) const {
+    if ((*schema)[column].type == ColumnType::TEXT) {
+        return std::string(get_text(column));
+    }
+    return value_to_string(get_value(column));
+}
@@ -0,0 +1,88 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/result_cache.h"
+
+ResultCache::ResultCache(KeyFunction get_key, size_t capacity)
+        : get_key(std::move(get_key)), capacity(capacity), max_entry_size(capacity / 8), bytes(0) {}
+
+std::shared_ptr<const std::string> ResultCache::find(const std::string& query, uint64_t& row_count,
+                                                     std::unique_ptr<Fill>& fill, PreparedQuery& prepared) {
+    std::string key;
+    std::vector<std::shared_ptr<const Table>> tables;
+    if (!get_key(query, key, tables, prepared)) {
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = lookup.find(key);
+        if (it != lookup.end()) {
+            if (is_current(it->second->versions)) {
+                entries.splice(entries.begin(), entries, it->second);
+                row_count = it->second->row_count;
+                Metrics::add(Metrics::RESULT_CACHE_HITS);
+                return it->second->output;
+            }
+            erase(it->second);
+        }
+    }
+    Metrics::add(Metrics::RESULT_CACHE_MISSES);
+
+    // Versions taken before the query runs: a change made meanwhile leaves
+    // the entry stale rather than labelled with data it may not contain
+    fill = std::make_unique<Fill>();
+    fill->key = std::move(key);
+    for (auto& table : tables) {
+        uint64_t version = table->get_version();
+        fill->versions.emplace_back(std::move(table), version);
+    }
+    return nullptr;
+}
+
+bool ResultCache::capture(Fill& fill, const std::string& output) const {
+    if (fill.key.size() + fill.output.size() + output.size() > max_entry_size) {
+        return false;
+    }
+    fill.output += output;
+    return true;
+}
+
+void ResultCache::insert(Fill& fill, uint64_t row_count) {
+    if (!is_current(fill.versions)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(fill.key);
+    if (it != lookup.end()) {
+        // Another worker ran the same query at the same time
+        erase(it->second);
+    }
+    entries.push_front({std::move(fill.key), std::move(fill.versions),
+                        std::make_shared<const std::string>(std::move(fill.output)), row_count});
+    lookup[entries.front().key] = entries.begin();
+    bytes += get_size(entries.front());
+    while (bytes > capacity) {
+        erase(std::prev(entries.end()));
+    }
+}
+
+bool ResultCache::is_current(const TableVersions& versions) {
+    for (const auto& version : versions) {
+        if (version.first->get_version() != version.second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The key is stored twice, in the entry and in the lookup map
+size_t ResultCache::get_size(const Entry& entry) {
+    return 2 * entry.key.size() + entry.output->size() + sizeof(Entry);
+}
+
+void ResultCache::erase(std::list<Entry>::iterator it) {
+    bytes -= get_size(*it);
+    lookup.erase(it->key);
+    entries.erase(it);
+}
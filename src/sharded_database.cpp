@@ -0,0 +1,487 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/sharded_database.h"
+#include <csignal>
+#include <exception>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+// Waits for the jobs of one call and keeps the first of their errors
+class JobGroup {
+public:
+    explicit JobGroup(size_t job_count) : pending(job_count) {}
+
+    void finish(std::exception_ptr failure) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failure && !error) {
+            error = failure;
+        }
+        if (--pending == 0) {
+            done.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending;
+    std::exception_ptr error;
+};
+
+// Pins the thread to the index-th core the process may run on; if that
+// fails the thread just stays unpinned
+void pin_thread(std::thread& thread, size_t index) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        return;
+    }
+    cpu_set_t target;
+    CPU_ZERO(&target);
+    CPU_SET(cpus[index % cpus.size()], &target);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(target), &target);
+}
+
+bool parse_key(const std::string& text, int64_t& key) {
+    try {
+        Value value = bind_literal(ColumnType::INTEGER, text);
+        if (const int64_t* integer = std::get_if<int64_t>(&value)) {
+            key = *integer;
+            return true;
+        }
+    } catch (const std::exception&) {
+        // Left for the shards to reject
+    }
+    return false;
+}
+
+void split_conjuncts(const Expression* expression, std::vector<const Expression*>& conjuncts) {
+    if (expression == nullptr) {
+        return;
+    }
+    if (expression->kind == Expression::AND) {
+        split_conjuncts(expression->left.get(), conjuncts);
+        split_conjuncts(expression->right.get(), conjuncts);
+    } else {
+        conjuncts.push_back(expression);
+    }
+}
+
+} // namespace
+
+// A shard's own cursor, advanced on the shard's executor. Dropping it hands
+// the shard's cursor back to the executor too, without waiting.
+class ShardedDatabase::ShardCursor : public QueryCursor {
+public:
+    ShardCursor(ShardedDatabase& database, size_t shard, std::unique_ptr<QueryCursor> cursor)
+            : database(database), shard(shard), cursor(std::move(cursor)) {}
+
+    ~ShardCursor() override {
+        if (cursor) {
+            std::shared_ptr<QueryCursor> released(std::move(cursor));
+            database.submit(*database.shards[shard], [released]() mutable { released.reset(); });
+        }
+    }
+
+    bool next(const RowSink& sink, size_t max_rows) override {
+        if (!cursor) {
+            return false;
+        }
+        bool more = false;
+        database.run(shard, [&] { more = cursor->next(sink, max_rows); });
+        return more;
+    }
+
+    size_t get_row_count() const override {
+        return cursor ? cursor->get_row_count() : row_count;
+    }
+
+    void close() override {
+        if (cursor) {
+            database.run(shard, [this] {
+                row_count = cursor->get_row_count();
+                cursor->close();
+                cursor.reset();
+            });
+        }
+    }
+
+private:
+    ShardedDatabase& database;
+    size_t shard;
+    std::unique_ptr<QueryCursor> cursor;
+    size_t row_count = 0;
+};
+
+ShardedDatabase::ShardedDatabase(const DatabaseConfig& config) : statement_cache(config.statement_cache_size) {
+    if (config.shard_count == 0) {
+        throw std::runtime_error("A sharded database needs at least one shard");
+    }
+    // Keys are spread by the shard count, so it can't change once there is data
+    auto shard_file = [&config](size_t shard) { return config.data_file + "-shard" + std::to_string(shard); };
+    size_t existing = 0;
+    for (size_t i = 0; i < config.shard_count; ++i) {
+        existing += access(shard_file(i).c_str(), F_OK) == 0 ? 1 : 0;
+    }
+    if ((existing > 0 && existing < config.shard_count) || access(shard_file(config.shard_count).c_str(), F_OK) == 0) {
+        throw std::runtime_error("The shards of " + config.data_file + " were created with another shard count");
+    }
+
+    // Every shard is scanned by its own executor alone
+    for (size_t i = 0; i < config.shard_count; ++i) {
+        DatabaseConfig shard_config = config;
+        shard_config.data_file = shard_file(i);
+        shard_config.buffer_pool_size = config.buffer_pool_size / config.shard_count;
+        shard_config.scan_threads = 0;
+        shard_config.shard_index = i;
+        shards.push_back(std::make_unique<Shard>());
+        shards.back()->db = std::make_unique<Database>(shard_config);
+    }
+
+    // Leave shutdown signals to the threads that wait for them
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    for (size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->thread = std::thread(&ShardedDatabase::run_jobs, this, std::ref(*shards[i]));
+        pin_thread(shards[i]->thread, i);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+ShardedDatabase::~ShardedDatabase() {
+    for (auto& shard : shards) {
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->stopping = true;
+        }
+        shard->cv.notify_all();
+        shard->thread.join();
+    }
+}
+
+void ShardedDatabase::run_jobs(Shard& shard) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true) {
+        shard.cv.wait(lock, [&shard] { return shard.stopping || !shard.jobs.empty(); });
+        if (shard.jobs.empty()) {
+            return;
+        }
+        std::function<void()> job = std::move(shard.jobs.front());
+        shard.jobs.pop_front();
+        lock.unlock();
+        job();
+        job = nullptr;
+        lock.lock();
+    }
+}
+
+void ShardedDatabase::submit(Shard& shard, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.jobs.push_back(std::move(job));
+    }
+    shard.cv.notify_one();
+}
+
+// Runs job on the shard's executor and waits for it, rethrowing its error
+void ShardedDatabase::run(size_t shard, const std::function<void()>& job) {
+    JobGroup group(1);
+    submit(*shards[shard], [&group, &job] {
+        std::exception_ptr failure;
+        try {
+            QueryArena::Scope arena_scope;
+            job();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        group.finish(failure);
+    });
+    group.wait();
+}
+
+// Runs job(shard) on every executor at once and waits for all of them
+void ShardedDatabase::run_everywhere(const std::function<void(size_t shard)>& job) {
+    JobGroup group(shards.size());
+    for (size_t i = 0; i < shards.size(); ++i) {
+        submit(*shards[i], [&group, &job, i] {
+            std::exception_ptr failure;
+            try {
+                QueryArena::Scope arena_scope;
+                job(i);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            group.finish(failure);
+        });
+    }
+    group.wait();
+}
+
+// Parsed here only to route the query; the shards parse it again themselves
+std::shared_ptr<const Statement> ShardedDatabase::prepare_statement(const std::string& query,
+                                                                    std::vector<std::string>& parameters,
+                                                                    std::string* normalized_query) {
+    if (QueryParser::first_word(query) == "PREPARE") {
+        return std::make_shared<const Statement>(QueryParser::parse(QueryParser::tokenize(query)));
+    }
+    std::string normalized = QueryParser::normalize(query, parameters);
+    if (normalized_query != nullptr) {
+        *normalized_query = normalized;
+    }
+    if (auto cached = statement_cache.find(normalized)) {
+        return cached;
+    }
+    auto statement = std::make_shared<const Statement>(QueryParser::parse(QueryParser::tokenize(normalized)));
+    const std::string& command = statement->command;
+    if (command == "SELECT" || command == "INSERT" || command == "UPDATE" || command == "DELETE" ||
+        command == "EXECUTE") {
+        statement_cache.insert(normalized, statement);
+    }
+    return statement;
+}
+
+std::shared_ptr<const Statement> ShardedDatabase::find_prepared_statement(const std::string& name) {
+    std::lock_guard<std::mutex> lock(prepared_mutex);
+    auto it = prepared_statements.find(name);
+    return it == prepared_statements.end() ? nullptr : it->second;
+}
+
+// Shard 0's schema without dictionaries: every shard has codes of its own,
+// so rows gathered from several shards are read as text. nullptr when there
+// is no such table.
+std::shared_ptr<const Schema> ShardedDatabase::find_schema(const std::string& table_name) {
+    {
+        std::shared_lock<std::shared_mutex> lock(schema_mutex);
+        auto it = schemas.find(table_name);
+        if (it != schemas.end()) {
+            return it->second;
+        }
+    }
+    std::vector<Column> columns;
+    try {
+        run(0, [&] {
+            Schema schema = shards[0]->db->get_schema(table_name);
+            for (const Column& column : schema.get_columns()) {
+                columns.push_back({column.name, column.type});
+            }
+        });
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+    std::unique_lock<std::shared_mutex> lock(schema_mutex);
+    auto it = schemas.emplace(table_name, std::make_shared<const Schema>(std::move(columns))).first;
+    return it->second;
+}
+
+// The shard of a single-row INSERT's key, or of a key the WHERE clause
+// requires with "key = value". False when the statement may touch several.
+bool ShardedDatabase::find_shard(const Statement& statement, const std::vector<std::string>& parameters,
+                                 size_t& shard) {
+    const std::string& command = statement.command;
+    int64_t key;
+    if (command == "INSERT") {
+        if (statement.row_count != 1) {
+            return false;
+        }
+        std::vector<std::string> values = statement.bind_values(parameters);
+        if (values.empty() || !parse_key(values[0], key)) {
+            return false;
+        }
+    } else if (command == "SELECT" || command == "UPDATE" || command == "DELETE") {
+        std::shared_ptr<const Schema> schema = find_schema(statement.table_name);
+        if (!statement.join_table.empty() || schema == nullptr) {
+            return false;
+        }
+        std::vector<const Expression*> conjuncts;
+        split_conjuncts(statement.condition.get(), conjuncts);
+        auto names_key = [&](const Expression* conjunct) {
+            return conjunct->kind == Expression::COMPARISON && conjunct->op == Expression::EQ &&
+                   conjunct->column == (*schema)[0].name && parse_key(conjunct->get_literal(parameters), key);
+        };
+        if (std::find_if(conjuncts.begin(), conjuncts.end(), names_key) == conjuncts.end()) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    shard = get_shard(key, shards.size());
+    return true;
+}
+
+std::unique_ptr<QueryCursor> ShardedDatabase::open_on(size_t shard, const std::string& query) {
+    std::unique_ptr<QueryCursor> cursor;
+    run(shard, [&] { cursor = shards[shard]->db->open_query(query); });
+    // Rows already in memory are handed out right here
+    if (dynamic_cast<BufferedCursor*>(cursor.get()) != nullptr) {
+        return cursor;
+    }
+    return std::make_unique<ShardCursor>(*this, shard, std::move(cursor));
+}
+
+// Runs the query on every shard, adding up the row counts. label_rows puts
+// a ("shard", index) row before the rows of each shard, e.g. for EXPLAIN.
+std::unique_ptr<QueryCursor> ShardedDatabase::open_everywhere(const std::string& query, bool label_rows) {
+    std::vector<BufferedCursor> results(shards.size());
+    run_everywhere([&](size_t shard) {
+        std::unique_ptr<QueryCursor> cursor = shards[shard]->db->open_query(query);
+        BufferedCursor& result = results[shard];
+        while (cursor->next([&result](const std::vector<Value>& row) { result.rows.push_back(row); }, SIZE_MAX)) {
+        }
+        result.row_count = cursor->get_row_count();
+    });
+    auto cursor = std::make_unique<BufferedCursor>();
+    for (size_t shard = 0; shard < results.size(); ++shard) {
+        if (label_rows) {
+            cursor->rows.push_back({std::string("shard"), static_cast<int64_t>(shard)});
+            cursor->row_count++;
+        }
+        for (std::vector<Value>& row : results[shard].rows) {
+            cursor->rows.push_back(std::move(row));
+        }
+        cursor->row_count += results[shard].row_count;
+    }
+    return cursor;
+}
+
+// The shards filter their rows on their executors, all at the same time
+std::unique_ptr<QueryCursor> ShardedDatabase::select_everywhere(const Statement& statement,
+                                                                const std::vector<std::string>& parameters) {
+    std::shared_ptr<const Schema> schema = find_schema(statement.table_name);
+    if (schema == nullptr) {
+        throw std::runtime_error("Table not found: " + statement.table_name);
+    }
+    PartedRows parts;
+    parts.part_count = shards.size();
+    parts.scan_all = [&](const std::function<bool(size_t, const RecordView*, size_t)>& visitor) {
+        run_everywhere([&](size_t part) {
+            shards[part]->db->scan_table(statement.table_name, statement.condition.get(), parameters,
+                                         [&visitor, part](const RecordView* rows, size_t count) {
+                return visitor(part, rows, count);
+            });
+        });
+    };
+    auto cursor = std::make_unique<BufferedCursor>();
+    cursor->row_count = Database::select_parts(statement, parameters, *schema, parts,
+                                               [&cursor](const std::vector<Value>& row) {
+        cursor->rows.push_back(row);
+    });
+    return cursor;
+}
+
+std::unique_ptr<QueryCursor> ShardedDatabase::open_query(const std::string& query) {
+    PreparedQuery prepared;
+    return open_query(query, prepared);
+}
+
+std::unique_ptr<QueryCursor> ShardedDatabase::open_query(const std::string& query, PreparedQuery& prepared) {
+    QueryArena::Scope arena_scope;
+    std::vector<std::string> parameters = std::move(prepared.parameters);
+    std::shared_ptr<const Statement> statement = std::move(prepared.statement);
+    try {
+        if (statement == nullptr) {
+            statement = prepare_statement(query, parameters);
+        }
+    } catch (const std::exception&) {
+        // Shard 0 reports the error as it would without shards
+        return open_on(0, query);
+    }
+    const std::string& command = statement->command;
+    if (parameters.size() != statement->parameter_count || command == "STATS" || command == "SHOW CACHE") {
+        return open_on(0, query);
+    }
+    if (command == "PREPARE" || command == "DEALLOCATE") {
+        std::unique_ptr<QueryCursor> cursor = open_everywhere(query, false);
+        std::lock_guard<std::mutex> lock(prepared_mutex);
+        if (command == "PREPARE") {
+            prepared_statements[statement->statement_name] = statement->prepared;
+        } else {
+            prepared_statements.erase(statement->statement_name);
+        }
+        return cursor;
+    }
+
+    // The statement that really runs, and its parameters
+    bool explain = command == "EXPLAIN" || command == "EXPLAIN ANALYZE";
+    std::shared_ptr<const Statement> target = explain ? statement->prepared : statement;
+    if (target->command == "EXECUTE") {
+        std::shared_ptr<const Statement> prepared = find_prepared_statement(target->statement_name);
+        std::vector<std::string> values = target->bind_values(parameters);
+        if (prepared == nullptr || values.size() != prepared->parameter_count) {
+            return open_on(0, query);
+        }
+        target = prepared;
+        parameters = std::move(values);
+    }
+
+    size_t shard = 0;
+    bool routed;
+    try {
+        if (target->command == "UPDATE") {
+            std::shared_ptr<const Schema> schema = find_schema(target->table_name);
+            const std::vector<std::string>& columns = target->columns;
+            if (schema != nullptr && std::find(columns.begin(), columns.end(), (*schema)[0].name) != columns.end()) {
+                Metrics::add(Metrics::QUERIES);
+                throw std::runtime_error("The primary key of a partitioned table can't be updated");
+            }
+        }
+        routed = find_shard(*target, parameters, shard);
+        if (!routed && target->command == "SELECT" && !explain) {
+            Metrics::add(Metrics::QUERIES);
+            return select_everywhere(*target, parameters);
+        }
+    } catch (const std::exception& e) {
+        Metrics::add(Metrics::QUERY_ERRORS);
+        throw std::runtime_error("Error executing query: " + std::string(e.what()));
+    }
+    return routed ? open_on(shard, query) : open_everywhere(query, explain);
+}
+
+// Read on the calling thread: the shards only take shared locks for it
+bool ShardedDatabase::get_result_key(const std::string& query, std::string& key,
+                                     std::vector<std::shared_ptr<const Table>>& tables, PreparedQuery& prepared) {
+    QueryArena::Scope arena_scope;
+    std::string normalized;
+    prepared = {};
+    try {
+        prepared.statement = prepare_statement(query, prepared.parameters, &normalized);
+    } catch (const std::exception&) {
+        prepared = {};
+        return false;
+    }
+    if (!Database::make_result_key(*prepared.statement, normalized, prepared.parameters, key)) {
+        return false;
+    }
+    tables.clear();
+    for (auto& shard : shards) {
+        if (!shard->db->find_result_tables(*prepared.statement, tables)) {
+            return false;
+        }
+    }
+    return true;
+}
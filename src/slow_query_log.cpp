@@ -0,0 +1,141 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/slow_query_log.h"
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// e.g. 2024-07-01T12:00:00.123Z
+std::string format_time(std::chrono::system_clock::time_point time) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    std::tm utc = {};
+    gmtime_r(&seconds, &utc);
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    char text[32];
+    size_t length = std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(text + length, sizeof(text) - length, ".%03dZ", static_cast<int>(milliseconds));
+    return text;
+}
+
+double to_milliseconds(std::chrono::nanoseconds duration) {
+    return static_cast<double>(duration.count()) / 1e6;
+}
+
+// Keeps every entry on one line and the query inside its quotes
+std::string quote(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default: quoted += c; break;
+        }
+    }
+    return quoted + "\"";
+}
+
+} // namespace
+
+SlowQueryLog::SlowQueryLog(const Options& options)
+        : options(options), file(options.path, std::ios::app), file_size(0), dropped(0), stopping(false) {
+    if (!file) {
+        throw std::runtime_error("Cannot open slow query log " + options.path);
+    }
+    file.seekp(0, std::ios::end);
+    file_size = static_cast<size_t>(file.tellp());
+    thread = std::thread(&SlowQueryLog::write_entries, this);
+}
+
+SlowQueryLog::~SlowQueryLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+bool SlowQueryLog::is_slow(std::chrono::nanoseconds elapsed) const {
+    return elapsed >= std::chrono::milliseconds(options.threshold_ms);
+}
+
+void SlowQueryLog::record(Entry entry) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.size() >= MAX_QUEUED_ENTRIES) {
+            dropped++;
+            return;
+        }
+        queue.push_back(std::move(entry));
+    }
+    cv.notify_one();
+}
+
+// Writes whatever is queued, outside the lock, until stopped with nothing left
+void SlowQueryLog::write_entries() {
+    std::vector<Entry> entries;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !queue.empty() || dropped > 0; });
+        if (queue.empty() && dropped == 0) {
+            return;
+        }
+        entries.swap(queue);
+        uint64_t lost = dropped;
+        dropped = 0;
+        lock.unlock();
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3);
+        for (const Entry& entry : entries) {
+            line.str("");
+            line << format_time(entry.finished_at) << " total_ms=" << to_milliseconds(entry.total)
+                 << " queue_ms=" << to_milliseconds(entry.queued) << " execute_ms=" << to_milliseconds(entry.executed)
+                 << " rows=" << entry.row_count << " bytes=" << entry.response_bytes
+                 << " status=" << (entry.failed ? "error" : "ok") << " query=" << quote(entry.query) << "\n";
+            write_line(line.str());
+        }
+        if (lost > 0) {
+            write_line(format_time(std::chrono::system_clock::now()) + " dropped=" + std::to_string(lost) +
+                       " slow queries arrived while the log was behind\n");
+        }
+        file.flush();
+        entries.clear();
+        lock.lock();
+    }
+}
+
+void SlowQueryLog::write_line(const std::string& line) {
+    if (file_size > 0 && file_size + line.size() > options.max_file_bytes) {
+        rotate();
+    }
+    file << line;
+    file_size += line.size();
+    if (!file) {
+        std::cerr << "Error writing slow query log " << options.path << std::endl;
+        file.clear();
+    }
+}
+
+void SlowQueryLog::rotate() {
+    file.close();
+    for (int i = options.max_files - 1; i >= 1; --i) {
+        std::string from = options.path + "." + std::to_string(i);
+        std::rename(from.c_str(), (options.path + "." + std::to_string(i + 1)).c_str());
+    }
+    if (options.max_files > 0) {
+        std::rename(options.path.c_str(), (options.path + ".1").c_str());
+    }
+    file.open(options.path, std::ios::trunc);
+    file_size = 0;
+}
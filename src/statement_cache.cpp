@@ -0,0 +1,43 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/statement_cache.h"
+
+StatementCache::StatementCache(size_t capacity) : capacity(capacity), hits(0), misses(0) {}
+
+std::shared_ptr<const Statement> StatementCache::find(const std::string& normalized_query) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(normalized_query);
+    if (it == lookup.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+}
+
+void StatementCache::insert(const std::string& normalized_query, std::shared_ptr<const Statement> statement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capacity == 0) {
+        return;
+    }
+    auto it = lookup.find(normalized_query);
+    if (it != lookup.end()) {
+        // Another worker parsed the same shape first
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+    entries.emplace_front(normalized_query, std::move(statement));
+    lookup[normalized_query] = entries.begin();
+    if (entries.size() > capacity) {
+        lookup.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+StatementCache::Stats StatementCache::get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {hits, misses, entries.size(), capacity};
+}
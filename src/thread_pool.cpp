@@ -0,0 +1,140 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+struct ThreadPool::Job {
+    // Tasks [begin, end) not taken yet; the owner takes from the front, thieves from the back
+    struct Run {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    Job(const std::function<void(size_t, size_t)>& task, size_t participant_count)
+            : task(task), runs(participant_count) {}
+
+    bool take(size_t participant, size_t& index) {
+        for (size_t i = 0; i < runs.size(); ++i) {
+            Run& run = runs[(participant + i) % runs.size()];
+            std::lock_guard<std::mutex> lock(run.mutex);
+            if (run.begin < run.end) {
+                index = i == 0 ? run.begin++ : --run.end;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::function<void(size_t, size_t)>& task;
+    std::vector<Run> runs;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    // Guarded by the pool mutex
+    size_t claimed = 1;
+    size_t active = 0;
+    std::condition_variable done;
+};
+
+ThreadPool::ThreadPool(size_t thread_count) : stopping(false) {
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&ThreadPool::worker_function, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::get_thread_count() const {
+    return threads.size();
+}
+
+void ThreadPool::run(size_t task_count, const std::function<void(size_t task, size_t participant)>& task) {
+    size_t participant_count = std::min(task_count, threads.size() + 1);
+    if (participant_count <= 1) {
+        for (size_t i = 0; i < task_count; ++i) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<Job>(task, participant_count);
+    for (size_t i = 0; i < participant_count; ++i) {
+        job->runs[i].begin = task_count * i / participant_count;
+        job->runs[i].end = task_count * (i + 1) / participant_count;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    cv.notify_all();
+
+    participate(*job, 0);
+    {
+        // No thread joins once the job is off the list; wait for those that did
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = std::find(jobs.begin(), jobs.end(), job);
+        if (it != jobs.end()) {
+            jobs.erase(it);
+        }
+        job->done.wait(lock, [&job] { return job->active == 0; });
+    }
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
+
+void ThreadPool::worker_function() {
+    while (true) {
+        std::shared_ptr<Job> job;
+        size_t participant;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = jobs.front();
+            participant = job->claimed++;
+            if (job->claimed == job->runs.size()) {
+                jobs.pop_front();
+            }
+            job->active++;
+        }
+        participate(*job, participant);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--job->active == 0) {
+                job->done.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::participate(Job& job, size_t participant) {
+    size_t index;
+    while (!job.failed && job.take(participant, index)) {
+        try {
+            job.task(index, participant);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.error_mutex);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+            job.failed = true;
+        }
+    }
+}
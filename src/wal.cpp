@@ -0,0 +1,267 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/wal.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Record framing: [u32 body_length][u32 crc32(body)][body]
+// Body: [u8 type][u16 name_length][name][i64 key][u32 payload_length][payload]
+constexpr size_t RECORD_HEADER_SIZE = 8;
+
+uint32_t crc32(const char* data, size_t length) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template<typename T>
+void append_value(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool read_value(const std::string& in, size_t& offset, size_t end, T& value) {
+    if (offset + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(&value, in.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+void write_all(int fd, const std::string& data) {
+    size_t total_written = 0;
+    while (total_written < data.size()) {
+        ssize_t n = write(fd, data.data() + total_written, data.size() - total_written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Error writing WAL: " + std::string(strerror(errno)));
+        }
+        total_written += n;
+    }
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path, SyncPolicy policy, int sync_interval_ms)
+        : path(path), policy(policy), sync_interval_ms(sync_interval_ms), running(true) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open WAL " + path + ": " + std::string(strerror(errno)));
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        file_size = st.st_size;
+    }
+
+    if (policy == SyncPolicy::INTERVAL) {
+        sync_thread = std::thread(&WriteAheadLog::sync_loop, this);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    running = false;
+    stop_cv.notify_all();
+    if (sync_thread.joinable()) {
+        sync_thread.join();
+    }
+    try {
+        wait_for(get_last_lsn(), policy != SyncPolicy::OFF);
+    } catch (const std::exception&) {
+        // Nothing sensible left to do; recovery stops at the last complete record
+    }
+    close(fd);
+}
+
+uint64_t WriteAheadLog::append(Record::Type type, const std::string& table_name, int64_t key,
+                               const std::string& payload) {
+    std::string body;
+    body.reserve(1 + 2 + table_name.size() + 8 + 4 + payload.size());
+    append_value<uint8_t>(body, type);
+    append_value<uint16_t>(body, static_cast<uint16_t>(table_name.size()));
+    body.append(table_name);
+    append_value<int64_t>(body, key);
+    append_value<uint32_t>(body, static_cast<uint32_t>(payload.size()));
+    body.append(payload);
+
+    uint32_t length = static_cast<uint32_t>(body.size());
+    uint32_t checksum = crc32(body.data(), body.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    append_value<uint32_t>(buffer, length);
+    append_value<uint32_t>(buffer, checksum);
+    buffer.append(body);
+    return ++last_lsn;
+}
+
+void WriteAheadLog::commit(uint64_t lsn) {
+    switch (policy) {
+        case SyncPolicy::EVERY_COMMIT:
+            wait_for(lsn, true);
+            break;
+        case SyncPolicy::OFF:
+            wait_for(lsn, false);
+            break;
+        case SyncPolicy::INTERVAL:
+            // The sync thread picks the record up within sync_interval_ms
+            break;
+    }
+}
+
+uint64_t WriteAheadLog::get_last_lsn() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last_lsn;
+}
+
+size_t WriteAheadLog::get_size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return file_size + buffer.size();
+}
+
+void WriteAheadLog::replay(const std::function<void(const Record&)>& apply) {
+    std::string contents;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        contents.resize(file_size);
+        size_t total_read = 0;
+        while (total_read < file_size) {
+            ssize_t n = pread(fd, &contents[total_read], file_size - total_read, total_read);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Error reading WAL: " + std::string(strerror(errno)));
+            }
+            if (n == 0) break;
+            total_read += n;
+        }
+        contents.resize(total_read);
+    }
+
+    // Stop at the first torn or corrupt record; everything after it was never acknowledged
+    size_t offset = 0;
+    while (offset + RECORD_HEADER_SIZE <= contents.size()) {
+        uint32_t length, checksum;
+        memcpy(&length, contents.data() + offset, sizeof(length));
+        memcpy(&checksum, contents.data() + offset + 4, sizeof(checksum));
+        size_t body = offset + RECORD_HEADER_SIZE;
+        size_t end = body + length;
+        if (end > contents.size() || crc32(contents.data() + body, length) != checksum) {
+            break;
+        }
+
+        Record record;
+        uint8_t type;
+        uint16_t name_length;
+        uint32_t payload_length;
+        size_t pos = body;
+        if (!read_value(contents, pos, end, type) || !read_value(contents, pos, end, name_length) ||
+            pos + name_length > end) {
+            break;
+        }
+        record.type = static_cast<Record::Type>(type);
+        record.table_name.assign(contents.data() + pos, name_length);
+        pos += name_length;
+        if (!read_value(contents, pos, end, record.key) || !read_value(contents, pos, end, payload_length) ||
+            pos + payload_length > end) {
+            break;
+        }
+        record.payload.assign(contents.data() + pos, payload_length);
+
+        apply(record);
+        offset = end;
+    }
+}
+
+void WriteAheadLog::truncate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flush_cv.wait(lock, [this] { return !flushing; });
+
+    buffer.clear();
+    if (ftruncate(fd, 0) < 0 || fdatasync(fd) < 0) {
+        throw std::runtime_error("Error truncating WAL: " + std::string(strerror(errno)));
+    }
+    file_size = 0;
+    written_lsn = last_lsn;
+    durable_lsn = last_lsn;
+}
+
+// Called with the lock held. The lock is dropped for the I/O so other
+// writers keep appending; whatever they append rides on the next flush.
+void WriteAheadLog::flush(std::unique_lock<std::mutex>& lock, bool sync) {
+    flushing = true;
+    std::string batch;
+    batch.swap(buffer);
+    uint64_t batch_lsn = last_lsn;
+    lock.unlock();
+
+    try {
+        write_all(fd, batch);
+        if (sync && fdatasync(fd) < 0) {
+            throw std::runtime_error("Error syncing WAL: " + std::string(strerror(errno)));
+        }
+    } catch (...) {
+        lock.lock();
+        flushing = false;
+        flush_cv.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    flushing = false;
+    file_size += batch.size();
+    written_lsn = batch_lsn;
+    if (sync) {
+        durable_lsn = batch_lsn;
+    }
+    flush_cv.notify_all();
+}
+
+// Group commit: the first waiter becomes the leader and flushes everything
+// appended so far; the others wait for it and usually find their record covered.
+void WriteAheadLog::wait_for(uint64_t lsn, bool sync) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ((sync ? durable_lsn : written_lsn) < lsn) {
+        if (flushing) {
+            flush_cv.wait(lock);
+            continue;
+        }
+        flush(lock, sync);
+    }
+}
+
+void WriteAheadLog::sync_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        stop_cv.wait_for(lock, std::chrono::milliseconds(sync_interval_ms));
+        if (!flushing && durable_lsn < last_lsn) {
+            try {
+                flush(lock, true);
+            } catch (const std::exception& e) {
+                std::cerr << "WAL sync failed, retrying: " << e.what() << std::endl;
+            }
+        }
+    }
+}
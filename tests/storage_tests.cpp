@@ -0,0 +1,222 @@
+//
+// Created by amir on 01.07.24.
+//
+
+#include "../include/btree.h"
+#include "../include/database.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #condition "\n"; \
+            ++failures;                                                                    \
+        }                                                                                  \
+    } while (false)
+
+constexpr int64_t TREE_KEYS = 20000;
+// Few enough frames that the trees below are evicted and read back as they grow
+constexpr size_t SMALL_POOL_SIZE = 16 * PAGE_SIZE;
+
+// Payload sizes vary so leaves split at different cell counts
+std::string payload_for(int64_t key) {
+    return std::string(static_cast<size_t>(key % 200 + 1), static_cast<char>('a' + key % 26));
+}
+
+// Walks the tree in order and checks it holds exactly keys, with their payloads
+void check_contents(const BTree& tree, const std::vector<int64_t>& keys) {
+    BTree::Cursor cursor(tree);
+    cursor.first();
+    size_t count = 0;
+    for (; cursor.valid(); cursor.next(), ++count) {
+        if (count >= keys.size() || cursor.key() != keys[count] ||
+            cursor.payload() != payload_for(keys[count])) {
+            break;
+        }
+    }
+    CHECK(count == keys.size());
+    CHECK(!cursor.valid());
+}
+
+void test_btree_insert_split_remove(const std::string& dir) {
+    Pager pager(dir + "/btree.db");
+    BufferPool pool(pager, SMALL_POOL_SIZE);
+    BTree tree(pool, BTree::create(pool));
+    CHECK(tree.is_empty());
+
+    std::vector<int64_t> keys(TREE_KEYS);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::vector<int64_t> shuffled = keys;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+    for (int64_t key : shuffled) {
+        CHECK(tree.insert(key, payload_for(key)));
+    }
+    std::vector<int64_t> separators;
+    tree.get_leaf_separators(separators);
+    CHECK(separators.size() > 100);
+    CHECK(std::is_sorted(separators.begin(), separators.end()));
+    check_contents(tree, keys);
+
+    // An existing key is replaced, not added
+    CHECK(!tree.insert(7, "replaced"));
+    std::string payload;
+    CHECK(tree.find(7, payload) && payload == "replaced");
+    CHECK(!tree.insert(7, payload_for(7)));
+
+    std::vector<int64_t> odd;
+    for (int64_t key : shuffled) {
+        if (key % 2 == 0) {
+            CHECK(tree.remove(key));
+        }
+    }
+    CHECK(!tree.remove(0));
+    CHECK(!tree.remove(TREE_KEYS));
+    for (int64_t key : keys) {
+        bool found = tree.find(key, payload);
+        CHECK(found == (key % 2 != 0));
+        if (found) {
+            CHECK(payload == payload_for(key));
+            odd.push_back(key);
+        }
+    }
+    check_contents(tree, odd);
+
+    for (int64_t key = 0; key < TREE_KEYS; key += 2) {
+        CHECK(tree.insert(key, payload_for(key)));
+    }
+    check_contents(tree, keys);
+}
+
+void test_btree_bulk_load(const std::string& dir) {
+    Pager pager(dir + "/bulk.db");
+    BufferPool pool(pager, SMALL_POOL_SIZE);
+    BTree tree(pool, BTree::create(pool));
+
+    // Even keys only, so inserts afterwards land inside packed leaves
+    std::vector<BTree::Entry> entries;
+    std::vector<int64_t> keys;
+    for (int64_t key = 0; key < TREE_KEYS; key += 2) {
+        entries.emplace_back(key, payload_for(key));
+        keys.push_back(key);
+    }
+    tree.bulk_load(entries);
+    check_contents(tree, keys);
+
+    for (int64_t key = 1; key < TREE_KEYS; key += 2) {
+        CHECK(tree.insert(key, payload_for(key)));
+    }
+    keys.resize(TREE_KEYS);
+    std::iota(keys.begin(), keys.end(), 0);
+    check_contents(tree, keys);
+}
+
+std::string query_value(Database& db, const std::string& query) {
+    std::vector<std::vector<std::string>> rows = db.execute_query(query);
+    return rows.size() == 1 && rows[0].size() == 1 ? rows[0][0] : "";
+}
+
+std::string insert_rows(int64_t first, int64_t last) {
+    std::string query = "INSERT INTO items VALUES ";
+    for (int64_t id = first; id < last; ++id) {
+        query += (id > first ? ", (" : "(") + std::to_string(id) + ", 'item" + std::to_string(id) + "', " +
+                 std::to_string(id % 10) + ")";
+    }
+    return query;
+}
+
+// Runs work in a child process that then exits without any destructor, so
+// nothing gets a chance to checkpoint: as if the server had been killed
+bool run_and_crash(const std::function<void()>& work) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        try {
+            work();
+        } catch (const std::exception& e) {
+            std::cerr << "Child failed: " << e.what() << std::endl;
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void check_recovered(Database& db) {
+    CHECK(query_value(db, "SELECT COUNT(*) FROM items") == "2500");
+    CHECK(query_value(db, "SELECT COUNT(*) FROM items WHERE qty = 7 AND id < 500") == "500");
+    CHECK(query_value(db, "SELECT COUNT(*) FROM items WHERE id >= 1500 AND id < 2000") == "0");
+    CHECK(query_value(db, "SELECT name FROM items WHERE id = 2999") == "item2999");
+    CHECK(query_value(db, "SELECT qty FROM items WHERE id = 1234") == "4");
+}
+
+// Writes after the last checkpoint exist only in the WAL, while some of the
+// pages they dirtied were already evicted into the file. Reopening has to
+// roll the file back to the checkpoint and replay the log over it.
+void test_recovery_after_crash(const std::string& dir) {
+    DatabaseConfig config;
+    config.data_file = dir + "/crash.db";
+    config.buffer_pool_size = SMALL_POOL_SIZE;
+    config.scan_threads = 0;
+
+    bool crashed = run_and_crash([&config] {
+        auto* db = new Database(config);
+        db->execute_query("CREATE TABLE items (id INTEGER, name TEXT, qty INTEGER)");
+        db->execute_query(insert_rows(0, 1000));
+        db->execute_query(insert_rows(1000, 2000));
+        db->execute_query("SAVE");
+        db->execute_query("UPDATE items SET qty = 7 WHERE id < 500");
+        db->execute_query("DELETE FROM items WHERE id >= 1500");
+        db->execute_query(insert_rows(2000, 3000));
+    });
+    CHECK(crashed);
+    CHECK(std::filesystem::file_size(config.data_file + "-wal") > 0);
+
+    {
+        Database db(config);
+        check_recovered(db);
+    }
+    // The recovered state was checkpointed on close and reopens as it was
+    Database db(config);
+    check_recovered(db);
+}
+
+} // namespace
+
+int main() {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+                                ("sqlite_storage_tests_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+
+    const std::pair<const char*, void (*)(const std::string&)> tests[] = {
+            {"btree_insert_split_remove", test_btree_insert_split_remove},
+            {"btree_bulk_load", test_btree_bulk_load},
+            {"recovery_after_crash", test_recovery_after_crash},
+    };
+    for (const auto& test : tests) {
+        int before = failures;
+        try {
+            test.second(dir.string());
+        } catch (const std::exception& e) {
+            std::cerr << test.first << ": " << e.what() << std::endl;
+            ++failures;
+        }
+        std::cout << (failures == before ? "PASS " : "FAIL ") << test.first << std::endl;
+    }
+
+    std::filesystem::remove_all(dir);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}